@@ -0,0 +1,574 @@
+#include "CppLog.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+using namespace std;
+
+using namespace CppLog;
+
+typedef boost::chrono::steady_clock BenchClock;
+
+// counts how many times a log argument was really evaluated
+boost::atomic<long> g_nEvaluated(0);
+
+int Expensive(int n)
+{
+	g_nEvaluated.fetch_add(1, boost::memory_order_relaxed);
+	return n;
+}
+
+// what LOG_CMD used to do before the level check: lock first, then test the level
+void LegacyDisabledLoop(long nCalls)
+{
+	for(long i = 0; i < nCalls; i++)
+	{
+		boost::lock_guard<LogMutex> lock(Log::Instance().GetMutex());
+		if(Log::Instance().GetLogLevel() <= LOG_LEVEL_DEBUG)
+		{
+			Expensive(i);
+		}
+	}
+}
+
+void DisabledLoop(long nCalls)
+{
+	for(long i = 0; i < nCalls; i++)
+	{
+		LOG_DEBUG("disabled message " << Expensive(i));
+	}
+}
+
+// GetLogTime() as it was before the cached formatter
+string LegacyGetLogTime()
+{
+	time_t ttNow;
+	tm tmNow;
+	std::stringstream stime;
+	ttNow = time(NULL);
+	localtime_r(&ttNow, &tmNow);
+	stime << std::setfill('0') << std::setw(4) << tmNow.tm_year+1900 << "/";
+	stime << std::setfill('0') << std::setw(2) << tmNow.tm_mon+1 << "/";
+	stime << std::setfill('0') << std::setw(2) << tmNow.tm_mday << " ";
+	stime << std::setfill('0') << std::setw(2) << tmNow.tm_hour << ":";
+	stime << std::setfill('0') << std::setw(2) << tmNow.tm_min << ":";
+	stime << std::setfill('0') << std::setw(2) << tmNow.tm_sec;
+	return stime.str();
+}
+
+void BenchTime(long nCalls)
+{
+	size_t nTotalLen = 0; // keeps the results alive
+	BenchClock::time_point tStart = BenchClock::now();
+	for(long i = 0; i < nCalls; i++)
+	{
+		nTotalLen += LegacyGetLogTime().size();
+	}
+	double dLegacy = boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count();
+	cout << "timestamp legacy GetLogTime: ns/call=" << dLegacy / nCalls << endl;
+
+	tStart = BenchClock::now();
+	for(long i = 0; i < nCalls; i++)
+	{
+		nTotalLen += GetLogTime().size();
+	}
+	double dUncached = boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count();
+	cout << "timestamp GetLogTime (uncached): ns/call=" << dUncached / nCalls << endl;
+
+	const char* sPrecision[] = {"second", "milli", "micro", "nano"};
+	TimeFormatter formatter;
+	string sBuf;
+	for(int p = TIME_PRECISION_SECOND; p <= TIME_PRECISION_NANO; p++)
+	{
+		tStart = BenchClock::now();
+		for(long i = 0; i < nCalls; i++)
+		{
+			sBuf.clear();
+			formatter.Append(sBuf, GetCurrentLogTime(), static_cast<TIME_PRECISION>(p));
+			nTotalLen += sBuf.size();
+		}
+		double dCached = boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count();
+		cout << "timestamp TimeFormatter " << sPrecision[p] << ": ns/call=" << dCached / nCalls
+			<< " speedup=" << dLegacy / dCached << "x" << endl;
+	}
+	if(nTotalLen == 0)
+	{
+		cout << endl;
+	}
+}
+
+// time spent by the logging thread per message, formatting on the caller versus capturing for the writer thread
+double CallerLoop(long nCalls)
+{
+	BenchClock::time_point tStart = BenchClock::now();
+	for(long i = 0; i < nCalls; i++)
+	{
+		LOG_INFO("order " << i << " filled, px=" << 101.25 + i << " qty=" << 300 << " side=" << "buy" << " account=" << (i & 0xff));
+	}
+	return boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count() / nCalls;
+}
+
+void BenchCaller(long nCalls)
+{
+	QueuedFileAppenderPtr qfa = QueuedFileAppender::Create();
+	qfa->SetDir("bench_log");
+	qfa->SetPrefixName("bench");
+	qfa->SetCompress(false);
+	Log::Instance().AddAppender(qfa);
+	Log::Instance().SetLogLevel(LOG_LEVEL_ALL);
+
+	Log::Instance().SetDeferredFormat(false);
+	double dEager = CallerLoop(nCalls);
+	cout << "caller eager format: ns/msg=" << dEager << endl;
+	Log::Instance().SetDeferredFormat(true);
+	double dDeferred = CallerLoop(nCalls);
+	cout << "caller deferred format: ns/msg=" << dDeferred << " saved=" << 100 * (1 - dDeferred / dEager) << "%" << endl;
+}
+
+// text lines against binary records (SetBinaryOutput) through a synchronous appender
+void BenchBinaryOutput(long nCalls)
+{
+	Log::Instance().SetDeferredFormat(false);
+	for(int nBinary = 0; nBinary < 2; nBinary++)
+	{
+		string sPrefix = nBinary ? "bench_bin" : "bench_text";
+		double dNanos = 0;
+		{
+			FileAppenderPtr fa = FileAppender::Create();
+			fa->SetDir("bench_log");
+			fa->SetPrefixName(sPrefix);
+			fa->SetCompress(false);
+			fa->SetBinaryOutput(nBinary != 0);
+			Log::Instance().AddAppender(fa);
+			dNanos = CallerLoop(nCalls);
+			Log::Instance().ClearAppenders();
+		}
+		unsigned long long nBytes = 0;
+		for(boost::filesystem::directory_iterator it("bench_log"); it != boost::filesystem::directory_iterator(); ++it)
+		{
+			if(it->path().filename().string().compare(0, sPrefix.size(), sPrefix) == 0)
+			{
+				nBytes += boost::filesystem::file_size(it->path());
+				boost::filesystem::remove(it->path());
+			}
+		}
+		cout << "file appender " << (nBinary ? "binary" : "text") << " output: ns/msg=" << dNanos
+			<< " bytes/line=" << (double)nBytes / nCalls << endl;
+	}
+}
+
+double KvLoop(long nCalls)
+{
+	BenchClock::time_point tStart = BenchClock::now();
+	for(long i = 0; i < nCalls; i++)
+	{
+		LOG_INFO_KV("order filled", "id", i, "px", 101.25 + i, "qty", 300, "side", "buy", "account", (i & 0xff));
+	}
+	return boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count() / nCalls;
+}
+
+// structured messages as text lines against json lines, and the escaping of a plain string
+void BenchJsonOutput(long nCalls)
+{
+	Log::Instance().SetDeferredFormat(false);
+	for(int nJson = 0; nJson < 2; nJson++)
+	{
+		FileAppenderPtr fa = FileAppender::Create();
+		fa->SetDir("bench_log");
+		fa->SetPrefixName("bench_kv");
+		fa->SetCompress(false);
+		fa->SetJsonOutput(nJson != 0);
+		Log::Instance().AddAppender(fa);
+		cout << "file appender LOG_INFO_KV " << (nJson ? "json" : "text") << " output: ns/msg=" << KvLoop(nCalls) << endl;
+		Log::Instance().ClearAppenders();
+	}
+
+	string sText(1024, 'x');
+	string sBuf;
+	BenchClock::time_point tStart = BenchClock::now();
+	for(long i = 0; i < nCalls; i++)
+	{
+		sBuf.clear();
+		AppendJsonString(sBuf, sText.data(), sText.size());
+	}
+	double dNanos = boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count();
+	cout << "json escape 1KB plain: ns/call=" << dNanos / nCalls << " GB/s=" << (double)nCalls * sText.size() / dNanos << endl;
+}
+
+// synchronous appender, every line is written through before Write returns
+void BenchFileAppender(long nCalls)
+{
+	FileAppenderPtr fa = FileAppender::Create();
+	fa->SetDir("bench_log");
+	fa->SetPrefixName("bench_sync");
+	fa->SetCompress(false);
+	string sLine = "2024/01/01 00:00:00 - INFO - order filled, px=101.25 qty=300 side=buy [ BenchCppLog.cpp : 1 ]\n";
+	BenchClock::time_point tStart = BenchClock::now();
+	for(long i = 0; i < nCalls; i++)
+	{
+		fa->Write(sLine);
+	}
+	double dNanos = boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count();
+	cout << "file appender write: ns/line=" << dNanos / nCalls << " lines/s=" << nCalls / (dNanos / 1e9) << endl;
+}
+
+#ifndef WIN32
+// same lines through the mapped file, no syscall per line
+void BenchMmapFileAppender(long nCalls)
+{
+	double dNanos = 0;
+	{
+		MmapFileAppenderPtr ma = MmapFileAppender::Create();
+		ma->SetDir("bench_log");
+		ma->SetPrefixName("bench_mmap");
+		ma->SetCompress(false);
+		string sLine = "2024/01/01 00:00:00 - INFO - order filled, px=101.25 qty=300 side=buy [ BenchCppLog.cpp : 1 ]\n";
+		BenchClock::time_point tStart = BenchClock::now();
+		for(long i = 0; i < nCalls; i++)
+		{
+			ma->Write(sLine);
+		}
+		dNanos = boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count();
+	}
+	cout << "mmap file appender write: ns/line=" << dNanos / nCalls << " lines/s=" << nCalls / (dNanos / 1e9) << endl;
+}
+
+// a rotated log file of realistic lines
+void WriteBenchLog(const string& sPath, long nLines)
+{
+	ofstream out(sPath.c_str());
+	string sLine;
+	TimeFormatter formatter;
+	LogTime tmLog = GetCurrentLogTime();
+	for(long i = 0; i < nLines; i++)
+	{
+		sLine.clear();
+		tmLog.m_nNanoSec = (i * 7919) % 1000000000;
+		formatter.Append(sLine, tmLog, TIME_PRECISION_MICRO);
+		sLine.append(" - INFO - order ");
+		AppendInt(sLine, i);
+		sLine.append(" filled, px=");
+		AppendDouble(sLine, 101.25 + (i % 977) * 0.25);
+		sLine.append(" qty=");
+		AppendInt(sLine, 100 * (i % 13));
+		sLine.append(" side=buy account=");
+		AppendInt(sLine, i & 0xff);
+		sLine.append(" [ BenchCppLog.cpp : 1 ]\n");
+		out << sLine;
+	}
+}
+
+// in process gzip against the gzip command on the same rotated file
+void BenchGzip(long nLines)
+{
+	boost::filesystem::create_directory("bench_log");
+	const string sLog = "bench_log/bench_gzip.log";
+	WriteBenchLog(sLog, nLines);
+	double dMB = boost::filesystem::file_size(sLog) / 1e6;
+
+	BenchClock::time_point tStart = BenchClock::now();
+	bool bOk = GzipFile(sLog, sLog + ".gz");
+	double dSecs = boost::chrono::duration<double>(BenchClock::now() - tStart).count();
+	double dRatio = bOk ? dMB * 1e6 / boost::filesystem::file_size(sLog + ".gz") : 0;
+	cout << "gzip in process: MB=" << dMB << " MB/s=" << dMB / dSecs << " ratio=" << dRatio << endl;
+
+	unsigned nThreads = boost::thread::hardware_concurrency();
+	nThreads = (nThreads > 1) ? nThreads : 2;
+	tStart = BenchClock::now();
+	bOk = ParallelGzipFile(sLog, sLog + ".gz", nThreads);
+	dSecs = boost::chrono::duration<double>(BenchClock::now() - tStart).count();
+	dRatio = bOk ? dMB * 1e6 / boost::filesystem::file_size(sLog + ".gz") : 0;
+	cout << "gzip parallel: threads=" << nThreads << " MB=" << dMB << " MB/s=" << dMB / dSecs << " ratio=" << dRatio << endl;
+
+	tStart = BenchClock::now();
+	int nRet = system(("gzip -6 -c " + sLog + " > " + sLog + ".cmd.gz").c_str());
+	dSecs = boost::chrono::duration<double>(BenchClock::now() - tStart).count();
+	if(nRet == 0)
+	{
+		dRatio = dMB * 1e6 / boost::filesystem::file_size(sLog + ".cmd.gz");
+		cout << "gzip command: MB=" << dMB << " MB/s=" << dMB / dSecs << " ratio=" << dRatio << endl;
+	}
+	boost::filesystem::remove(sLog);
+	boost::filesystem::remove(sLog + ".gz");
+	boost::filesystem::remove(sLog + ".cmd.gz");
+}
+#endif
+
+// a backlog of days compressed by one thread, then by one per core
+void BenchCompressionPool(long nLinesPerFile)
+{
+	const int c_nFiles = 8;
+	unsigned nCores = boost::thread::hardware_concurrency();
+	FileManager files;
+	files.SetDir("bench_log");
+	files.SetPrefixName("backlog");
+	for(unsigned nThreads = 1; ; nThreads = (nCores > 1 ? nCores : 2))
+	{
+		for(int i = 0; i < c_nFiles; i++)
+		{
+			WriteBenchLog(files.GetDir() + "backlog_2000010" + char('1' + i) + ".log", nLinesPerFile);
+		}
+		CompressionPool pool;
+		pool.SetThreads(nThreads);
+		pool.SetNice(10);
+		BenchClock::time_point tStart = BenchClock::now();
+		for(int i = 0; i < c_nFiles; i++)
+		{
+			pool.Submit(files, string("backlog_2000010") + char('1' + i));
+		}
+		pool.WaitIdle();
+		double dSecs = boost::chrono::duration<double>(BenchClock::now() - tStart).count();
+		cout << "compression pool: threads=" << nThreads << " files=" << c_nFiles << " compressed=" << pool.GetCompressed()
+			<< " secs=" << dSecs << endl;
+		for(int i = 0; i < c_nFiles; i++)
+		{
+			boost::filesystem::remove(files.GetDir() + "backlog_2000010" + char('1' + i) + ".log.gz");
+		}
+		if(nThreads > 1)
+		{
+			break;
+		}
+	}
+}
+
+#ifndef WIN32
+// bytes that reach the disk, plain text against the compressed output mode
+void BenchCompressedOutput(long nCalls)
+{
+	for(int nCompressed = 0; nCompressed < 2; nCompressed++)
+	{
+		string sPrefix = nCompressed ? "bench_gz" : "bench_plain";
+		double dSecs = 0;
+		{
+			FileAppenderPtr fa = FileAppender::Create();
+			fa->SetDir("bench_log");
+			fa->SetPrefixName(sPrefix);
+			fa->SetCompress(false);
+			fa->SetCompressedOutput(nCompressed != 0);
+			string sLine;
+			TimeFormatter formatter;
+			BenchClock::time_point tStart = BenchClock::now();
+			for(long i = 0; i < nCalls; i++)
+			{
+				sLine.clear();
+				formatter.Append(sLine, GetCurrentLogTime(), TIME_PRECISION_MICRO);
+				sLine.append(" - INFO - order ");
+				AppendInt(sLine, i);
+				sLine.append(" filled, px=101.25 qty=300 side=buy [ BenchCppLog.cpp : 1 ]\n");
+				fa->Write(sLine);
+			}
+			dSecs = boost::chrono::duration<double>(BenchClock::now() - tStart).count();
+		}
+		unsigned long long nBytes = 0;
+		for(boost::filesystem::directory_iterator it("bench_log"); it != boost::filesystem::directory_iterator(); ++it)
+		{
+			if(it->path().filename().string().compare(0, sPrefix.size(), sPrefix) == 0)
+			{
+				nBytes += boost::filesystem::file_size(it->path());
+				boost::filesystem::remove(it->path());
+			}
+		}
+		cout << "file appender " << (nCompressed ? "compressed" : "plain") << " output: lines/s=" << nCalls / dSecs
+			<< " bytes/line=" << (double)nBytes / nCalls << endl;
+	}
+}
+// the queued writer thread on the plain writev path against the asynchronous writes (SetAsyncWrites), timed
+// until every byte is in the kernel
+void BenchAsyncWrites(long nCalls)
+{
+	string sLine = "2024/01/01 00:00:00 - INFO - order filled, px=101.25 qty=300 side=buy [ BenchCppLog.cpp : 1 ]\n";
+	unsigned long long nExpected = (unsigned long long)sLine.size() * nCalls;
+	for(unsigned nInFlight = 0; nInFlight <= 8; nInFlight = nInFlight ? nInFlight * 4 : 2)
+	{
+		double dSecs = 0;
+		AsyncWriteStats stats;
+		memset(&stats, 0, sizeof(stats)); // the writev run has none
+		{
+			QueuedFileAppenderPtr qfa = QueuedFileAppender::Create();
+			qfa->SetDir("bench_log");
+			qfa->SetPrefixName("bench_async");
+			qfa->SetCompress(false);
+			qfa->SetAsyncWrites(nInFlight);
+			BenchClock::time_point tStart = BenchClock::now();
+			for(long i = 0; i < nCalls; i++)
+			{
+				qfa->Write(sLine);
+			}
+			if(nInFlight)
+			{
+				while(qfa->GetAsyncWriteStats().m_nBytes < nExpected)
+				{
+					boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+				}
+				stats = qfa->GetAsyncWriteStats();
+			}
+			else
+			{
+				qfa.reset(); // the queue is drained in the destructor
+			}
+			dSecs = boost::chrono::duration<double>(BenchClock::now() - tStart).count();
+		}
+		boost::filesystem::remove_all("bench_log");
+		cout << "queued " << (nInFlight == 0 ? "writev" : (stats.m_bUring ? "io_uring" : "pwritev")) << " writes";
+		if(nInFlight)
+		{
+			cout << " in flight=" << nInFlight;
+		}
+		cout << ": MB/s=" << nExpected / dSecs / 1e6;
+		if(nInFlight)
+		{
+			cout << " writes=" << stats.m_nWrites << " mean depth=" << (double)stats.m_nInFlightSum / stats.m_nWrites
+				<< " max depth=" << stats.m_nMaxInFlight;
+		}
+		cout << endl;
+	}
+}
+#endif
+
+void QueuedLoop(long nCalls)
+{
+	for(long i = 0; i < nCalls; i++)
+	{
+		LOG_INFO("queued message " << i);
+	}
+}
+
+double RunThreads(int nThreads, long nCalls, void (*loop)(long));
+void Report(const char* sName, int nThreads, long nCalls, double dNanos);
+
+// producers push into their own rings, throughput should grow with the thread count up to the core count.
+// the queue is bounded, the rings take its capacity in batches and do not share a counter per record
+void BenchProducers(int nMaxThreads, long nCalls)
+{
+	Log::Instance().ClearAppenders();
+	QueuedFileAppenderPtr qfa = QueuedFileAppender::Create();
+	qfa->SetDir("bench_log");
+	qfa->SetPrefixName("bench_producers");
+	qfa->SetCompress(false);
+	qfa->SetQueueCapacity(65536, 16 * 1024 * 1024);
+	Log::Instance().AddAppender(qfa);
+	for(int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2)
+	{
+		Report("queued LOG_INFO", nThreads, nCalls, RunThreads(nThreads, nCalls, QueuedLoop));
+	}
+	Log::Instance().ClearAppenders();
+}
+
+// the rings against the double buffer, both formatting on the calling thread
+void BenchQueueTypes(int nMaxThreads, long nCalls)
+{
+	Log::Instance().SetDeferredFormat(false);
+	for(int nType = 0; nType < 2; nType++)
+	{
+		Log::Instance().ClearAppenders();
+		QueuedFileAppenderPtr qfa = QueuedFileAppender::Create(nType ? QUEUE_DOUBLE_BUFFER : QUEUE_RINGS);
+		qfa->SetDir("bench_log");
+		qfa->SetPrefixName("bench_queue");
+		qfa->SetCompress(false);
+		Log::Instance().AddAppender(qfa);
+		for(int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2)
+		{
+			Report(nType ? "double buffer LOG_INFO" : "rings eager LOG_INFO", nThreads, nCalls, RunThreads(nThreads, nCalls, QueuedLoop));
+		}
+	}
+	Log::Instance().ClearAppenders();
+}
+
+// an appender that drops everything, what is left is the dispatch
+class NullAppender : public Appender
+{
+public:
+	using Appender::Write;
+	void Write(const std::string&) {}
+	void Write(const LogRecordPtr&) {}
+};
+
+// the appender list is read without a lock, the threads should not serialize on the dispatch
+void BenchDispatch(int nMaxThreads, long nCalls)
+{
+	Log::Instance().ClearAppenders();
+	Log::Instance().AddAppender(AppenderPtr(new NullAppender()));
+	for(int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2)
+	{
+		Report("dispatch LOG_INFO", nThreads, nCalls, RunThreads(nThreads, nCalls, QueuedLoop));
+	}
+	Log::Instance().ClearAppenders();
+}
+
+// the only appender takes ERROR and above: LOG_INFO is not formatted at all, against the same appender taking it
+void BenchAppenderLevels(long nCalls)
+{
+	Log::Instance().ClearAppenders();
+	Log::Instance().SetLogLevel(LOG_LEVEL_ALL);
+	Log::Instance().SetDeferredFormat(false);
+	AppenderPtr appender(new NullAppender());
+	Log::Instance().AddAppender(appender);
+	double dWanted = CallerLoop(nCalls);
+	appender->SetLevel(LOG_LEVEL_ERROR);
+	double dUnwanted = CallerLoop(nCalls);
+	cout << "appender levels: wanted ns/msg=" << dWanted << " unwanted ns/msg=" << dUnwanted << endl;
+	Log::Instance().ClearAppenders();
+}
+
+double RunThreads(int nThreads, long nCalls, void (*loop)(long))
+{
+	boost::thread_group threads;
+	BenchClock::time_point tStart = BenchClock::now();
+	for(int i = 0; i < nThreads; i++)
+	{
+		threads.create_thread(boost::bind(loop, nCalls));
+	}
+	threads.join_all();
+	return boost::chrono::duration<double, boost::nano>(BenchClock::now() - tStart).count();
+}
+
+void Report(const char* sName, int nThreads, long nCalls, double dNanos)
+{
+	// wall time spread over the cores that actually ran the threads
+	unsigned nCores = boost::thread::hardware_concurrency();
+	if(nCores == 0 || nCores > (unsigned)nThreads)
+	{
+		nCores = nThreads;
+	}
+	double dTotalCalls = (double)nThreads * nCalls;
+	cout << sName << ": threads=" << nThreads << " calls=" << dTotalCalls
+		<< " ns/call=" << dNanos * nCores / dTotalCalls
+		<< " calls/s=" << dTotalCalls / (dNanos / 1e9) << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int nThreads = (argc > 1) ? atoi(argv[1]) : 32;
+	long nCalls = (argc > 2) ? atol(argv[2]) : 1000000;
+
+	Log::Instance().SetLogLevel(LOG_LEVEL_INFO); // LOG_DEBUG is disabled
+
+	Report("disabled LOG_DEBUG", nThreads, nCalls, RunThreads(nThreads, nCalls, DisabledLoop));
+	// the mutex version is far slower, run fewer calls
+	Report("lock then check (old LOG_CMD)", nThreads, nCalls / 10, RunThreads(nThreads, nCalls / 10, LegacyDisabledLoop));
+
+	cout << "arguments evaluated: " << g_nEvaluated.load() << endl;
+
+	BenchTime(nCalls);
+
+	bool bOk = (g_nEvaluated.load() == 0);
+	BenchFileAppender(nCalls / 5);
+#ifndef WIN32
+	BenchMmapFileAppender(nCalls / 5);
+	BenchGzip(nCalls);
+	BenchCompressedOutput(nCalls / 5);
+	BenchAsyncWrites(nCalls);
+#endif
+	BenchCompressionPool(nCalls / 4);
+	BenchBinaryOutput(nCalls / 5);
+	BenchJsonOutput(nCalls / 5);
+	BenchCaller(nCalls / 5);
+	BenchProducers(nThreads, nCalls / 10);
+	BenchQueueTypes(nThreads, nCalls / 10);
+	BenchDispatch(nThreads, nCalls / 10);
+	BenchAppenderLevels(nCalls / 5);
+	return bOk ? 0 : 1;
+}
@@ -0,0 +1,1028 @@
+#include "CppLog.h"
+#include <iostream>
+#include <cstdlib>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+using namespace std;
+
+using namespace CppLog;
+
+// cpplog-check: checks what the library does against what it should do, the file formats give back what went in.
+// every check runs, the exit code is 1 if one of them failed
+
+const string c_sDir = "check_log";
+
+bool ReadFile(const string& sPath, string& sText)
+{
+	ifstream in(sPath.c_str(), ios_base::binary);
+	if(!in)
+	{
+		return false;
+	}
+	ostringstream out;
+	out << in.rdbuf();
+	sText = out.str();
+	return true;
+}
+
+bool WriteFile(const string& sPath, const string& sText)
+{
+	ofstream out(sPath.c_str(), ios_base::binary);
+	out << sText;
+	return out.good();
+}
+
+bool Report(const string& sCheck, bool bOk)
+{
+	cout << (bOk ? "ok      " : "FAILED  ") << sCheck << endl;
+	return bOk;
+}
+
+// lines of mixed length, the last one may be cut short
+string MakeText(size_t nSize)
+{
+	string sText;
+	for(unsigned n = 0; sText.size() < nSize; n++)
+	{
+		sText += "line " + boost::lexical_cast<string>(n) + " " + string(n * 2654435761u % 97, char('a' + n % 26)) + "\n";
+	}
+	sText.resize(nSize);
+	return sText;
+}
+
+// keeps the messages, rendered the way the writer thread would
+class MessageAppender : public Appender
+{
+public:
+	explicit MessageAppender(bool bDeferred) : m_bDeferred(bDeferred) {}
+	using Appender::Write;
+	void Write(const std::string&) {}
+	void Write(const LogRecordPtr& record)
+	{
+		string sMessage;
+		record->RenderMessage(sMessage);
+		m_vMessages.push_back(sMessage);
+	}
+	bool AcceptsDeferred() const { return m_bDeferred; }
+	vector<string> m_vMessages;
+private:
+	bool m_bDeferred;
+};
+
+// the messages against a std::ostringstream fed the same values, formatted inline, deferred and after a manipulator
+bool CheckStreamFormat()
+{
+	const unsigned char* pUnsigned = reinterpret_cast<const unsigned char*>("unsigned");
+	signed char* pSigned = const_cast<signed char*>(reinterpret_cast<const signed char*>("signed"));
+	vector<string> vExpected;
+	{
+		ostringstream os;
+		os << true << " " << false << " " << pUnsigned << " " << pSigned << " " << 'c' << " " << -12 << " " << 2.5;
+		vExpected.push_back(os.str());
+	}
+	{
+		ostringstream os;
+		os << std::boolalpha << true << " " << false << " " << pUnsigned << " " << pSigned << std::hex << " " << 255;
+		vExpected.push_back(os.str());
+	}
+	bool bAllOk = true;
+	for(int nDeferred = 0; nDeferred < 2; nDeferred++)
+	{
+		boost::shared_ptr<MessageAppender> appender(new MessageAppender(nDeferred != 0));
+		Log::Instance().SetDeferredFormat(nDeferred != 0);
+		Log::Instance().AddAppender(appender);
+		LOG_INFO(true << " " << false << " " << pUnsigned << " " << pSigned << " " << 'c' << " " << -12 << " " << 2.5);
+		LOG_INFO(std::boolalpha << true << " " << false << " " << pUnsigned << " " << pSigned << std::hex << " " << 255);
+		Log::Instance().ClearAppenders();
+		bAllOk = Report(nDeferred ? "stream format: deferred" : "stream format: inline", appender->m_vMessages == vExpected) && bAllOk;
+	}
+	Log::Instance().SetDeferredFormat(false);
+	return bAllOk;
+}
+
+int g_nEvaluated = 0;
+
+int Evaluated()
+{
+	return ++g_nEvaluated;
+}
+
+// a message per level, the appenders get the ones at or above their own level
+void LogLevels()
+{
+	LOG_DEBUG("debug");
+	LOG_INFO("info");
+	LOG_WARN("warn");
+	LOG_ERROR("error");
+	LOG_FATAL("fatal");
+}
+
+// the levels IsEnabled lets through, as "DIWEF" with '-' for the ones it does not
+string EnabledLevels()
+{
+	string sLevels;
+	for(int nLevel = LOG_LEVEL_DEBUG; nLevel < LOG_LEVEL_ALL; nLevel++)
+	{
+		sLevels.push_back(Log::Instance().IsEnabled(LOG_LEVEL(nLevel)) ? "DIWEF"[nLevel] : '-');
+	}
+	return sLevels;
+}
+
+// every appender gets the messages at or above its own level, and IsEnabled follows the lowest of them (and the
+// log level) through every change, so a message no appender wants is not even evaluated
+bool CheckAppenderLevels()
+{
+	Log& log = Log::Instance();
+	boost::shared_ptr<MessageAppender> warn(new MessageAppender(false));
+	boost::shared_ptr<MessageAppender> all(new MessageAppender(false));
+	warn->SetLevel(LOG_LEVEL_WARN);
+	log.AddAppender(warn);
+	log.AddAppender(all);
+	LogLevels();
+	const char* vWarn[] = {"warn", "error", "fatal"};
+	const char* vAll[] = {"debug", "info", "warn", "error", "fatal"};
+	bool bOk = warn->m_vMessages == vector<string>(vWarn, vWarn + 3) && all->m_vMessages == vector<string>(vAll, vAll + 5);
+	bool bAllOk = Report("appender levels: messages", bOk);
+
+	bOk = EnabledLevels() == "DIWEF";
+	all->SetLevel(LOG_LEVEL_ERROR);
+	bOk = EnabledLevels() == "--WEF" && bOk;
+	log.RemoveAppender(warn);
+	bOk = EnabledLevels() == "---EF" && bOk;
+	all->SetLevel(LOG_LEVEL_DEBUG);
+	bOk = EnabledLevels() == "DIWEF" && bOk;
+	log.SetLogLevel(LOG_LEVEL_WARN);
+	bOk = EnabledLevels() == "--WEF" && bOk;
+	log.SetLogLevel(LOG_LEVEL_ALL);
+	all->SetLevel(LOG_LEVEL_FATAL);
+	LOG_ERROR("not evaluated " << Evaluated());
+	LOG_FATAL("evaluated " << Evaluated());
+	bOk = g_nEvaluated == 1 && bOk;
+	log.ClearAppenders();
+	bOk = EnabledLevels() == "-----" && bOk;
+	bAllOk = Report("appender levels: IsEnabled", bOk) && bAllOk;
+	return bAllOk;
+}
+
+// json escaping one byte at a time, what AppendJsonString must give with or without SSE2
+string JsonEscape(const string& sText)
+{
+	string sOut;
+	for(size_t i = 0; i < sText.size(); i++)
+	{
+		unsigned char c = static_cast<unsigned char>(sText[i]);
+		const char* pShort = (c == '"') ? "\\\"" : (c == '\\') ? "\\\\" : (c == '\n') ? "\\n" : (c == '\r') ? "\\r"
+			: (c == '\t') ? "\\t" : (c == '\b') ? "\\b" : (c == '\f') ? "\\f" : 0;
+		if(pShort)
+		{
+			sOut += pShort;
+		}
+		else if(c < 0x20)
+		{
+			char szEscape[8];
+			snprintf(szEscape, sizeof(szEscape), "\\u%04x", c);
+			sOut += szEscape;
+		}
+		else
+		{
+			sOut.push_back(char(c));
+		}
+	}
+	return sOut;
+}
+
+// AppendJsonString against JsonEscape, for every length and start up to a few 16 byte blocks (the SSE2 blocks and
+// the tail after them), on text with control characters, quotes, backslashes and utf-8, which passes as it is
+bool CheckJsonEscape()
+{
+	const string vSamples[] = {
+		"plain text, nothing to escape in it at all, in more than one block",
+		string("\0\x01\x02\x1f\x20\x7f\"\\\n\r\t\b\f", 13),
+		"\xe4\xb8\xad\xe6\x96\x87 caf\xc3\xa9 \xf0\x9f\x98\x80 \"quoted\" \\path\\ \xff\xfe\x80",
+		"0123456789abcde\"0123456789abcde\\0123456789abcde\n0123456789abcdef\x1f"
+	};
+	bool bOk = true;
+	unsigned nRandom = 12345;
+	string sRandom;
+	for(int i = 0; i < 4096; i++)
+	{
+		nRandom = nRandom * 1103515245 + 12345;
+		unsigned n = (nRandom >> 16) & 0xff;
+		sRandom.push_back(char(n % 4 == 0 ? n % 0x20 : n % 4 == 1 ? "\"\\ab"[(n >> 2) % 4] : n));
+	}
+	for(size_t s = 0; s < sizeof(vSamples) / sizeof(vSamples[0]) + 1; s++)
+	{
+		const string& sSample = (s < sizeof(vSamples) / sizeof(vSamples[0])) ? vSamples[s] : sRandom;
+		for(size_t nBegin = 0; nBegin < 17 && nBegin < sSample.size(); nBegin++)
+		{
+			for(size_t nLen = 0; nBegin + nLen <= sSample.size() && nLen <= 70; nLen++)
+			{
+				string sOut = "prefix";
+				AppendJsonString(sOut, sSample.data() + nBegin, nLen);
+				bOk = sOut == "prefix" + JsonEscape(sSample.substr(nBegin, nLen)) && bOk;
+			}
+		}
+		string sOut;
+		AppendJsonString(sOut, sSample.data(), sSample.size());
+		bOk = sOut == JsonEscape(sSample) && bOk;
+	}
+	string sOut;
+	AppendJsonString(sOut, vSamples[1].data(), vSamples[1].size());
+	bOk = sOut == "\\u0000\\u0001\\u0002\\u001f \x7f\\\"\\\\\\n\\r\\t\\b\\f" && bOk;
+	return Report("json escaping", bOk);
+}
+
+#ifndef WIN32
+// ParallelGzipFile through the gzip command: empty, a byte, around the chunk size and around a full ring of chunks
+bool CheckParallelGzip()
+{
+	const size_t nChunk = 1024 * 1024;
+	const size_t vSizes[] = {0, 1, nChunk - 1, nChunk, nChunk + 1, 2 * nChunk, 4 * nChunk + 1, 6 * nChunk + 12345};
+	const unsigned vThreads[] = {1, 2, 3};
+	const string sSrc = c_sDir + "/gzip_src.log";
+	const string sOut = c_sDir + "/gzip_out.log";
+	bool bAllOk = true;
+	for(size_t i = 0; i < sizeof(vSizes) / sizeof(vSizes[0]); i++)
+	{
+		string sText = MakeText(vSizes[i]);
+		WriteFile(sSrc, sText);
+		for(size_t t = 0; t < sizeof(vThreads) / sizeof(vThreads[0]); t++)
+		{
+			boost::filesystem::remove(sSrc + ".gz");
+			bool bOk = ParallelGzipFile(sSrc, sSrc + ".gz", vThreads[t]);
+			bOk = bOk && system(("gzip -dc " + sSrc + ".gz > " + sOut).c_str()) == 0;
+			string sBack;
+			bOk = bOk && ReadFile(sOut, sBack) && sBack == sText;
+			bAllOk = Report("parallel gzip: bytes=" + boost::lexical_cast<string>(vSizes[i])
+				+ " threads=" + boost::lexical_cast<string>(vThreads[t]), bOk) && bAllOk;
+		}
+	}
+	return bAllOk;
+}
+
+// nMilli after tStart, may be negative
+LogTime MilliTime(time_t tStart, long nMilli)
+{
+	long nSec = (nMilli >= 0) ? nMilli / 1000 : -((999 - nMilli) / 1000);
+	LogTime tmLog;
+	tmLog.m_nSec = tStart + nSec;
+	tmLog.m_nNanoSec = (nMilli - nSec * 1000) * 1000000;
+	return tmLog;
+}
+
+bool TimeLess(const LogTime& a, const LogTime& b)
+{
+	return a.m_nSec < b.m_nSec || (a.m_nSec == b.m_nSec && a.m_nNanoSec < b.m_nNanoSec);
+}
+
+// "YYYY/MM/DD HH:MM:SS.mmm"
+string FormatLineTime(const LogTime& tmLog)
+{
+	tm _tm;
+	localtime_r(&tmLog.m_nSec, &_tm);
+	char szTime[64];
+	snprintf(szTime, sizeof(szTime), "%04d/%02d/%02d %02d:%02d:%02d.%03ld", _tm.tm_year + 1900, _tm.tm_mon + 1,
+		_tm.tm_mday, _tm.tm_hour, _tm.tm_min, _tm.tm_sec, tmLog.m_nNanoSec / 1000000);
+	return szTime;
+}
+
+// ReadRange against a scan of every line. every 7th line is 30ms late, as the lines of several threads are,
+// and the blocks are small so the late lines also cross into the next block
+bool CheckReadRange()
+{
+	const string sPath = c_sDir + "/range.log.gz";
+	const time_t tStart = 1700000000;
+	vector<string> vLines;
+	vector<LogTime> vTimes;
+	BlockLogWriter writer;
+	writer.SetBlockSize(4096);
+	bool bOk = writer.Open(sPath);
+	for(int i = 0; i < 5000; i++)
+	{
+		LogTime tmLine = MilliTime(tStart, i * 10 - (i % 7 == 0 ? 30 : 0));
+		string sLine = FormatLineTime(tmLine) + " INFO message " + boost::lexical_cast<string>(i) + "\n";
+		writer.Write(sLine.data(), sLine.size());
+		vLines.push_back(sLine);
+		vTimes.push_back(tmLine);
+	}
+	bOk = writer.Close() && bOk;
+
+	BlockLogReader reader;
+	bOk = bOk && reader.Open(sPath) && reader.GetBlocks().size() > 10;
+	const long vRanges[][2] = {{0, 50000}, {0, 1}, {990, 1000}, {1000, 1030}, {12345, 23456}, {20000, 20010}, {49970, 60000}, {-1000, 5}};
+	for(size_t r = 0; bOk && r < sizeof(vRanges) / sizeof(vRanges[0]); r++)
+	{
+		LogTime tmBegin = MilliTime(tStart, vRanges[r][0]);
+		LogTime tmEnd = MilliTime(tStart, vRanges[r][1]);
+		string sExpected;
+		for(size_t i = 0; i < vLines.size(); i++)
+		{
+			if(!TimeLess(vTimes[i], tmBegin) && TimeLess(vTimes[i], tmEnd))
+			{
+				sExpected += vLines[i];
+			}
+		}
+		ostringstream out;
+		bOk = reader.ReadRange(tmBegin, tmEnd, out) && out.str() == sExpected;
+	}
+	return Report("read range: blocks=" + boost::lexical_cast<string>(reader.GetBlocks().size()), bOk);
+}
+
+// the lines every level and call site would write, through the appenders already added
+void LogEverything()
+{
+	for(int i = 0; i < 2000; i++)
+	{
+		LOG_DEBUG("debug " << i);
+		LOG_INFO("info " << i << " " << 1.5 * i << " " << string(i % 300, 'x'));
+		LOG_WARN("");
+		LOG_ERROR("tab\tquote\"backslash\\ " << i);
+		LOG_FATAL("fatal " << -i);
+		LOG_INFO_KV("order", "id", i, "px", 101.25, "side", "buy");
+	}
+}
+
+// the binary records decoded by BinaryLogDecoder against the text lines of the same records
+bool CheckBinaryDecode()
+{
+	bool bAllOk = true;
+	for(int nPrecision = TIME_PRECISION_SECOND; nPrecision <= TIME_PRECISION_NANO; nPrecision++)
+	{
+		string sTextPath, sBinPath;
+		Log::Instance().SetTimePrecision(TIME_PRECISION(nPrecision));
+		{
+			FileAppenderPtr text = FileAppender::Create();
+			text->SetDir(c_sDir);
+			text->SetPrefixName("decode_text");
+			text->SetCompress(false);
+			FileAppenderPtr bin = FileAppender::Create();
+			bin->SetDir(c_sDir);
+			bin->SetPrefixName("decode_bin");
+			bin->SetCompress(false);
+			bin->SetBinaryOutput(true);
+			Log::Instance().AddAppender(text);
+			Log::Instance().AddAppender(bin);
+			LogEverything();
+			Log::Instance().ClearAppenders();
+			sTextPath = text->SynthesizeTodyFileName();
+			sBinPath = bin->SynthesizeTodyFileName();
+			sBinPath.insert(sBinPath.size() - 4, ".bin");
+		}
+		string sText;
+		ostringstream decoded;
+		BinaryLogDecoder decoder;
+		bool bOk = ReadFile(sTextPath, sText) && decoder.DecodeFile(sBinPath, decoded) && decoded.str() == sText;
+		bAllOk = Report("binary decode: precision=" + boost::lexical_cast<string>(nPrecision), bOk) && bAllOk;
+		boost::filesystem::remove(sTextPath);
+		boost::filesystem::remove(sBinPath);
+	}
+	Log::Instance().SetTimePrecision(TIME_PRECISION_SECOND);
+	return bAllOk;
+}
+
+// the asynchronous writes against the plain ones, for the same records, directly and through a queued appender
+bool CheckAsyncWrites()
+{
+	bool bAllOk = true;
+	for(int nQueued = 0; nQueued < 2; nQueued++)
+	{
+		string sPlainPath, sAsyncPath;
+		{
+			FileAppenderPtr plain = FileAppender::Create();
+			plain->SetDir(c_sDir);
+			plain->SetPrefixName("async_plain");
+			plain->SetCompress(false);
+			FileAppenderPtr async = nQueued ? FileAppenderPtr(QueuedFileAppender::Create()) : FileAppender::Create();
+			async->SetDir(c_sDir);
+			async->SetPrefixName("async_async");
+			async->SetCompress(false);
+			async->SetAsyncWrites(4, 4096); // small buffers, many of them in flight
+			Log::Instance().AddAppender(plain);
+			Log::Instance().AddAppender(async);
+			LogEverything();
+			Log::Instance().ClearAppenders();
+			sPlainPath = plain->SynthesizeTodyFileName();
+			sAsyncPath = async->SynthesizeTodyFileName();
+		}
+		string sPlain, sAsync;
+		bool bOk = ReadFile(sPlainPath, sPlain) && ReadFile(sAsyncPath, sAsync) && !sPlain.empty() && sAsync == sPlain;
+		bAllOk = Report(nQueued ? "async writes: queued appender" : "async writes: file appender", bOk) && bAllOk;
+		boost::filesystem::remove(sPlainPath);
+		boost::filesystem::remove(sAsyncPath);
+	}
+	return bAllOk;
+}
+
+// record n of thread t, for the queue checks
+LogRecordPtr QueueRecord(unsigned t, unsigned n)
+{
+	string sText = boost::lexical_cast<string>(t) + " " + boost::lexical_cast<string>(n) + " " + string(n % 50, 'q') + "\n";
+	return LogRecord::Create(sText);
+}
+
+// per thread, the records must come in the order they were pushed, from nFirst on and without a gap
+bool InThreadOrder(const vector<LogRecordPtr>& vRecords, unsigned nThreads, unsigned nFirst, unsigned nCount)
+{
+	vector<unsigned> vNext(nThreads, nFirst);
+	for(size_t i = 0; i < vRecords.size(); i++)
+	{
+		unsigned t = 0, n = 0;
+		if(sscanf(vRecords[i]->GetText().c_str(), "%u %u", &t, &n) != 2 || t >= nThreads || n != vNext[t])
+		{
+			return false;
+		}
+		vNext[t]++;
+	}
+	for(unsigned t = 0; t < nThreads; t++)
+	{
+		if(vNext[t] != nFirst + nCount)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PushQueued(SafeQueue& queue, unsigned t, unsigned n)
+{
+	return queue.PushMsg(QueueRecord(t, n));
+}
+
+bool PushQueued(DoubleBufferQueue& queue, unsigned t, unsigned n)
+{
+	return queue.Push(QueueRecord(t, n)->GetText(), LOG_LEVEL_INFO);
+}
+
+template<class Q> void PushRecords(Q* pQueue, unsigned t, unsigned nCount, boost::atomic<unsigned>* pPushed)
+{
+	for(unsigned n = 0; n < nCount; n++)
+	{
+		if(PushQueued(*pQueue, t, n))
+		{
+			pPushed->fetch_add(1);
+		}
+	}
+}
+
+// nRounds times, nThreads threads that push nCount records each and exit
+void PushFromShortThreads(SafeQueue* pQueue, unsigned nRounds, unsigned nThreads, unsigned nCount, boost::atomic<unsigned>* pPushed)
+{
+	for(unsigned r = 0; r < nRounds; r++)
+	{
+		boost::thread_group threads;
+		for(unsigned t = 0; t < nThreads; t++)
+		{
+			threads.create_thread(boost::bind(PushRecords<SafeQueue>, pQueue, t, nCount, pPushed));
+		}
+		threads.join_all();
+	}
+}
+
+// SafeQueue under its overflow policies: a full queue drops the newest records, or the oldest ones of the thread,
+// or makes the producers wait until every record got through. the capacity is small enough to be counted record
+// by record, or big enough for the rings to take it in batches, which must not let more in
+bool CheckOverflow()
+{
+	bool bAllOk = true;
+	const unsigned vCapacity[] = {100, 6400};
+	for(size_t c = 0; c < sizeof(vCapacity) / sizeof(vCapacity[0]); c++)
+	{
+		const unsigned nCap = vCapacity[c];
+		const string sCap = " capacity=" + boost::lexical_cast<string>(nCap);
+		{
+			SafeQueue queue;
+			queue.SetCapacity(nCap, 0);
+			queue.SetOverflowPolicy(OVERFLOW_DROP_NEWEST);
+			unsigned nPushed = 0;
+			for(unsigned n = 0; n < nCap + 50; n++)
+			{
+				nPushed += queue.PushMsg(QueueRecord(0, n)) ? 1 : 0;
+			}
+			vector<LogRecordPtr> vRecords;
+			queue.PopAll(vRecords);
+			queue.PopAll(vRecords); // the ring is idle now, its credit goes back
+			bool bOk = nPushed == nCap && queue.TakeDropped() == 50 && InThreadOrder(vRecords, 1, 0, nCap) && queue.GetDepth() == 0;
+			bAllOk = Report("overflow: drop newest" + sCap, bOk) && bAllOk;
+		}
+		{
+			SafeQueue queue;
+			queue.SetCapacity(nCap, 0);
+			queue.SetOverflowPolicy(OVERFLOW_DROP_OLDEST);
+			for(unsigned n = 0; n < nCap + 50; n++)
+			{
+				queue.PushMsg(QueueRecord(0, n));
+			}
+			vector<LogRecordPtr> vRecords;
+			queue.PopAll(vRecords);
+			queue.PopAll(vRecords);
+			bool bOk = queue.TakeDropped() == 50 && InThreadOrder(vRecords, 1, 50, nCap) && queue.GetDepth() == 0;
+			bAllOk = Report("overflow: drop oldest" + sCap, bOk) && bAllOk;
+		}
+		{
+			// the bytes bound, a record that does not fit in what is left is dropped
+			const size_t nMaxBytes = nCap * 40;
+			SafeQueue queue;
+			queue.SetCapacity(0, nMaxBytes);
+			queue.SetOverflowPolicy(OVERFLOW_DROP_NEWEST);
+			for(unsigned n = 0; n < nCap * 2; n++)
+			{
+				queue.PushMsg(QueueRecord(0, n));
+			}
+			vector<LogRecordPtr> vRecords;
+			queue.PopAll(vRecords);
+			size_t nBytes = 0;
+			for(size_t i = 0; i < vRecords.size(); i++)
+			{
+				nBytes += vRecords[i]->GetText().size();
+			}
+			bool bOk = nBytes <= nMaxBytes && nBytes + 64 > nMaxBytes;
+			bAllOk = Report("overflow: drop newest bytes" + sCap, bOk) && bAllOk;
+		}
+		{
+			// several threads, no consumer. each ring may keep some credit it did not use, at most 64 records
+			const unsigned nThreads = 4;
+			SafeQueue queue;
+			queue.SetCapacity(nCap, 0);
+			queue.SetOverflowPolicy(OVERFLOW_DROP_NEWEST);
+			boost::atomic<unsigned> nPushed(0);
+			boost::thread_group threads;
+			for(unsigned t = 0; t < nThreads; t++)
+			{
+				threads.create_thread(boost::bind(PushRecords<SafeQueue>, &queue, t, nCap, &nPushed));
+			}
+			threads.join_all();
+			vector<LogRecordPtr> vRecords;
+			queue.PopAll(vRecords);
+			bool bOk = nPushed <= nCap && nPushed + nThreads * 64 >= nCap && vRecords.size() == nPushed
+				&& queue.TakeDropped() == nThreads * nCap - nPushed && queue.GetDepth() == 0;
+			bAllOk = Report("overflow: drop newest threads=4" + sCap, bOk) && bAllOk;
+		}
+		{
+			const unsigned nThreads = 4;
+			const unsigned nCount = 20000;
+			SafeQueue queue;
+			queue.SetCapacity(nCap, 0);
+			queue.SetOverflowPolicy(OVERFLOW_BLOCK);
+			boost::atomic<unsigned> nPushed(0);
+			boost::thread_group threads;
+			for(unsigned t = 0; t < nThreads; t++)
+			{
+				threads.create_thread(boost::bind(PushRecords<SafeQueue>, &queue, t, nCount, &nPushed));
+			}
+			vector<LogRecordPtr> vRecords;
+			while(vRecords.size() < nThreads * nCount)
+			{
+				queue.WaitForWork(10);
+				queue.PopAll(vRecords);
+			}
+			threads.join_all();
+			queue.PopAll(vRecords);
+			bool bOk = nPushed == nThreads * nCount && queue.TakeDropped() == 0 && InThreadOrder(vRecords, nThreads, 0, nCount)
+				&& queue.GetDepth() == 0;
+			bAllOk = Report("overflow: block threads=4" + sCap, bOk) && bAllOk;
+		}
+	}
+	return bAllOk;
+}
+
+// a file appender that cannot open its file counts what it was given as lost, and writes nothing
+bool CheckLostWrites()
+{
+	WriteFile(c_sDir + "/not_a_dir", "");
+	FileAppenderPtr appender = FileAppender::Create();
+	appender->SetDir(c_sDir + "/not_a_dir");
+	appender->SetPrefixName("lost");
+	appender->SetCompress(false);
+	TelemetryStats before = GetTelemetryStats();
+	for(int i = 0; i < 1000; i++)
+	{
+		appender->Write("lost line\n");
+	}
+	TelemetryStats after = GetTelemetryStats();
+	bool bOk = after.m_nBytesLost - before.m_nBytesLost == 10000 && after.m_nBytesWritten == before.m_nBytesWritten;
+	return Report("lost writes", bOk);
+}
+
+// a file whose path cannot even be checked (the name is too long) does not take the worker thread down,
+// the pool goes idle and the next file is still compressed
+bool CheckCompressionErrors()
+{
+	FileManager files;
+	files.SetDir(c_sDir);
+	WriteFile(c_sDir + "/pool.log", MakeText(10000));
+	CompressionPool pool;
+	pool.Submit(files, string(300, 'a'));
+	pool.WaitIdle();
+	pool.Submit(files, "pool");
+	pool.WaitIdle();
+	bool bOk = pool.GetCompressed() == 1 && boost::filesystem::exists(c_sDir + "/pool.log.gz");
+	boost::filesystem::remove(c_sDir + "/pool.log.gz");
+	return Report("compression pool: errors", bOk);
+}
+
+// threads that push a few records and exit while the consumer drains: the records of the closed rings go into
+// the same merge, so every batch comes out in time order, and nothing is lost
+bool CheckClosedRings()
+{
+	const unsigned nRounds = 300;
+	const unsigned nThreads = 4;
+	const unsigned nCount = 20;
+	SafeQueue queue;
+	boost::atomic<unsigned> nPushed(0);
+	boost::thread producers(boost::bind(PushFromShortThreads, &queue, nRounds, nThreads, nCount, &nPushed));
+	bool bOk = true;
+	size_t nPopped = 0;
+	vector<LogRecordPtr> vRecords;
+	bool bDone = false;
+	while(!bDone)
+	{
+		bDone = producers.timed_join(boost::posix_time::milliseconds(0));
+		vRecords.clear();
+		queue.PopAll(vRecords);
+		for(size_t i = 1; i < vRecords.size(); i++)
+		{
+			bOk = !TimeLess(vRecords[i]->GetTime(), vRecords[i - 1]->GetTime()) && bOk;
+		}
+		nPopped += vRecords.size();
+	}
+	vRecords.clear();
+	queue.PopAll(vRecords);
+	nPopped += vRecords.size();
+	bOk = bOk && nPopped == nPushed && nPushed == nRounds * nThreads * nCount;
+	return Report("closed rings: time order", bOk);
+}
+
+template<class Q> void TimeWait(Q* pQueue, unsigned nMaxWaitMs, long* pWaitedMs)
+{
+	boost::posix_time::ptime tStart = boost::posix_time::microsec_clock::universal_time();
+	pQueue->WaitForWork(nMaxWaitMs);
+	*pWaitedMs = (boost::posix_time::microsec_clock::universal_time() - tStart).total_milliseconds();
+}
+
+// how long the consumer waited, at most nMaxWaitMs, while nRecords were pushed. bAlways wakes it after that
+template<class Q> long WaitWhilePushing(Q& queue, unsigned nRecords, unsigned nMaxWaitMs, bool bAlways = false)
+{
+	long nWaitedMs = 0;
+	boost::thread consumer(boost::bind(TimeWait<Q>, &queue, nMaxWaitMs, &nWaitedMs));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50)); // parked by then
+	for(unsigned n = 0; n < nRecords; n++)
+	{
+		PushQueued(queue, 0, n);
+	}
+	if(bAlways)
+	{
+		queue.Wake(true);
+	}
+	consumer.join();
+	return nWaitedMs;
+}
+
+// the consumer is woken once the threshold of records or bytes is queued, and not long before: the credit a ring
+// takes ahead is at most a 16th of it. otherwise it waits until its deadline, unless it is woken on purpose
+template<class Q> bool CheckWakeThreshold(const string& sQueue)
+{
+	const unsigned nThreshold = 160;
+	const size_t nNever = 1 << 30;
+	unsigned nBelowBytes = 0;
+	size_t nBytes = 0;
+	for(unsigned n = 0; n < nThreshold; n++)
+	{
+		nBytes += QueueRecord(0, n)->GetText().size();
+	}
+	for(size_t nPushed = 0; nPushed + QueueRecord(0, nBelowBytes)->GetText().size() < nBytes - nBytes / 16; nBelowBytes++)
+	{
+		nPushed += QueueRecord(0, nBelowBytes)->GetText().size();
+	}
+	bool bAllOk = true;
+	{
+		Q queue;
+		queue.SetWakeThreshold(nThreshold, nNever);
+		bAllOk = Report("wake up: " + sQueue + " below the records", WaitWhilePushing(queue, nThreshold - nThreshold / 16 - 1, 300) >= 250) && bAllOk;
+	}
+	{
+		Q queue;
+		queue.SetWakeThreshold(nThreshold, nNever);
+		bAllOk = Report("wake up: " + sQueue + " at the records", WaitWhilePushing(queue, nThreshold, 5000) < 1000) && bAllOk;
+	}
+	{
+		Q queue;
+		queue.SetWakeThreshold(nNever, nBytes);
+		bAllOk = Report("wake up: " + sQueue + " below the bytes", WaitWhilePushing(queue, nBelowBytes, 300) >= 250) && bAllOk;
+	}
+	{
+		Q queue;
+		queue.SetWakeThreshold(nNever, nBytes);
+		bAllOk = Report("wake up: " + sQueue + " at the bytes", WaitWhilePushing(queue, nThreshold, 5000) < 1000) && bAllOk;
+	}
+	{
+		Q queue;
+		queue.SetWakeThreshold(nThreshold, nNever);
+		bAllOk = Report("wake up: " + sQueue + " on purpose", WaitWhilePushing(queue, 1, 5000, true) < 1000) && bAllOk;
+	}
+	return bAllOk;
+}
+
+// the lines of a swap as records, false if an end does not close a line
+bool SplitLines(const string& sLines, const vector<size_t>& vEnds, vector<LogRecordPtr>& vRecords)
+{
+	size_t nBegin = 0;
+	for(size_t i = 0; i < vEnds.size(); i++)
+	{
+		if(vEnds[i] <= nBegin || vEnds[i] > sLines.size() || sLines[vEnds[i] - 1] != '\n')
+		{
+			return false;
+		}
+		string sLine = sLines.substr(nBegin, vEnds[i] - nBegin);
+		vRecords.push_back(LogRecord::Create(sLine));
+		nBegin = vEnds[i];
+	}
+	return nBegin == sLines.size();
+}
+
+void PushFromThreads(DoubleBufferQueue* pQueue, unsigned nThreads, unsigned nCount, boost::atomic<unsigned>* pPushed)
+{
+	boost::thread_group threads;
+	for(unsigned t = 0; t < nThreads; t++)
+	{
+		threads.create_thread(boost::bind(PushRecords<DoubleBufferQueue>, pQueue, t, nCount, pPushed));
+	}
+	threads.join_all();
+}
+
+void LogLines(unsigned t, unsigned nCount)
+{
+	for(unsigned n = 0; n < nCount; n++)
+	{
+		LOG_INFO(t << " " << n);
+	}
+}
+
+// QUEUE_DOUBLE_BUFFER: the lines of every thread come out whole, in order and all of them. from the queue itself,
+// with a capacity small enough to make the producers wait or to drop lines, and through a queued appender
+bool CheckDoubleBuffer()
+{
+	const unsigned nThreads = 4;
+	const unsigned nCount = 20000;
+	bool bAllOk = true;
+	{
+		DoubleBufferQueue queue;
+		queue.SetCapacity(100, 0);
+		boost::atomic<unsigned> nPushed(0);
+		boost::thread producers(boost::bind(PushFromThreads, &queue, nThreads, nCount, &nPushed));
+		vector<LogRecordPtr> vRecords;
+		bool bOk = true;
+		for(bool bDone = false; !bDone; )
+		{
+			bDone = producers.timed_join(boost::posix_time::milliseconds(0));
+			queue.WaitForWork(10);
+			string sLines;
+			vector<size_t> vEnds;
+			queue.Swap(sLines, vEnds);
+			bOk = SplitLines(sLines, vEnds, vRecords) && bOk;
+		}
+		bOk = bOk && queue.TakeDropped() == 0 && InThreadOrder(vRecords, nThreads, 0, nCount) && queue.GetDepth() == 0;
+		bAllOk = Report("double buffer: block threads=4", bOk) && bAllOk;
+	}
+	{
+		DoubleBufferQueue queue;
+		queue.SetCapacity(100, 0);
+		queue.SetOverflowPolicy(OVERFLOW_DROP_NEWEST);
+		for(unsigned n = 0; n < 150; n++)
+		{
+			PushQueued(queue, 0, n);
+		}
+		string sLines;
+		vector<size_t> vEnds;
+		vector<LogRecordPtr> vRecords;
+		queue.Swap(sLines, vEnds);
+		bool bOk = SplitLines(sLines, vEnds, vRecords) && queue.TakeDropped() == 50 && InThreadOrder(vRecords, 1, 0, 100);
+		bAllOk = Report("double buffer: drop newest", bOk) && bAllOk;
+	}
+	{
+		string sPath;
+		{
+			QueuedFileAppenderPtr appender = QueuedFileAppender::Create(QUEUE_DOUBLE_BUFFER);
+			appender->SetDir(c_sDir);
+			appender->SetPrefixName("double_buffer");
+			appender->SetCompress(false);
+			Log::Instance().AddAppender(appender);
+			boost::thread_group threads;
+			for(unsigned t = 0; t < nThreads; t++)
+			{
+				threads.create_thread(boost::bind(LogLines, t, nCount));
+			}
+			threads.join_all();
+			Log::Instance().ClearAppenders();
+			sPath = appender->SynthesizeTodyFileName();
+		}
+		// the message of every line, after the level
+		string sText;
+		vector<LogRecordPtr> vRecords;
+		bool bOk = ReadFile(sPath, sText);
+		for(size_t nBegin = 0; bOk && nBegin < sText.size(); )
+		{
+			size_t nEnd = sText.find('\n', nBegin);
+			size_t nMsg = sText.find(" - INFO - ", nBegin);
+			bOk = nEnd != string::npos && nMsg < nEnd;
+			if(bOk)
+			{
+				string sMessage = sText.substr(nMsg + 10, nEnd - nMsg - 10);
+				vRecords.push_back(LogRecord::Create(sMessage));
+				nBegin = nEnd + 1;
+			}
+		}
+		bOk = bOk && InThreadOrder(vRecords, nThreads, 0, nCount);
+		bAllOk = Report("double buffer: queued appender threads=4", bOk) && bAllOk;
+		boost::filesystem::remove(sPath);
+	}
+	return bAllOk;
+}
+
+unsigned long long HistogramCount(const unsigned long long* pBuckets)
+{
+	unsigned long long nCount = 0;
+	for(int i = 0; i < c_nTelemetryBuckets; i++)
+	{
+		nCount += pBuckets[i];
+	}
+	return nCount;
+}
+
+// GetTelemetryStats against what was logged and what is in the file, as differences from before. the messages
+// come from a thread that exits before the stats are taken, its counts must stay. the queue is small and drops
+bool CheckTelemetry()
+{
+	const unsigned nCount = 1000;
+	TelemetryStats before = GetTelemetryStats();
+	string sPath;
+	{
+		QueuedFileAppenderPtr appender = QueuedFileAppender::Create();
+		appender->SetDir(c_sDir);
+		appender->SetPrefixName("telemetry");
+		appender->SetCompress(false);
+		appender->SetQueueCapacity(10, 0);
+		appender->SetOverflowPolicy(OVERFLOW_DROP_NEWEST);
+		Log::Instance().AddAppender(appender);
+		boost::thread logger(boost::bind(LogLines, 0, nCount));
+		logger.join();
+		LOG_ERROR("error");
+		LOG_ERROR("error");
+		Log::Instance().ClearAppenders();
+		sPath = appender->SynthesizeTodyFileName();
+	}
+	TelemetryStats after = GetTelemetryStats();
+
+	// the lines that got through, and the drop reports written after them
+	string sText;
+	bool bOk = ReadFile(sPath, sText);
+	unsigned long long nLines = 0;
+	unsigned long long nDropped = 0;
+	for(size_t nBegin = 0; nBegin < sText.size(); )
+	{
+		size_t nEnd = sText.find('\n', nBegin);
+		string sLine = sText.substr(nBegin, nEnd - nBegin);
+		if(sLine.find("messages dropped, the queue was full") != string::npos)
+		{
+			nDropped += strtoull(sLine.c_str() + sLine.find(" - WARN - ") + 10, 0, 10);
+		}
+		else
+		{
+			nLines++;
+		}
+		nBegin = (nEnd == string::npos) ? sText.size() : nEnd + 1;
+	}
+	bOk = bOk && after.m_nMessages[LOG_LEVEL_INFO] - before.m_nMessages[LOG_LEVEL_INFO] == nCount
+		&& after.m_nMessages[LOG_LEVEL_ERROR] - before.m_nMessages[LOG_LEVEL_ERROR] == 2
+		&& after.m_nMessages[LOG_LEVEL_DEBUG] == before.m_nMessages[LOG_LEVEL_DEBUG]
+		&& after.m_nBytesWritten - before.m_nBytesWritten == sText.size()
+		&& after.m_nBytesLost == before.m_nBytesLost
+		&& nDropped > 0 && nLines + nDropped == nCount + 2 && after.m_nDropped - before.m_nDropped == nDropped
+		&& after.m_nQueueDepth == 0
+		&& after.m_nOpens - before.m_nOpens == 1 && after.m_nCloses - before.m_nCloses == 1;
+	bOk = Report("telemetry: counters", bOk);
+
+	// a batch is counted in the histogram once it has records, the sync timer on every pass. one enqueue in 16 of
+	// every thread is timed, the thread that logged started at the first one, this one is somewhere
+	unsigned long long nBatches = HistogramCount(after.m_BatchSize) - HistogramCount(before.m_BatchSize);
+	unsigned long long nSyncs = after.m_Sync.m_nCount - before.m_Sync.m_nCount;
+	unsigned long long nTimed = HistogramCount(after.m_EnqueueLatencyNs) - HistogramCount(before.m_EnqueueLatencyNs);
+	bool bHistogramsOk = nBatches > 0 && nBatches <= nSyncs && after.m_Sync.m_nTotalNs > before.m_Sync.m_nTotalNs
+		&& nTimed >= (nCount + 15) / 16 && nTimed <= (nCount + 15) / 16 + 2 && after.m_nMaxQueueDepth > 0;
+	bOk = Report("telemetry: histograms and timers", bHistogramsOk) && bOk;
+
+	string sJson;
+	FormatTelemetryStats(after, sJson);
+	bool bJsonOk = sJson.find("\"bytes_written\":" + boost::lexical_cast<string>(after.m_nBytesWritten)) != string::npos
+		&& sJson.find("\"dropped\":" + boost::lexical_cast<string>(after.m_nDropped)) != string::npos
+		&& sJson.find("\"ERROR\":" + boost::lexical_cast<string>(after.m_nMessages[LOG_LEVEL_ERROR])) != string::npos
+		&& sJson[0] == '{' && sJson.substr(sJson.size() - 2) == "}\n";
+	bOk = Report("telemetry: json", bJsonOk) && bOk;
+	boost::filesystem::remove(sPath);
+	return bOk;
+}
+
+void WriteMmapLines(MmapFileAppender* pAppender, unsigned t, unsigned nCount)
+{
+	for(unsigned n = 0; n < nCount; n++)
+	{
+		pAppender->Write(QueueRecord(t, n)->GetText());
+	}
+}
+
+// the lines of sText as records, false if it does not end with a whole line or has a zero byte
+bool SplitText(const string& sText, vector<LogRecordPtr>& vRecords)
+{
+	vector<size_t> vEnds;
+	for(size_t i = 0; i < sText.size(); i++)
+	{
+		if(sText[i] == '\n')
+		{
+			vEnds.push_back(i + 1);
+		}
+	}
+	return sText.find('\0') == string::npos && SplitLines(sText, vEnds, vRecords);
+}
+
+// MmapFileAppender: threads that reserve their lines in the same window at once, with windows of a page so that
+// many lines fall across the end of one, give every line whole and in order and nothing else. a file left with
+// zeros after its lines, as by a crash, is cut after them at the next open and written on from there
+bool CheckMmapFile()
+{
+	const unsigned nThreads = 4;
+	const unsigned nCount = 20000;
+	bool bAllOk = true;
+	{
+		string sPath;
+		{
+			MmapFileAppenderPtr appender = MmapFileAppender::Create();
+			appender->SetDir(c_sDir);
+			appender->SetPrefixName("mmap");
+			appender->SetCompress(false);
+			appender->SetWindowSize(4096);
+			boost::thread_group threads;
+			for(unsigned t = 0; t < nThreads; t++)
+			{
+				threads.create_thread(boost::bind(WriteMmapLines, appender.get(), t, nCount));
+			}
+			threads.join_all();
+			sPath = appender->SynthesizeTodyFileName();
+		}
+		string sText;
+		vector<LogRecordPtr> vRecords;
+		bool bOk = ReadFile(sPath, sText) && SplitText(sText, vRecords) && InThreadOrder(vRecords, nThreads, 0, nCount);
+		bAllOk = Report("mmap file: concurrent writers threads=4", bOk) && bAllOk;
+		boost::filesystem::remove(sPath);
+	}
+	{
+		MmapFileAppenderPtr appender = MmapFileAppender::Create();
+		appender->SetDir(c_sDir);
+		appender->SetPrefixName("mmap_crash");
+		appender->SetCompress(false);
+		string sPath = appender->SynthesizeTodyFileName();
+		WriteFile(sPath, QueueRecord(0, 0)->GetText() + QueueRecord(0, 1)->GetText() + string(10000, '\0'));
+		WriteMmapLines(appender.get(), 1, 3);
+		appender.reset();
+		string sText;
+		vector<LogRecordPtr> vRecords;
+		bool bOk = ReadFile(sPath, sText) && SplitText(sText, vRecords) && vRecords.size() == 5
+			&& sText == QueueRecord(0, 0)->GetText() + QueueRecord(0, 1)->GetText() + QueueRecord(1, 0)->GetText()
+				+ QueueRecord(1, 1)->GetText() + QueueRecord(1, 2)->GetText();
+		bAllOk = Report("mmap file: zeros after a crash", bOk) && bAllOk;
+		boost::filesystem::remove(sPath);
+	}
+	return bAllOk;
+}
+#endif
+
+int main()
+{
+	boost::filesystem::remove_all(c_sDir);
+	boost::filesystem::create_directory(c_sDir);
+	Log::Instance().SetLogLevel(LOG_LEVEL_ALL);
+	bool bOk = true;
+	bOk = CheckStreamFormat() && bOk;
+	bOk = CheckAppenderLevels() && bOk;
+	bOk = CheckJsonEscape() && bOk;
+#ifndef WIN32
+	bOk = CheckParallelGzip() && bOk;
+	bOk = CheckReadRange() && bOk;
+	bOk = CheckBinaryDecode() && bOk;
+	bOk = CheckAsyncWrites() && bOk;
+	bOk = CheckOverflow() && bOk;
+	bOk = CheckClosedRings() && bOk;
+	bOk = CheckDoubleBuffer() && bOk;
+	bOk = CheckMmapFile() && bOk;
+	bOk = CheckWakeThreshold<SafeQueue>("rings") && bOk;
+	bOk = CheckWakeThreshold<DoubleBufferQueue>("double buffer") && bOk;
+	bOk = CheckLostWrites() && bOk;
+	bOk = CheckCompressionErrors() && bOk;
+	bOk = CheckTelemetry() && bOk;
+#endif
+	if(bOk)
+	{
+		boost::filesystem::remove_all(c_sDir);
+	}
+	return bOk ? 0 : 1;
+}
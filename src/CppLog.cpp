@@ -1,238 +1,5167 @@
 #include <ctime>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <errno.h>
 #include <iomanip>
 #include <fstream>
+#include <algorithm>
 #include <boost/bind.hpp>
+#include <boost/chrono.hpp>
 #include <boost/filesystem.hpp>
 #include "CppLog.h"
 
 #ifdef WIN32
 	#include "zip.h"
 	#define LOCAL_TIME(_tm, _tt) localtime_s(&_tm, &_tt)
+	#define snprintf _snprintf
 #else
+	#include <zlib.h>
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/resource.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+	#include <sys/uio.h>
+	#include <climits>
+	#ifndef IOV_MAX
+		#define IOV_MAX 1024
+	#endif
+	#if defined(__linux__) && defined(__has_include)
+		#if __has_include(<linux/io_uring.h>)
+			#include <linux/io_uring.h>
+			#define CPPLOG_URING
+		#endif
+	#endif
 	#define LOCAL_TIME(_tm, _tt) localtime_r(&_tt, &_tm)
 #endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#ifdef WIN32
+		#include <intrin.h>
+	#endif
+	#define CPPLOG_SSE2
+#endif
+
+using namespace std;
+using namespace boost::filesystem;
+
+namespace CppLog
+{
+	// telemetry
+	// the counters of one thread. only that thread changes them, with a relaxed load and store, so counting costs
+	// no locked instruction; GetTelemetryStats() reads them from any thread
+	typedef boost::atomic<unsigned long long> TelemetryCounter;
+	struct TimerSlot
+	{
+		TelemetryCounter m_nCount;
+		TelemetryCounter m_nTotalNs;
+		TelemetryCounter m_nMaxNs;
+	};
+	enum TELEMETRY_TIMER
+	{
+		TIMER_SYNC,
+		TIMER_ARRANGE_FILES,
+		TIMER_COMPRESS,
+		TELEMETRY_TIMERS
+	};
+	struct TelemetrySlot
+	{
+		TelemetrySlot();
+		void AddTo(TelemetryStats& stats) const;
+		TelemetryCounter m_nMessages[LOG_LEVEL_ALL];
+		TelemetryCounter m_nBytesWritten;
+		TelemetryCounter m_nBytesLost;
+		TelemetryCounter m_nDropped;
+		TelemetryCounter m_nMaxQueueDepth;
+		TelemetryCounter m_EnqueueLatencyNs[c_nTelemetryBuckets];
+		TelemetryCounter m_BatchSize[c_nTelemetryBuckets];
+		TimerSlot m_Timers[TELEMETRY_TIMERS];
+		TelemetryCounter m_nOpens;
+		TelemetryCounter m_nCloses;
+		unsigned m_nEnqueues; // picks the enqueues that are timed
+	};
+
+	static inline void Bump(TelemetryCounter& counter, unsigned long long n = 1)
+	{
+		counter.store(counter.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+	}
+
+	static inline void Raise(TelemetryCounter& counter, unsigned long long n)
+	{
+		if(n > counter.load(boost::memory_order_relaxed))
+		{
+			counter.store(n, boost::memory_order_relaxed);
+		}
+	}
+
+	static int TelemetryBucket(unsigned long long n)
+	{
+		int nBucket = 0;
+		while(n > 1 && nBucket < c_nTelemetryBuckets - 1)
+		{
+			n >>= 1;
+			nBucket++;
+		}
+		return nBucket;
+	}
+
+	TelemetrySlot::TelemetrySlot()
+		: m_nEnqueues(0)
+	{
+		for(int i = 0; i < LOG_LEVEL_ALL; i++)
+		{
+			m_nMessages[i].store(0);
+		}
+		m_nBytesWritten.store(0);
+		m_nBytesLost.store(0);
+		m_nDropped.store(0);
+		m_nMaxQueueDepth.store(0);
+		for(int i = 0; i < c_nTelemetryBuckets; i++)
+		{
+			m_EnqueueLatencyNs[i].store(0);
+			m_BatchSize[i].store(0);
+		}
+		for(int i = 0; i < TELEMETRY_TIMERS; i++)
+		{
+			m_Timers[i].m_nCount.store(0);
+			m_Timers[i].m_nTotalNs.store(0);
+			m_Timers[i].m_nMaxNs.store(0);
+		}
+		m_nOpens.store(0);
+		m_nCloses.store(0);
+	}
+
+	static void AddTimer(TimerStats& stats, const TimerSlot& slot)
+	{
+		stats.m_nCount += slot.m_nCount.load(boost::memory_order_relaxed);
+		stats.m_nTotalNs += slot.m_nTotalNs.load(boost::memory_order_relaxed);
+		stats.m_nMaxNs = max(stats.m_nMaxNs, slot.m_nMaxNs.load(boost::memory_order_relaxed));
+	}
+
+	void TelemetrySlot::AddTo(TelemetryStats& stats) const
+	{
+		for(int i = 0; i < LOG_LEVEL_ALL; i++)
+		{
+			stats.m_nMessages[i] += m_nMessages[i].load(boost::memory_order_relaxed);
+		}
+		stats.m_nBytesWritten += m_nBytesWritten.load(boost::memory_order_relaxed);
+		stats.m_nBytesLost += m_nBytesLost.load(boost::memory_order_relaxed);
+		stats.m_nDropped += m_nDropped.load(boost::memory_order_relaxed);
+		stats.m_nMaxQueueDepth = max(stats.m_nMaxQueueDepth, m_nMaxQueueDepth.load(boost::memory_order_relaxed));
+		for(int i = 0; i < c_nTelemetryBuckets; i++)
+		{
+			stats.m_EnqueueLatencyNs[i] += m_EnqueueLatencyNs[i].load(boost::memory_order_relaxed);
+			stats.m_BatchSize[i] += m_BatchSize[i].load(boost::memory_order_relaxed);
+		}
+		AddTimer(stats.m_Sync, m_Timers[TIMER_SYNC]);
+		AddTimer(stats.m_ArrangeFiles, m_Timers[TIMER_ARRANGE_FILES]);
+		AddTimer(stats.m_Compress, m_Timers[TIMER_COMPRESS]);
+		stats.m_nOpens += m_nOpens.load(boost::memory_order_relaxed);
+		stats.m_nCloses += m_nCloses.load(boost::memory_order_relaxed);
+	}
+
+	// the slots of the threads alive and the queued appenders, never destroyed: threads may still exit after the statics
+	struct TelemetryRegistry
+	{
+		LogMutex m_Mutex;
+		std::vector<TelemetrySlot*> m_vSlots;
+		TelemetrySlot m_Retired; // what the threads that are gone counted
+		std::vector<const QueuedFileAppender*> m_vQueues;
+	};
+	static TelemetryRegistry* s_pTelemetry = new TelemetryRegistry();
+
+	// a thread that exits leaves its counts in m_Retired
+	static void RetireTelemetrySlot(TelemetrySlot* pSlot)
+	{
+		TelemetryStats stats;
+		memset(&stats, 0, sizeof(stats));
+		boost::lock_guard<LogMutex> lock(s_pTelemetry->m_Mutex);
+		pSlot->AddTo(stats);
+		TelemetrySlot& retired = s_pTelemetry->m_Retired;
+		for(int i = 0; i < LOG_LEVEL_ALL; i++)
+		{
+			Bump(retired.m_nMessages[i], stats.m_nMessages[i]);
+		}
+		Bump(retired.m_nBytesWritten, stats.m_nBytesWritten);
+		Bump(retired.m_nBytesLost, stats.m_nBytesLost);
+		Bump(retired.m_nDropped, stats.m_nDropped);
+		Raise(retired.m_nMaxQueueDepth, stats.m_nMaxQueueDepth);
+		for(int i = 0; i < c_nTelemetryBuckets; i++)
+		{
+			Bump(retired.m_EnqueueLatencyNs[i], stats.m_EnqueueLatencyNs[i]);
+			Bump(retired.m_BatchSize[i], stats.m_BatchSize[i]);
+		}
+		const TimerStats* pTimers[TELEMETRY_TIMERS] = { &stats.m_Sync, &stats.m_ArrangeFiles, &stats.m_Compress };
+		for(int i = 0; i < TELEMETRY_TIMERS; i++)
+		{
+			Bump(retired.m_Timers[i].m_nCount, pTimers[i]->m_nCount);
+			Bump(retired.m_Timers[i].m_nTotalNs, pTimers[i]->m_nTotalNs);
+			Raise(retired.m_Timers[i].m_nMaxNs, pTimers[i]->m_nMaxNs);
+		}
+		Bump(retired.m_nOpens, stats.m_nOpens);
+		Bump(retired.m_nCloses, stats.m_nCloses);
+		std::vector<TelemetrySlot*>& vSlots = s_pTelemetry->m_vSlots;
+		vSlots.erase(std::remove(vSlots.begin(), vSlots.end(), pSlot), vSlots.end());
+		delete pSlot;
+	}
+	static boost::thread_specific_ptr<TelemetrySlot>* s_pTelemetrySlot = new boost::thread_specific_ptr<TelemetrySlot>(RetireTelemetrySlot);
+
+	static TelemetrySlot& ThreadTelemetry()
+	{
+		TelemetrySlot* pSlot = s_pTelemetrySlot->get();
+		if(!pSlot)
+		{
+			pSlot = new TelemetrySlot();
+			{
+				boost::lock_guard<LogMutex> lock(s_pTelemetry->m_Mutex);
+				s_pTelemetry->m_vSlots.push_back(pSlot);
+			}
+			s_pTelemetrySlot->reset(pSlot);
+		}
+		return *pSlot;
+	}
+
+	static unsigned long long NanosSince(boost::chrono::steady_clock::time_point tStart)
+	{
+		return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now() - tStart).count();
+	}
+
+	// times the scope into one of the timers of the thread
+	class TelemetryTimer
+	{
+	public:
+		explicit TelemetryTimer(TELEMETRY_TIMER timer) : m_Timer(timer), m_tStart(boost::chrono::steady_clock::now()) {}
+		~TelemetryTimer()
+		{
+			unsigned long long nNs = NanosSince(m_tStart);
+			TimerSlot& slot = ThreadTelemetry().m_Timers[m_Timer];
+			Bump(slot.m_nCount);
+			Bump(slot.m_nTotalNs, nNs);
+			Raise(slot.m_nMaxNs, nNs);
+		}
+	private:
+		TELEMETRY_TIMER m_Timer;
+		boost::chrono::steady_clock::time_point m_tStart;
+	};
+
+	TelemetryStats GetTelemetryStats()
+	{
+		TelemetryStats stats;
+		memset(&stats, 0, sizeof(stats));
+		boost::lock_guard<LogMutex> lock(s_pTelemetry->m_Mutex);
+		s_pTelemetry->m_Retired.AddTo(stats);
+		for(size_t i = 0; i < s_pTelemetry->m_vSlots.size(); i++)
+		{
+			s_pTelemetry->m_vSlots[i]->AddTo(stats);
+		}
+		for(size_t i = 0; i < s_pTelemetry->m_vQueues.size(); i++)
+		{
+			stats.m_nQueueDepth += s_pTelemetry->m_vQueues[i]->GetQueueDepth();
+		}
+		return stats;
+	}
+
+	// bucket i counts the values from 2^i up to 2^(i+1)-1, the empty buckets at the end are left out
+	static void AppendTelemetryHistogram(std::string& sBuf, const char* szName, const unsigned long long* pBuckets)
+	{
+		int nEnd = c_nTelemetryBuckets;
+		while(nEnd > 0 && pBuckets[nEnd - 1] == 0)
+		{
+			nEnd--;
+		}
+		sBuf.append(",\"");
+		sBuf.append(szName);
+		sBuf.append("\":[");
+		for(int i = 0; i < nEnd; i++)
+		{
+			if(i > 0)
+			{
+				sBuf.push_back(',');
+			}
+			AppendUInt(sBuf, pBuckets[i]);
+		}
+		sBuf.push_back(']');
+	}
+
+	static void AppendTelemetryTimer(std::string& sBuf, const char* szName, const TimerStats& timer)
+	{
+		sBuf.append(",\"");
+		sBuf.append(szName);
+		sBuf.append("\":{\"count\":");
+		AppendUInt(sBuf, timer.m_nCount);
+		sBuf.append(",\"total_ns\":");
+		AppendUInt(sBuf, timer.m_nTotalNs);
+		sBuf.append(",\"max_ns\":");
+		AppendUInt(sBuf, timer.m_nMaxNs);
+		sBuf.push_back('}');
+	}
+
+	static void AppendTelemetryCounter(std::string& sBuf, const char* szName, unsigned long long n)
+	{
+		sBuf.append(",\"");
+		sBuf.append(szName);
+		sBuf.append("\":");
+		AppendUInt(sBuf, n);
+	}
+
+	void FormatTelemetryStats(const TelemetryStats& stats, std::string& sBuf)
+	{
+		sBuf.append("{\"messages\":{");
+		for(int i = 0; i < LOG_LEVEL_ALL; i++)
+		{
+			if(i > 0)
+			{
+				sBuf.push_back(',');
+			}
+			sBuf.push_back('"');
+			sBuf.append(c_LogLevelTag[i]);
+			sBuf.append("\":");
+			AppendUInt(sBuf, stats.m_nMessages[i]);
+		}
+		sBuf.push_back('}');
+		AppendTelemetryCounter(sBuf, "bytes_written", stats.m_nBytesWritten);
+		AppendTelemetryCounter(sBuf, "bytes_lost", stats.m_nBytesLost);
+		AppendTelemetryCounter(sBuf, "dropped", stats.m_nDropped);
+		AppendTelemetryCounter(sBuf, "queue_depth", stats.m_nQueueDepth);
+		AppendTelemetryCounter(sBuf, "max_queue_depth", stats.m_nMaxQueueDepth);
+		AppendTelemetryHistogram(sBuf, "enqueue_latency_ns", stats.m_EnqueueLatencyNs);
+		AppendTelemetryHistogram(sBuf, "batch_size", stats.m_BatchSize);
+		AppendTelemetryTimer(sBuf, "sync", stats.m_Sync);
+		AppendTelemetryTimer(sBuf, "arrange_files", stats.m_ArrangeFiles);
+		AppendTelemetryTimer(sBuf, "compress", stats.m_Compress);
+		AppendTelemetryCounter(sBuf, "opens", stats.m_nOpens);
+		AppendTelemetryCounter(sBuf, "closes", stats.m_nCloses);
+		sBuf.append("}\n");
+	}
+
+	// member functions for TelemetryDumper
+	TelemetryDumper::TelemetryDumper(const std::string& sPath, unsigned nIntervalSeconds)
+		: m_sPath(sPath)
+		, m_nInterval(nIntervalSeconds ? nIntervalSeconds : 1)
+		, m_bRun(true)
+	{
+		m_ThreadPtr = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&TelemetryDumper::Loop, this)));
+	}
+
+	TelemetryDumper::~TelemetryDumper()
+	{
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			m_bRun = false;
+			m_Cond.notify_one();
+		}
+		m_ThreadPtr->join();
+		Dump(); // what happened since the last interval
+	}
+
+	TelemetryDumperPtr TelemetryDumper::Create(const std::string& sPath, unsigned nIntervalSeconds)
+	{
+		return TelemetryDumperPtr(new TelemetryDumper(sPath, nIntervalSeconds));
+	}
+
+	void TelemetryDumper::Loop()
+	{
+		boost::unique_lock<LogMutex> lock(m_Mutex);
+		boost::system_time tNext = boost::get_system_time() + boost::posix_time::seconds(m_nInterval);
+		while(m_bRun)
+		{
+			if(m_Cond.timed_wait(lock, tNext) || boost::get_system_time() < tNext)
+			{
+				continue; // stopped, or woken up early
+			}
+			tNext += boost::posix_time::seconds(m_nInterval);
+			lock.unlock();
+			Dump();
+			lock.lock();
+		}
+	}
+
+	void TelemetryDumper::Dump()
+	{
+		std::string sLine("{\"time\":\"");
+		TimeFormatter formatter;
+		formatter.Append(sLine, GetCurrentLogTime(), TIME_PRECISION_MILLI);
+		sLine.append("\",");
+		std::string sStats;
+		FormatTelemetryStats(GetTelemetryStats(), sStats);
+		sLine.append(sStats, 1, std::string::npos); // one object, the time goes in front of the counters
+		std::ofstream file(m_sPath.c_str(), ios_base::app);
+		file << sLine;
+		if(file.fail())
+		{
+			cout << "write telemetry failed: " << m_sPath << endl;
+		}
+	}
+
+#ifndef WIN32
+	// appends one gzip member to a file, written as the input comes
+	class GzipWriter
+	{
+	public:
+		GzipWriter();
+		~GzipWriter();
+		bool Open(const std::string& sPath, bool bBlocks); // bBlocks hands everything to a BlockLogWriter
+		void Write(const char* pData, size_t nLen);
+		bool Flush(); // sync flush, everything written so far can be decompressed
+		bool Close(); // finishes the member
+	private:
+		GzipWriter(const GzipWriter&);
+		GzipWriter& operator=(const GzipWriter&);
+		void Deflate(int nFlush);
+		FILE* m_pFile;
+		bool m_bOk;
+		z_stream m_Stream;
+		std::vector<unsigned char> m_vOut;
+		boost::shared_ptr<BlockLogWriter> m_Blocks;
+	};
+
+	// appends to a file in large buffers that stay in flight while the next ones fill. io_uring (raw syscalls)
+	// with the buffers registered once, or one pwritev for the filled buffers when there is no io_uring.
+	// every buffer has its own offset in the file, so the writes may end in any order
+	class AsyncFileWriter
+	{
+	public:
+		AsyncFileWriter(AsyncWriteStats& stats, LogMutex& statsMutex);
+		~AsyncFileWriter();
+		bool Open(const std::string& sPath, unsigned nBuffers, size_t nBufferSize);
+		void Write(const char* pData, size_t nLen);
+		bool Flush(); // hands the partial buffer to the kernel, without waiting
+		bool Close(); // waits for all the writes
+	private:
+		AsyncFileWriter(const AsyncFileWriter&);
+		AsyncFileWriter& operator=(const AsyncFileWriter&);
+		void Submit(); // the current buffer
+		void WritePending(); // pwritev
+		void Reap(bool bWait); // the finished writes give their buffers back
+		void Finish(size_t nBuffer, long nResult); // a write has ended
+		void Count(unsigned nWrites, size_t nBytes, unsigned nInFlight);
+		bool SetupRing(unsigned nEntries);
+		void CloseRing();
+
+		AsyncWriteStats& m_Stats;
+		LogMutex& m_StatsMutex;
+		int m_nFile;
+		bool m_bOk;
+		unsigned long long m_nOffset; // where the next buffer goes
+		size_t m_nBufferSize;
+		std::vector<char*> m_vBuffers;
+		std::vector<size_t> m_vLen;
+		std::vector<unsigned long long> m_vOffset;
+		std::vector<size_t> m_vFree;
+		std::vector<size_t> m_vPending; // filled, not written yet (pwritev)
+		size_t m_nCurrent; // the buffer being filled, m_vBuffers.size() if none
+		unsigned m_nInFlight;
+		int m_nRing;
+#ifdef CPPLOG_URING
+		bool m_bFixed; // the buffers are registered
+		std::vector<iovec> m_vIov;
+		void* m_pSqRing;
+		void* m_pCqRing;
+		size_t m_nSqRingSize;
+		size_t m_nCqRingSize;
+		io_uring_sqe* m_pSqes;
+		size_t m_nSqesSize;
+		unsigned* m_pSqHead; // the entries the kernel has taken
+		unsigned* m_pSqTail;
+		unsigned* m_pSqMask;
+		unsigned* m_pSqArray;
+		unsigned* m_pCqHead;
+		unsigned* m_pCqTail;
+		unsigned* m_pCqMask;
+		io_uring_cqe* m_pCqes;
+#endif
+	};
+#endif
+
+	// member functions for Log
+	Log::Log()
+		: m_LogLevel(LOG_LEVEL_ALL)
+		, m_TimePrecision(TIME_PRECISION_SECOND)
+		, m_bDeferredWanted(false)
+		, m_bDeferred(false)
+		, m_nEnabledLevel(LOG_LEVEL_ALL) // no appenders yet
+		, m_pAppenders(new AppenderList())
+	{}
+
+	Log::~Log()
+	{
+		delete m_pAppenders.load();
+	}
+
+	void Log::AddAppender(AppenderPtr appender)
+	{
+		const AppenderList* pOld = 0;
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			AppenderList* pAppenders = new AppenderList(*m_pAppenders.load());
+			pAppenders->push_back(appender);
+			pOld = Publish(pAppenders);
+		}
+		Retire(pOld);
+	}
+
+	void Log::RemoveAppender(const AppenderPtr& appender)
+	{
+		const AppenderList* pOld = 0;
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			AppenderList* pAppenders = new AppenderList(*m_pAppenders.load());
+			pAppenders->erase(std::remove(pAppenders->begin(), pAppenders->end(), appender), pAppenders->end());
+			pOld = Publish(pAppenders);
+		}
+		Retire(pOld); // a removed appender is destroyed here, unless the caller still holds it
+	}
+
+	void Log::ClearAppenders()
+	{
+		const AppenderList* pOld = 0;
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			pOld = Publish(new AppenderList());
+		}
+		Retire(pOld);
+	}
+
+	AppenderList Log::GetAppenders() const
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		return *m_pAppenders.load();
+	}
+
+	// every thread that logs has a reader slot. m_nSeq is odd while the thread is in Log::Write(), only the thread
+	// itself changes it, so a Write() costs a store and a fence on a line no other thread writes
+	struct ReaderSlot
+	{
+		ReaderSlot() : m_nDepth(0) { m_nSeq.store(0); }
+		boost::atomic<unsigned> m_nSeq;
+		unsigned m_nDepth; // Write() calls of the thread in progress, an appender may log
+		char m_Pad[64]; // keeps the slots of two threads off the same cache line
+	};
+
+	// all the slots ever made, never destroyed: threads may still exit after the statics, and Retire() reads a
+	// slot after the lock is released. the slot of a thread that exited is even, and goes to the next new thread
+	struct ReaderRegistry
+	{
+		LogMutex m_Mutex;
+		std::vector<ReaderSlot*> m_vSlots;
+		std::vector<ReaderSlot*> m_vFree;
+	};
+	static ReaderRegistry* s_pReaders = new ReaderRegistry();
+
+	static void FreeReaderSlot(ReaderSlot* pSlot)
+	{
+		boost::lock_guard<LogMutex> lock(s_pReaders->m_Mutex);
+		s_pReaders->m_vFree.push_back(pSlot);
+	}
+	static boost::thread_specific_ptr<ReaderSlot>* s_pReaderSlot = new boost::thread_specific_ptr<ReaderSlot>(FreeReaderSlot);
+
+	static ReaderSlot& ThreadReaderSlot()
+	{
+		ReaderSlot* pSlot = s_pReaderSlot->get();
+		if(!pSlot)
+		{
+			{
+				boost::lock_guard<LogMutex> lock(s_pReaders->m_Mutex);
+				if(s_pReaders->m_vFree.empty())
+				{
+					pSlot = new ReaderSlot();
+					s_pReaders->m_vSlots.push_back(pSlot);
+				}
+				else
+				{
+					pSlot = s_pReaders->m_vFree.back();
+					s_pReaders->m_vFree.pop_back();
+				}
+			}
+			s_pReaderSlot->reset(pSlot);
+		}
+		return *pSlot;
+	}
+
+	const AppenderList* Log::Publish(AppenderList* pAppenders)
+	{
+		const AppenderList* pOld = m_pAppenders.exchange(pAppenders);
+		UpdateDeferred();
+		UpdateLevels();
+		return pOld;
+	}
+
+	void Log::Retire(const AppenderList* pOld)
+	{
+		// a Write() that read the old list entered before the exchange, and its slot still shows the odd count
+		// it entered with. the calls that enter from now on can only see the new list
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		std::vector<ReaderSlot*> vSlots;
+		{
+			boost::lock_guard<LogMutex> lock(s_pReaders->m_Mutex);
+			vSlots = s_pReaders->m_vSlots;
+		}
+		// without the lock, a thread blocked in an appender's Write() may be waiting on one that logs for the first time
+		for(size_t i = 0; i < vSlots.size(); i++)
+		{
+			boost::atomic<unsigned>& nSeq = vSlots[i]->m_nSeq;
+			unsigned n = nSeq.load(boost::memory_order_acquire);
+			while((n & 1) && nSeq.load(boost::memory_order_acquire) == n)
+			{
+				boost::this_thread::yield();
+			}
+		}
+		delete pOld; // the removed appenders go away here
+	}
+
+	void Log::SetDeferredFormat(bool bDeferred)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_bDeferredWanted = bDeferred;
+		UpdateDeferred();
+	}
+
+	void Log::UpdateDeferred()
+	{
+		bool bDeferred = m_bDeferredWanted;
+		const AppenderList& appenders = *m_pAppenders.load();
+		for(AppenderList::const_iterator it = appenders.begin(); it != appenders.end(); ++it)
+		{
+			bDeferred = bDeferred && (*it)->AcceptsDeferred();
+		}
+		m_bDeferred.store(bDeferred, boost::memory_order_relaxed);
+	}
+
+	// the outermost Write() of a thread makes its count odd, and even again when it leaves, even if an appender
+	// throws. the fence orders the odd count before the read of the list, as the exchange in Publish() is
+	// ordered before Retire() reads the counts
+	struct ReaderGuard
+	{
+		explicit ReaderGuard(ReaderSlot& slot) : m_Slot(slot)
+		{
+			if(m_Slot.m_nDepth++ == 0)
+			{
+				m_Slot.m_nSeq.store(m_Slot.m_nSeq.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+				boost::atomic_thread_fence(boost::memory_order_seq_cst);
+			}
+		}
+		~ReaderGuard()
+		{
+			if(--m_Slot.m_nDepth == 0)
+			{
+				m_Slot.m_nSeq.store(m_Slot.m_nSeq.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+			}
+		}
+		ReaderSlot& m_Slot;
+	};
+
+	void Log::Write(const LogRecordPtr& record)
+	{
+		ReaderGuard guard(ThreadReaderSlot());
+		const AppenderList& appenders = *m_pAppenders.load(boost::memory_order_acquire);
+		LOG_LEVEL level = record->GetLevel();
+		Bump(ThreadTelemetry().m_nMessages[level]);
+		for(AppenderList::const_iterator it = appenders.begin(); it != appenders.end(); ++it)
+		{
+			if((*it)->Wants(level))
+			{
+				(*it)->Write(record);
+			}
+		}
+	}
+
+	void Log::SetLogLevel(LOG_LEVEL level)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_LogLevel.store(level, boost::memory_order_relaxed);
+		UpdateLevels();
+	}
+
+	// LOG_LEVEL_ALL lets everything through, it counts as the lowest level
+	static int ThresholdOf(int nLevel)
+	{
+		return (nLevel == LOG_LEVEL_ALL) ? LOG_LEVEL_DEBUG : nLevel;
+	}
+
+	void Log::UpdateLevels()
+	{
+		int nLowest = LOG_LEVEL_ALL; // above every level when there is no appender
+		const AppenderList& appenders = *m_pAppenders.load();
+		for(AppenderList::const_iterator it = appenders.begin(); it != appenders.end(); ++it)
+		{
+			nLowest = std::min(nLowest, ThresholdOf((*it)->GetLevel()));
+		}
+		m_nEnabledLevel.store(std::max(nLowest, ThresholdOf(m_LogLevel.load(boost::memory_order_relaxed))), boost::memory_order_relaxed);
+	}
+
+	LOG_LEVEL Log::GetLogLevel()
+	{
+		return static_cast<LOG_LEVEL>(m_LogLevel.load(boost::memory_order_relaxed));
+	}
+
+	LogMutex& Log::GetMutex()
+	{
+		return m_Mutex;
+	}
+	
+	// member functions for LogRecord
+	// free records, shared by all threads. they are never destroyed, a thread may still log while statics go away
+	struct RecordPool
+	{
+		LogMutex m_Mutex;
+		std::vector<LogRecord*> m_vFree;
+	};
+	static RecordPool* s_pRecordPool = new RecordPool();
+	static const size_t c_nMaxPooledRecords = 4096;
+	static const size_t c_nMaxPooledCapacity = 64 * 1024; // bigger buffers are given back to the heap
+
+	LogRecordPtr LogRecord::Create(std::string& sText)
+	{
+		LogRecord* pRecord = Acquire();
+		pRecord->m_sText.swap(sText);
+		pRecord->m_sFields.clear();
+		pRecord->m_nMsgBegin = 0;
+		pRecord->m_nMsgEnd = pRecord->m_sText.size();
+		pRecord->m_nFieldsBegin = pRecord->m_nMsgEnd;
+		pRecord->m_Time = GetCurrentLogTime();
+		pRecord->m_pSite = 0;
+		pRecord->m_Level = LOG_LEVEL_FATAL;
+		pRecord->m_bDeferred = false;
+		return LogRecordPtr(pRecord);
+	}
+
+	LogRecord* LogRecord::Acquire()
+	{
+		{
+			boost::lock_guard<LogMutex> lock(s_pRecordPool->m_Mutex);
+			if(!s_pRecordPool->m_vFree.empty())
+			{
+				LogRecord* pRecord = s_pRecordPool->m_vFree.back();
+				s_pRecordPool->m_vFree.pop_back();
+				return pRecord;
+			}
+		}
+		return new LogRecord();
+	}
+
+	void LogRecord::Recycle(LogRecord* pRecord)
+	{
+		if(pRecord->m_sText.capacity() <= c_nMaxPooledCapacity && pRecord->m_sFields.capacity() <= c_nMaxPooledCapacity)
+		{
+			pRecord->m_sText.clear();
+			pRecord->m_sFields.clear();
+			boost::lock_guard<LogMutex> lock(s_pRecordPool->m_Mutex);
+			if(s_pRecordPool->m_vFree.size() < c_nMaxPooledRecords)
+			{
+				s_pRecordPool->m_vFree.push_back(pRecord);
+				return;
+			}
+		}
+		delete pRecord;
+	}
+
+	void intrusive_ptr_add_ref(const LogRecord* p)
+	{
+		p->m_nRef.fetch_add(1, boost::memory_order_relaxed);
+	}
+
+	void intrusive_ptr_release(const LogRecord* p)
+	{
+		if(p->m_nRef.fetch_sub(1, boost::memory_order_release) == 1)
+		{
+			boost::atomic_thread_fence(boost::memory_order_acquire);
+			LogRecord::Recycle(const_cast<LogRecord*>(p));
+		}
+	}
+
+	// member functions for LogStream
+	// the streams of one thread, a stream is busy from Begin() to Finish(), nested log calls take the next one
+	struct ThreadStreams
+	{
+		ThreadStreams() : m_nDepth(0) {}
+		~ThreadStreams()
+		{
+			for(size_t i = 0; i < m_vStreams.size(); i++)
+			{
+				delete m_vStreams[i];
+			}
+		}
+		std::vector<LogStream*> m_vStreams;
+		size_t m_nDepth;
+	};
+	static boost::thread_specific_ptr<ThreadStreams>* s_pThreadStreams = new boost::thread_specific_ptr<ThreadStreams>();
+	static void RenderFieldsText(const std::string& sFields, std::string& sBuf);
+
+	LogStream::LogStream()
+		: m_pText(0)
+		, m_bSlow(false)
+		, m_pSlow(0)
+	{}
+
+	LogStream::~LogStream()
+	{
+		delete m_pSlow;
+	}
+
+	LogStream& LogStream::Begin(const Log& log, const LogSite& site, LOG_LEVEL level)
+	{
+		ThreadStreams* pStreams = s_pThreadStreams->get();
+		if(!pStreams)
+		{
+			pStreams = new ThreadStreams();
+			s_pThreadStreams->reset(pStreams);
+		}
+		if(pStreams->m_nDepth == pStreams->m_vStreams.size())
+		{
+			pStreams->m_vStreams.push_back(new LogStream());
+		}
+		LogStream& stream = *pStreams->m_vStreams[pStreams->m_nDepth++];
+
+		// the last record can be reused unless an appender still holds it
+		if(!stream.m_Record || stream.m_Record->m_nRef.load(boost::memory_order_acquire) != 1)
+		{
+			stream.m_Record = LogRecord::Acquire();
+		}
+		LogRecord& record = *stream.m_Record;
+		stream.m_pText = &record.m_sText;
+		stream.m_pText->clear();
+		record.m_sFields.clear();
+		stream.m_bDeferred = log.IsDeferredFormat();
+		stream.m_bSlow = false;
+		stream.m_bFast = !stream.m_bDeferred;
+		if(stream.m_pSlow)
+		{
+			stream.m_pSlow->str("");
+			stream.m_pSlow->clear();
+			stream.m_pSlow->flags(ios_base::dec | ios_base::skipws);
+			stream.m_pSlow->fill(' ');
+			stream.m_pSlow->precision(6);
+			stream.m_pSlow->width(0);
+		}
+
+		record.m_Time = GetCurrentLogTime();
+		record.m_pSite = &site;
+		record.m_Level = level;
+		record.m_TimePrecision = log.GetTimePrecision();
+		record.m_bDeferred = stream.m_bDeferred;
+		if(!stream.m_bDeferred)
+		{
+			stream.m_TimeFormatter.Append(*stream.m_pText, record.m_Time, record.m_TimePrecision);
+			stream.m_pText->append(" - ");
+			stream.m_pText->append(c_LogLevelTag[level]);
+			stream.m_pText->append(" - ");
+		}
+		record.m_nMsgBegin = stream.m_pText->size();
+		return stream;
+	}
+
+	LogRecordPtr LogStream::Finish()
+	{
+		if(m_bSlow)
+		{
+			const std::string& sSlow = m_pSlow->str();
+			if(m_bDeferred)
+			{
+				Capture(sSlow.data(), sSlow.size());
+			}
+			else
+			{
+				m_pText->append(sSlow);
+			}
+		}
+		m_Record->m_nFieldsBegin = m_pText->size();
+		if(!m_bDeferred && !m_Record->m_sFields.empty())
+		{
+			RenderFieldsText(m_Record->m_sFields, *m_pText);
+		}
+		m_Record->m_nMsgEnd = m_pText->size();
+		if(!m_bDeferred)
+		{
+			m_pText->append(" [ ");
+			m_pText->append(m_Record->m_pSite->m_sFile);
+			m_pText->append(" : ");
+			AppendInt(*m_pText, m_Record->m_pSite->m_nLine);
+			m_pText->append(" ]\n");
+		}
+		Abandon();
+		return LogRecordPtr(m_Record.get());
+	}
+
+	void LogStream::Abandon()
+	{
+		s_pThreadStreams->get()->m_nDepth--;
+	}
+
+	LogStream& LogStream::operator<<(const char* s)
+	{
+		if(!s)
+		{
+			s = "(null)";
+		}
+		if(m_bFast)
+		{
+			m_pText->append(s);
+		}
+		else if(m_bSlow)
+		{
+			*m_pSlow << s;
+		}
+		else
+		{
+			Capture(s, strlen(s));
+		}
+		return *this;
+	}
+
+	LogStream& LogStream::operator<<(std::ostream& (*pf)(std::ostream&))
+	{
+		if(!m_bSlow && (pf == static_cast<std::ostream& (*)(std::ostream&)>(std::endl)))
+		{
+			return *this << '\n';
+		}
+		pf(SlowStream());
+		return FlushSlow();
+	}
+
+	LogStream& LogStream::operator<<(std::ios_base& (*pf)(std::ios_base&))
+	{
+		pf(SlowStream());
+		return FlushSlow();
+	}
+
+	std::ostream& LogStream::SlowStream()
+	{
+		if(!m_pSlow)
+		{
+			m_pSlow = new std::ostringstream();
+		}
+		return *m_pSlow;
+	}
+
+	LogStream& LogStream::FlushSlow()
+	{
+		if(m_bSlow)
+		{
+			return *this;
+		}
+		// a manipulator changed the stream state, keep formatting through it until the end of the message
+		if(m_pSlow->width() != 0 || m_pSlow->flags() != (ios_base::dec | ios_base::skipws)
+			|| m_pSlow->fill() != ' ' || m_pSlow->precision() != 6)
+		{
+			m_bSlow = true;
+			m_bFast = false;
+			return *this;
+		}
+		const std::string& sSlow = m_pSlow->str();
+		if(m_bDeferred)
+		{
+			Capture(sSlow.data(), sSlow.size());
+		}
+		else
+		{
+			m_pText->append(sSlow);
+		}
+		m_pSlow->str("");
+		return *this;
+	}
+
+	// deferred arguments, a type byte followed by the raw value, strings are length prefixed
+	enum ARG_TYPE
+	{
+		ARG_STRING,
+		ARG_CHAR,
+		ARG_INT,
+		ARG_UINT,
+		ARG_DOUBLE,
+		ARG_LONG_DOUBLE,
+		ARG_POINTER,
+		ARG_BOOL
+	};
+
+	template<class T> static void PutArg(std::string& sBuf, ARG_TYPE type, const T& v)
+	{
+		sBuf.push_back(static_cast<char>(type));
+		sBuf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+	}
+
+	template<class T> static T GetArg(const std::string& sBuf, size_t& nPos)
+	{
+		T v;
+		memcpy(&v, sBuf.data() + nPos, sizeof(v));
+		nPos += sizeof(v);
+		return v;
+	}
+
+	void LogStream::Capture(const char* s, size_t nLen)
+	{
+		PutArg(*m_pText, ARG_STRING, static_cast<unsigned int>(nLen));
+		m_pText->append(s, nLen);
+	}
+
+	void LogStream::Capture(char c)
+	{
+		PutArg(*m_pText, ARG_CHAR, c);
+	}
+
+	void LogStream::Capture(bool b)
+	{
+		PutArg(*m_pText, ARG_BOOL, b);
+	}
+
+	void LogStream::Capture(long long n)
+	{
+		PutArg(*m_pText, ARG_INT, n);
+	}
+
+	void LogStream::Capture(unsigned long long n)
+	{
+		PutArg(*m_pText, ARG_UINT, n);
+	}
+
+	void LogStream::Capture(double d)
+	{
+		PutArg(*m_pText, ARG_DOUBLE, d);
+	}
+
+	void LogStream::Capture(long double d)
+	{
+		PutArg(*m_pText, ARG_LONG_DOUBLE, d);
+	}
+
+	void LogStream::Capture(const void* p)
+	{
+		PutArg(*m_pText, ARG_POINTER, p);
+	}
+
+	// a field is its key as a string argument followed by the value as an argument
+	std::string& LogStream::FieldKey(const char* sKey)
+	{
+		std::string& sFields = m_Record->m_sFields;
+		size_t nLen = strlen(sKey);
+		PutArg(sFields, ARG_STRING, static_cast<unsigned int>(nLen));
+		sFields.append(sKey, nLen);
+		return sFields;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, const char* v)
+	{
+		if(!v)
+		{
+			v = "(null)";
+		}
+		std::string& sFields = FieldKey(sKey);
+		size_t nLen = strlen(v);
+		PutArg(sFields, ARG_STRING, static_cast<unsigned int>(nLen));
+		sFields.append(v, nLen);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, const std::string& v)
+	{
+		std::string& sFields = FieldKey(sKey);
+		PutArg(sFields, ARG_STRING, static_cast<unsigned int>(v.size()));
+		sFields.append(v);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, char c)
+	{
+		PutArg(FieldKey(sKey), ARG_CHAR, c);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, bool b)
+	{
+		PutArg(FieldKey(sKey), ARG_BOOL, b);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, long long n)
+	{
+		PutArg(FieldKey(sKey), ARG_INT, n);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, unsigned long long n)
+	{
+		PutArg(FieldKey(sKey), ARG_UINT, n);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, double d)
+	{
+		PutArg(FieldKey(sKey), ARG_DOUBLE, d);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, long double d)
+	{
+		PutArg(FieldKey(sKey), ARG_LONG_DOUBLE, d);
+		return *this;
+	}
+
+	LogStream& LogStream::Field(const char* sKey, const void* p)
+	{
+		PutArg(FieldKey(sKey), ARG_POINTER, p);
+		return *this;
+	}
+
+	void LogRecord::Render(std::string& sBuf, TimeFormatter& formatter) const
+	{
+		if(!m_bDeferred)
+		{
+			sBuf.append(m_sText);
+			return;
+		}
+		formatter.Append(sBuf, m_Time, m_TimePrecision);
+		sBuf.append(" - ");
+		sBuf.append(c_LogLevelTag[m_Level]);
+		sBuf.append(" - ");
+		RenderMessage(sBuf);
+		sBuf.append(" [ ");
+		sBuf.append(m_pSite->m_sFile);
+		sBuf.append(" : ");
+		AppendInt(sBuf, m_pSite->m_nLine);
+		sBuf.append(" ]\n");
+	}
+
+	void LogRecord::RenderMessage(std::string& sBuf) const
+	{
+		if(!m_bDeferred)
+		{
+			sBuf.append(m_sText, m_nMsgBegin, m_nMsgEnd - m_nMsgBegin);
+			return;
+		}
+		RenderArgs(sBuf);
+		if(!m_sFields.empty())
+		{
+			RenderFieldsText(m_sFields, sBuf);
+		}
+	}
+
+	void LogRecord::RenderArgs(std::string& sBuf) const
+	{
+		size_t nPos = 0;
+		while(nPos < m_sText.size())
+		{
+			switch(m_sText[nPos++])
+			{
+			case ARG_STRING:
+				{
+					unsigned int nLen = GetArg<unsigned int>(m_sText, nPos);
+					sBuf.append(m_sText, nPos, nLen);
+					nPos += nLen;
+				}
+				break;
+			case ARG_CHAR:
+				sBuf.push_back(GetArg<char>(m_sText, nPos));
+				break;
+			case ARG_BOOL:
+				sBuf.push_back(GetArg<bool>(m_sText, nPos) ? '1' : '0'); // boolalpha makes the stream slow, it is never seen here
+				break;
+			case ARG_INT:
+				AppendInt(sBuf, GetArg<long long>(m_sText, nPos));
+				break;
+			case ARG_UINT:
+				AppendUInt(sBuf, GetArg<unsigned long long>(m_sText, nPos));
+				break;
+			case ARG_DOUBLE:
+				AppendDouble(sBuf, GetArg<double>(m_sText, nPos));
+				break;
+			case ARG_LONG_DOUBLE:
+				AppendLongDouble(sBuf, GetArg<long double>(m_sText, nPos));
+				break;
+			case ARG_POINTER:
+				AppendPointer(sBuf, GetArg<const void*>(m_sText, nPos));
+				break;
+			default:
+				nPos = m_sText.size();
+				break;
+			}
+		}
+	}
+
+	// " key=value" for every field
+	static void RenderFieldsText(const std::string& sFields, std::string& sBuf)
+	{
+		size_t nPos = 0;
+		while(nPos < sFields.size())
+		{
+			nPos++; // the key is a string
+			unsigned int nKeyLen = GetArg<unsigned int>(sFields, nPos);
+			sBuf.push_back(' ');
+			sBuf.append(sFields, nPos, nKeyLen);
+			sBuf.push_back('=');
+			nPos += nKeyLen;
+			switch(sFields[nPos++])
+			{
+			case ARG_STRING:
+				{
+					unsigned int nLen = GetArg<unsigned int>(sFields, nPos);
+					sBuf.append(sFields, nPos, nLen);
+					nPos += nLen;
+				}
+				break;
+			case ARG_CHAR:
+				sBuf.push_back(GetArg<char>(sFields, nPos));
+				break;
+			case ARG_BOOL:
+				sBuf.append(GetArg<bool>(sFields, nPos) ? "true" : "false");
+				break;
+			case ARG_INT:
+				AppendInt(sBuf, GetArg<long long>(sFields, nPos));
+				break;
+			case ARG_UINT:
+				AppendUInt(sBuf, GetArg<unsigned long long>(sFields, nPos));
+				break;
+			case ARG_DOUBLE:
+				AppendDouble(sBuf, GetArg<double>(sFields, nPos));
+				break;
+			case ARG_LONG_DOUBLE:
+				AppendLongDouble(sBuf, GetArg<long double>(sFields, nPos));
+				break;
+			case ARG_POINTER:
+				AppendPointer(sBuf, GetArg<const void*>(sFields, nPos));
+				break;
+			default:
+				nPos = sFields.size();
+				break;
+			}
+		}
+	}
+
+	// formatting helpers
+	void AppendUInt(std::string& sBuf, unsigned long long n)
+	{
+		char buf[24];
+		char* p = buf + sizeof(buf);
+		do
+		{
+			*--p = static_cast<char>('0' + n % 10);
+			n /= 10;
+		} while(n);
+		sBuf.append(p, buf + sizeof(buf) - p);
+	}
+
+	void AppendInt(std::string& sBuf, long long n)
+	{
+		if(n < 0)
+		{
+			sBuf.push_back('-');
+			AppendUInt(sBuf, 0 - static_cast<unsigned long long>(n));
+		}
+		else
+		{
+			AppendUInt(sBuf, static_cast<unsigned long long>(n));
+		}
+	}
+
+	void AppendDouble(std::string& sBuf, double d)
+	{
+		char buf[32];
+		int nLen = snprintf(buf, sizeof(buf), "%g", d);
+		if(nLen > 0)
+		{
+			sBuf.append(buf, min(nLen, (int)sizeof(buf) - 1));
+		}
+	}
+
+	void AppendLongDouble(std::string& sBuf, long double d)
+	{
+		char buf[48];
+		int nLen = snprintf(buf, sizeof(buf), "%Lg", d);
+		if(nLen > 0)
+		{
+			sBuf.append(buf, min(nLen, (int)sizeof(buf) - 1));
+		}
+	}
+
+	void AppendPointer(std::string& sBuf, const void* p)
+	{
+		static const char c_HexDigits[] = "0123456789abcdef";
+		size_t n = reinterpret_cast<size_t>(p);
+		if(n == 0)
+		{
+			sBuf.push_back('0');
+			return;
+		}
+		char buf[2 + 2 * sizeof(size_t)];
+		char* pEnd = buf + sizeof(buf);
+		char* pDigit = pEnd;
+		while(n)
+		{
+			*--pDigit = c_HexDigits[n & 0xf];
+			n >>= 4;
+		}
+		*--pDigit = 'x';
+		*--pDigit = '0';
+		sBuf.append(pDigit, pEnd - pDigit);
+	}
+
+	static void AppendJsonEscape(std::string& sBuf, unsigned char c)
+	{
+		static const char c_HexDigits[] = "0123456789abcdef";
+		sBuf.push_back('\\');
+		switch(c)
+		{
+		case '"': sBuf.push_back('"'); break;
+		case '\\': sBuf.push_back('\\'); break;
+		case '\n': sBuf.push_back('n'); break;
+		case '\r': sBuf.push_back('r'); break;
+		case '\t': sBuf.push_back('t'); break;
+		case '\b': sBuf.push_back('b'); break;
+		case '\f': sBuf.push_back('f'); break;
+		default:
+			sBuf.append("u00");
+			sBuf.push_back(c_HexDigits[c >> 4]);
+			sBuf.push_back(c_HexDigits[c & 0xf]);
+			break;
+		}
+	}
+
+#ifdef CPPLOG_SSE2
+	static inline unsigned LowestBit(unsigned n)
+	{
+#ifdef WIN32
+		unsigned long nIndex;
+		_BitScanForward(&nIndex, n);
+		return nIndex;
+#else
+		return __builtin_ctz(n);
+#endif
+	}
+#endif
+
+	// the runs without a quote, a backslash or a control character are appended whole. with SSE2, 16 bytes are
+	// checked at a time, so plain text costs about a compare per 16 bytes besides the copy
+	void AppendJsonString(std::string& sBuf, const char* p, size_t nLen)
+	{
+		const char* pEnd = p + nLen;
+		const char* pRun = p; // the first byte not appended yet
+#ifdef CPPLOG_SSE2
+		const __m128i vQuote = _mm_set1_epi8('"');
+		const __m128i vBackslash = _mm_set1_epi8('\\');
+		const __m128i vControl = _mm_set1_epi8(0x1f);
+		while(pEnd - p >= 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			// unsigned min(v, 0x1f) == v for the bytes up to 0x1f
+			__m128i vEscape = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, vQuote), _mm_cmpeq_epi8(v, vBackslash)),
+				_mm_cmpeq_epi8(_mm_min_epu8(v, vControl), v));
+			unsigned nMask = static_cast<unsigned>(_mm_movemask_epi8(vEscape));
+			if(nMask == 0)
+			{
+				p += 16;
+				continue;
+			}
+			p += LowestBit(nMask);
+			sBuf.append(pRun, p - pRun);
+			AppendJsonEscape(sBuf, static_cast<unsigned char>(*p));
+			pRun = ++p;
+		}
+#endif
+		for(; p < pEnd; p++)
+		{
+			unsigned char c = static_cast<unsigned char>(*p);
+			if(c == '"' || c == '\\' || c < 0x20)
+			{
+				sBuf.append(pRun, p - pRun);
+				AppendJsonEscape(sBuf, c);
+				pRun = p + 1;
+			}
+		}
+		sBuf.append(pRun, pEnd - pRun);
+	}
+
+	// log time
+	LogTime GetCurrentLogTime()
+	{
+		LogTime tmLog;
+#ifdef WIN32
+		FILETIME ft;
+		GetSystemTimeAsFileTime(&ft);
+		unsigned long long nTicks = ((static_cast<unsigned long long>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime)
+			- 116444736000000000ULL; // 100ns ticks from 1601 to 1970
+		tmLog.m_nSec = static_cast<time_t>(nTicks / 10000000);
+		tmLog.m_nNanoSec = static_cast<long>(nTicks % 10000000) * 100;
+#else
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		tmLog.m_nSec = ts.tv_sec;
+		tmLog.m_nNanoSec = ts.tv_nsec;
+#endif
+		return tmLog;
+	}
+
+	static void Write2Digits(char* p, int n)
+	{
+		p[0] = static_cast<char>('0' + n / 10);
+		p[1] = static_cast<char>('0' + n % 10);
+	}
+
+	TimeFormatter::TimeFormatter()
+		: m_nMinuteStart(-1)
+	{}
+
+	void TimeFormatter::RenderMinute(time_t tt)
+	{
+		tm tmNow;
+		LOCAL_TIME(tmNow, tt);
+		int nYear = tmNow.tm_year + 1900;
+		Write2Digits(m_szMinute, nYear / 100);
+		Write2Digits(m_szMinute + 2, nYear % 100);
+		m_szMinute[4] = '/';
+		Write2Digits(m_szMinute + 5, tmNow.tm_mon + 1);
+		m_szMinute[7] = '/';
+		Write2Digits(m_szMinute + 8, tmNow.tm_mday);
+		m_szMinute[10] = ' ';
+		Write2Digits(m_szMinute + 11, tmNow.tm_hour);
+		m_szMinute[13] = ':';
+		Write2Digits(m_szMinute + 14, tmNow.tm_min);
+		m_szMinute[16] = ':';
+		m_nMinuteStart = tt - min(tmNow.tm_sec, 59); // a leap second is shown as :59
+	}
+
+	void TimeFormatter::Append(std::string& sBuf, const LogTime& tmLog, TIME_PRECISION precision)
+	{
+		if(tmLog.m_nSec < m_nMinuteStart || tmLog.m_nSec >= m_nMinuteStart + 60)
+		{
+			RenderMinute(tmLog.m_nSec);
+		}
+		static const int c_nDigits[] = {0, 3, 6, 9};
+		static const long c_nDivisor[] = {1000000000, 1000000, 1000, 1};
+		char buf[13];
+		Write2Digits(buf, static_cast<int>(tmLog.m_nSec - m_nMinuteStart));
+		size_t nLen = 2;
+		if(precision != TIME_PRECISION_SECOND)
+		{
+			buf[2] = '.';
+			long nFraction = tmLog.m_nNanoSec / c_nDivisor[precision];
+			nLen = 3 + c_nDigits[precision];
+			for(size_t i = nLen - 1; i > 2; i--)
+			{
+				buf[i] = static_cast<char>('0' + nFraction % 10);
+				nFraction /= 10;
+			}
+		}
+		sBuf.append(m_szMinute, sizeof(m_szMinute));
+		sBuf.append(buf, nLen);
+	}
+
+	// member functions for Appender
+	void Appender::SetLevel(LOG_LEVEL level)
+	{
+		m_Level.store(level, boost::memory_order_relaxed);
+		Log& log = Log::Instance();
+		boost::lock_guard<LogMutex> lock(log.GetMutex());
+		log.UpdateLevels();
+	}
+
+	void Appender::Write(const LogRecordPtr& record)
+	{
+		if(record->IsDeferred())
+		{
+			std::string sText;
+			TimeFormatter formatter;
+			record->Render(sText, formatter);
+			Write(sText);
+		}
+		else
+		{
+			Write(record->GetText());
+		}
+	}
+
+	// member functions for ConsoleAppender
+	ConsoleAppender::ConsoleAppender(){}
+
+	void ConsoleAppender::Write(const std::string& msg)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		cout << msg;
+	}
+
+	ConsoleAppenderPtr ConsoleAppender::Create()
+	{
+		return ConsoleAppenderPtr(new ConsoleAppender());
+	}
+
+	// member functions for FileAppender
+	FileAppender::FileAppender()
+		: m_nAsyncInFlight(0)
+		, m_nAsyncBufferSize(0)
+		, m_bCompressedOutput(false)
+		, m_bSeekableOutput(false)
+		, m_tLastFlush(0)
+		, m_nUnflushed(0)
+		, m_tRollover(0)
+		, m_nOpenVersion(0)
+		, m_Housekeeper(Housekeeper::Instance())
+		, m_bReopen(false)
+	{
+		SetCompress(true);
+		SetPrefixName("test");
+		memset(&m_AsyncStats, 0, sizeof(m_AsyncStats));
+#ifndef WIN32
+		m_nFile = -1;
+		m_nLostBytes = 0;
+		m_tLostReported = 0;
+#endif
+	}
+
+	FileAppender::~FileAppender()
+	{
+		if(IsOpen())
+		{
+			Bump(ThreadTelemetry().m_nCloses);
+		}
+		m_filestream.close();
+#ifndef WIN32
+		if(m_nFile >= 0)
+		{
+			close(m_nFile);
+		}
+#endif
+		m_AsyncWriter.reset(); // before the stats it counts into
+		m_Housekeeper->Release(m_sHeldFile);
+	}
+
+	void FileAppender::Open()
+	{
+		// one compare per write, the directory is only scanned when the file changes
+		time_t ttNow = time(NULL);
+		if(ttNow >= m_tRollover || m_nOpenVersion != m_nNameVersion
+			|| (m_bReopen.load(boost::memory_order_relaxed) && m_bReopen.exchange(false)))
+		{
+			Reopen(ttNow);
+		}
+	}
+
+	bool FileAppender::IsOpen() const
+	{
+#ifndef WIN32
+		if(m_nFile >= 0)
+		{
+			return true;
+		}
+#endif
+		return m_filestream.is_open() || m_GzipWriter || m_AsyncWriter;
+	}
+
+	void FileAppender::Reopen(time_t ttNow)
+	{
+		if(IsOpen())
+		{
+			Close();
+		}
+		m_Housekeeper->Release(m_sHeldFile); // the async writes and the buffers are all in the file now
+		// the deadline comes from the time taken before the name, so a name of the new day can only come with
+		// a deadline that has already passed, never the other way round
+		m_tRollover = NextRolloverTime(ttNow);
+		m_nOpenVersion = m_nNameVersion;
+		m_Housekeeper->Watch(*this); // after the close, yesterday's file can be compressed
+		string sTag = m_Encoder ? m_Encoder->GetFileTag() : "";
+		string sFileName;
+#ifndef WIN32
+		if(m_bCompressedOutput)
+		{
+			sFileName = FreeGzipName(SynthesizeTodyFileStem() + sTag); // a .gz, the housekeeper never compresses it
+			m_GzipWriter.reset(new GzipWriter());
+			if(!m_GzipWriter->Open(sFileName, m_bSeekableOutput))
+			{
+				m_GzipWriter.reset();
+				cout << "open file failed: " << sFileName << endl;
+				m_tRollover = ttNow + 1; // try again in a second
+				return;
+			}
+		}
+		else if(m_nAsyncInFlight)
+		{
+			sFileName = m_sHeldFile = m_Housekeeper->Hold(*this, sTag);
+			m_AsyncWriter.reset(new AsyncFileWriter(m_AsyncStats, m_StatsMutex));
+			if(!m_AsyncWriter->Open(sFileName, m_nAsyncInFlight, m_nAsyncBufferSize))
+			{
+				m_AsyncWriter.reset();
+				cout << "open file failed: " << sFileName << endl;
+				m_tRollover = ttNow + 1; // try again in a second
+				return;
+			}
+		}
+		else
+		{
+			sFileName = m_sHeldFile = m_Housekeeper->Hold(*this, sTag);
+			m_nFile = open(sFileName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+			if(m_nFile < 0)
+			{
+				cout << "open file failed: " << sFileName << endl;
+				m_tRollover = ttNow + 1; // try again in a second
+				return;
+			}
+		}
+#else
+		sFileName = m_sHeldFile = m_Housekeeper->Hold(*this, sTag);
+		m_filestream.clear();
+		m_filestream.open(sFileName.c_str(), ios_base::app);
+		if(m_filestream.fail())
+		{
+			m_filestream.clear();
+			cout << "open file failed: " << sFileName << endl;
+			m_tRollover = ttNow + 1; // try again in a second
+			return;
+		}
+#endif
+		if(m_Encoder)
+		{
+			// every file, or part of a file after a reopen, can be decoded on its own
+			m_sRenderBuf.clear();
+			m_Encoder->Begin(m_sRenderBuf);
+			WriteWithoutFlush(m_sRenderBuf);
+		}
+		Bump(ThreadTelemetry().m_nOpens);
+	}
+
+	void FileAppender::Close()
+	{
+		if(IsOpen())
+		{
+			Bump(ThreadTelemetry().m_nCloses);
+		}
+#ifndef WIN32
+		if(m_GzipWriter)
+		{
+			if(!m_GzipWriter->Close())
+			{
+				cout << "close file failed: " << endl;
+			}
+			m_GzipWriter.reset();
+			m_tRollover = 0;
+			return;
+		}
+		if(m_AsyncWriter)
+		{
+			if(!m_AsyncWriter->Close())
+			{
+				cout << "close file failed: " << endl;
+			}
+			m_AsyncWriter.reset();
+			m_tRollover = 0;
+			return;
+		}
+		if(m_nFile >= 0)
+		{
+			if(close(m_nFile) != 0)
+			{
+				cout << "close file failed: " << endl;
+			}
+			m_nFile = -1;
+			m_tRollover = 0;
+			return;
+		}
+#endif
+		m_filestream.close();
+		if(m_filestream.fail())
+		{
+			m_filestream.clear();
+			cout << "close file failed: " << endl;
+		}
+		m_tRollover = 0;
+	}
+
+	void FileAppender::Flush()
+	{
+#ifndef WIN32
+		if(m_GzipWriter)
+		{
+			m_tLastFlush = time(NULL);
+			m_nUnflushed = 0;
+			if(!m_GzipWriter->Flush())
+			{
+				cout << "write file failed: " << endl;
+			}
+			return;
+		}
+		if(m_AsyncWriter)
+		{
+			m_tLastFlush = time(NULL);
+			m_nUnflushed = 0;
+			if(!m_AsyncWriter->Flush())
+			{
+				cout << "write file failed: " << endl;
+			}
+			return;
+		}
+		// nothing is buffered, the plain output has no user space buffer and without a file the bytes are lost
+#else
+		m_filestream.flush();
+		if(m_filestream.fail())
+		{
+			m_filestream.clear();
+			cout << "write file failed: " << endl;
+		}
+#endif
+	}
+
+	void FileAppender::Write(const std::string& msg)
+	{
+		boost::lock_guard<LogMutex> lock(m_WriteMutex);
+		Open();
+		WriteText(msg);
+		FlushIfDue();
+	}
+
+	void FileAppender::Write(const LogRecordPtr& record)
+	{
+		boost::lock_guard<LogMutex> lock(m_WriteMutex);
+		Open();
+		WriteRecord(*record);
+		FlushIfDue();
+	}
+
+	void FileAppender::FlushIfDue()
+	{
+		// a sync point per line would ruin the compression, a write per line the batching
+		if((!m_GzipWriter && !m_AsyncWriter) || m_nUnflushed >= 64 * 1024 || time(NULL) != m_tLastFlush)
+		{
+			Flush();
+		}
+	}
+
+	void FileAppender::WriteText(const std::string& msg)
+	{
+		if(m_Encoder)
+		{
+			m_sRenderBuf.clear();
+			m_Encoder->EncodeText(msg, m_sRenderBuf);
+			WriteWithoutFlush(m_sRenderBuf);
+		}
+		else
+		{
+			WriteWithoutFlush(msg);
+		}
+	}
+
+	void FileAppender::WriteRecord(const LogRecord& record)
+	{
+		if(m_Encoder)
+		{
+			m_sRenderBuf.clear();
+			m_Encoder->Encode(record, m_sRenderBuf);
+			WriteWithoutFlush(m_sRenderBuf);
+		}
+		else if(record.IsDeferred())
+		{
+			m_sRenderBuf.clear();
+			record.Render(m_sRenderBuf, m_TimeFormatter);
+			WriteWithoutFlush(m_sRenderBuf);
+		}
+		else
+		{
+			WriteWithoutFlush(record.GetText());
+		}
+	}
+
+	void FileAppender::WriteBatch(const std::vector<LogRecordPtr>& vRecords)
+	{
+		if(m_Encoder)
+		{
+			m_sRenderBuf.clear();
+			for(std::vector<LogRecordPtr>::const_iterator it = vRecords.begin(); it != vRecords.end(); ++it)
+			{
+				m_Encoder->Encode(**it, m_sRenderBuf);
+			}
+			WriteWithoutFlush(m_sRenderBuf);
+			return;
+		}
+#ifndef WIN32
+		if(m_nFile >= 0)
+		{
+			// the eager lines go out from the records themselves, the deferred ones are rendered one after the
+			// other and only get their address once the buffer has stopped growing
+			m_sRenderBuf.clear();
+			m_vIov.clear();
+			for(std::vector<LogRecordPtr>::const_iterator it = vRecords.begin(); it != vRecords.end(); ++it)
+			{
+				if((*it)->IsDeferred())
+				{
+					size_t nBegin = m_sRenderBuf.size();
+					(*it)->Render(m_sRenderBuf, m_TimeFormatter);
+					if(m_vIov.empty() || m_vIov.back().iov_base)
+					{
+						iovec iov = { 0, 0 };
+						m_vIov.push_back(iov);
+					}
+					m_vIov.back().iov_len += m_sRenderBuf.size() - nBegin;
+				}
+				else
+				{
+					iovec iov = { const_cast<char*>((*it)->GetText().data()), (*it)->GetText().size() };
+					m_vIov.push_back(iov);
+				}
+				if(m_vIov.size() >= size_t(IOV_MAX) || m_sRenderBuf.size() >= 256 * 1024)
+				{
+					WriteSegments();
+					m_sRenderBuf.clear();
+				}
+			}
+			WriteSegments();
+			return;
+		}
+#endif
+		for(std::vector<LogRecordPtr>::const_iterator it = vRecords.begin(); it != vRecords.end(); ++it)
+		{
+			WriteRecord(**it);
+		}
+	}
+
+	void FileAppender::WriteLines(const std::string& sLines, const std::vector<size_t>& vEnds)
+	{
+		if(!m_Encoder)
+		{
+			WriteWithoutFlush(sLines);
+			return;
+		}
+		m_sRenderBuf.clear();
+		size_t nBegin = 0;
+		for(size_t i = 0; i < vEnds.size(); i++)
+		{
+			m_sLine.assign(sLines, nBegin, vEnds[i] - nBegin);
+			m_Encoder->EncodeText(m_sLine, m_sRenderBuf);
+			nBegin = vEnds[i];
+		}
+		WriteWithoutFlush(m_sRenderBuf);
+	}
+
+#ifndef WIN32
+	void FileAppender::WriteSegments()
+	{
+		size_t nRendered = 0;
+		for(size_t i = 0; i < m_vIov.size(); i++)
+		{
+			if(!m_vIov[i].iov_base)
+			{
+				m_vIov[i].iov_base = &m_sRenderBuf[nRendered];
+				nRendered += m_vIov[i].iov_len;
+			}
+		}
+		iovec* pIov = m_vIov.empty() ? 0 : &m_vIov[0];
+		size_t nIov = m_vIov.size();
+		while(nIov > 0)
+		{
+			ssize_t nWritten = writev(m_nFile, pIov, int(min(nIov, size_t(IOV_MAX))));
+			if(nWritten < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if(nWritten < 0 || (nWritten == 0 && pIov->iov_len > 0))
+			{
+				cout << "write file failed: " << strerror(errno) << endl;
+				break;
+			}
+			// skip what was written, a short write goes on from the middle of a segment
+			size_t nDone = size_t(nWritten);
+			Bump(ThreadTelemetry().m_nBytesWritten, nDone);
+			while(nIov > 0 && nDone >= pIov->iov_len)
+			{
+				nDone -= pIov->iov_len;
+				pIov++;
+				nIov--;
+			}
+			if(nIov > 0)
+			{
+				pIov->iov_base = static_cast<char*>(pIov->iov_base) + nDone;
+				pIov->iov_len -= nDone;
+			}
+		}
+		m_vIov.clear();
+	}
+#endif
+
+	void FileAppender::SetBinaryOutput(bool bBinary)
+	{
+		SetEncoder(boost::shared_ptr<LogEncoder>(bBinary ? new BinaryLogEncoder() : 0));
+	}
+
+	void FileAppender::SetJsonOutput(bool bJson)
+	{
+		SetEncoder(boost::shared_ptr<LogEncoder>(bJson ? new JsonLogEncoder() : 0));
+	}
+
+	void FileAppender::SetEncoder(const boost::shared_ptr<LogEncoder>& encoder)
+	{
+		boost::lock_guard<LogMutex> lock(m_WriteMutex);
+		// the same format again keeps the encoder of the open file
+		if(strcmp(m_Encoder ? m_Encoder->GetFileTag() : "", encoder ? encoder->GetFileTag() : "") != 0)
+		{
+			m_Encoder = encoder;
+			m_nNameVersion++; // the next write opens the other file
+		}
+	}
+
+	void FileAppender::WriteWithoutFlush(const std::string& msg)
+	{
+#ifndef WIN32
+		if(m_GzipWriter)
+		{
+			m_GzipWriter->Write(msg.data(), msg.size());
+			m_nUnflushed += msg.size();
+			Bump(ThreadTelemetry().m_nBytesWritten, msg.size());
+			return;
+		}
+		if(m_AsyncWriter)
+		{
+			m_AsyncWriter->Write(msg.data(), msg.size());
+			m_nUnflushed += msg.size();
+			Bump(ThreadTelemetry().m_nBytesWritten, msg.size());
+			return;
+		}
+		if(m_nFile >= 0)
+		{
+			iovec iov;
+			iov.iov_base = const_cast<char*>(msg.data());
+			iov.iov_len = msg.size();
+			m_vIov.assign(1, iov);
+			WriteSegments();
+			return;
+		}
+		// the file could not be opened, Reopen tries again every second
+		Lose(msg.size());
+#else
+		m_filestream << msg;
+		Bump(ThreadTelemetry().m_nBytesWritten, msg.size());
+#endif
+	}
+
+#ifndef WIN32
+	void FileAppender::Lose(size_t nBytes)
+	{
+		Bump(ThreadTelemetry().m_nBytesLost, nBytes);
+		m_nLostBytes += nBytes;
+		time_t ttNow = time(NULL);
+		if(ttNow != m_tLostReported)
+		{
+			cout << "write file failed: the file is not open, " << m_nLostBytes << " bytes lost" << endl;
+			m_nLostBytes = 0;
+			m_tLostReported = ttNow;
+		}
+	}
+#endif
+
+	void FileAppender::SetAsyncWrites(unsigned nInFlight, size_t nBufferSize)
+	{
+#ifdef WIN32
+		if(nInFlight)
+		{
+			cout << "asynchronous writes are not supported on windows" << endl;
+		}
+#else
+		boost::lock_guard<LogMutex> lock(m_WriteMutex);
+		m_nAsyncInFlight = nInFlight;
+		m_nAsyncBufferSize = max(nBufferSize, size_t(4096));
+		m_nNameVersion++; // the next write opens the file again
+#endif
+	}
+
+	AsyncWriteStats FileAppender::GetAsyncWriteStats() const
+	{
+		boost::lock_guard<LogMutex> lock(m_StatsMutex);
+		return m_AsyncStats;
+	}
+
+	void FileAppender::SetCompressedOutput(bool bCompressed, bool bSeekable)
+	{
+#ifdef WIN32
+		if(bCompressed)
+		{
+			cout << "compressed output is not supported on windows" << endl;
+		}
+#else
+		boost::lock_guard<LogMutex> lock(m_WriteMutex);
+		m_bCompressedOutput = bCompressed;
+		m_bSeekableOutput = bSeekable;
+		m_nNameVersion++; // the next write opens the other file
+#endif
+	}
+
+	FileAppenderPtr FileAppender::Create()
+	{
+		return FileAppenderPtr(new FileAppender());
+	}
+
+	// QueuedAppender
+	QueuedFileAppender::QueuedFileAppender(QUEUE_TYPE type)
+		: m_nMaxLatencyMs(200)
+		, m_bRun (true)
+	{
+		if(type == QUEUE_DOUBLE_BUFFER)
+		{
+			m_DoubleBuffer.reset(new DoubleBufferQueue());
+		}
+		{
+			boost::lock_guard<LogMutex> lock(s_pTelemetry->m_Mutex);
+			s_pTelemetry->m_vQueues.push_back(this);
+		}
+		m_ThreadPtr = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&QueuedFileAppender::Loop, this)));
+	}
+
+	QueuedFileAppender::~QueuedFileAppender()
+	{
+		{
+			boost::lock_guard<LogMutex> lock(s_pTelemetry->m_Mutex);
+			std::vector<const QueuedFileAppender*>& vQueues = s_pTelemetry->m_vQueues;
+			vQueues.erase(std::remove(vQueues.begin(), vQueues.end(), this), vQueues.end());
+		}
+		m_bRun.store(false, boost::memory_order_release);
+		// no need to wait for the deadline
+		if(m_DoubleBuffer)
+		{
+			m_DoubleBuffer->Wake(true);
+		}
+		else
+		{
+			m_Queue.Wake(true);
+		}
+		m_ThreadPtr->join();
+		Sync(); // flush all the messages in the queue before exit
+	}
+
+	void QueuedFileAppender::Sync()
+	{
+		TelemetryTimer timer(TIMER_SYNC);
+		boost::lock_guard<LogMutex> lock(m_WriteMutex); // uncontended unless an output setting changes
+		size_t nDropped = 0;
+		size_t nBatch = 0;
+		FileAppender::Open();
+		if(m_DoubleBuffer)
+		{
+			// the back buffers are empty again but keep their capacity
+			m_sBackLines.clear();
+			m_vBackEnds.clear();
+			m_DoubleBuffer->Swap(m_sBackLines, m_vBackEnds);
+			nDropped = m_DoubleBuffer->TakeDropped();
+			nBatch = m_vBackEnds.size();
+			FileAppender::WriteLines(m_sBackLines, m_vBackEnds);
+		}
+		else
+		{
+			m_Queue.PopAll(m_vBatch);
+			nDropped = m_Queue.TakeDropped();
+			nBatch = m_vBatch.size();
+			FileAppender::WriteBatch(m_vBatch);
+			m_vBatch.clear();
+		}
+		if(nBatch)
+		{
+			// the queue was at least as deep as what was taken from it
+			TelemetrySlot& slot = ThreadTelemetry();
+			Bump(slot.m_BatchSize[TelemetryBucket(nBatch)]);
+			Raise(slot.m_nMaxQueueDepth, nBatch);
+		}
+		if(nDropped)
+		{
+			WriteDropReport(nDropped);
+		}
+		FileAppender::Flush();
+	}
+
+	void QueuedFileAppender::Loop()
+	{
+		while(m_bRun.load(boost::memory_order_acquire))
+		{
+			unsigned nMaxLatencyMs = m_nMaxLatencyMs.load(boost::memory_order_relaxed);
+			if(m_DoubleBuffer)
+			{
+				m_DoubleBuffer->WaitForWork(nMaxLatencyMs);
+			}
+			else
+			{
+				m_Queue.WaitForWork(nMaxLatencyMs);
+			}
+			Sync();
+		}
+	}
+
+	void QueuedFileAppender::SetFlushTrigger(size_t nRecords, size_t nBytes, unsigned nMaxLatencyMs)
+	{
+		m_nMaxLatencyMs.store(nMaxLatencyMs, boost::memory_order_relaxed);
+		// the writer may be parked on the old deadline
+		if(m_DoubleBuffer)
+		{
+			m_DoubleBuffer->SetWakeThreshold(nRecords, nBytes);
+			m_DoubleBuffer->Wake(true);
+		}
+		else
+		{
+			m_Queue.SetWakeThreshold(nRecords, nBytes);
+			m_Queue.Wake(true);
+		}
+	}
+
+	void QueuedFileAppender::SetQueueCapacity(size_t nMaxRecords, size_t nMaxBytes)
+	{
+		if(m_DoubleBuffer)
+		{
+			m_DoubleBuffer->SetCapacity(nMaxRecords, nMaxBytes);
+		}
+		else
+		{
+			m_Queue.SetCapacity(nMaxRecords, nMaxBytes);
+		}
+	}
+
+	void QueuedFileAppender::SetOverflowPolicy(OVERFLOW_POLICY policy, LOG_LEVEL dropLevel)
+	{
+		if(m_DoubleBuffer)
+		{
+			m_DoubleBuffer->SetOverflowPolicy(policy, dropLevel);
+		}
+		else
+		{
+			m_Queue.SetOverflowPolicy(policy, dropLevel);
+		}
+	}
+	
+	void QueuedFileAppender::Write(const std::string& msg)
+	{
+		if(m_DoubleBuffer)
+		{
+			m_DoubleBuffer->Push(msg, LOG_LEVEL_FATAL); // like a record created from text, never dropped by level
+			return;
+		}
+		std::string sText(msg);
+		m_Queue.PushMsg(LogRecord::Create(sText));
+	}
+
+	void QueuedFileAppender::Write(const LogRecordPtr& record)
+	{
+		// timing every call would cost about as much as the call itself
+		TelemetrySlot& slot = ThreadTelemetry();
+		if((slot.m_nEnqueues++ & 15) != 0)
+		{
+			Enqueue(record);
+			return;
+		}
+		boost::chrono::steady_clock::time_point tStart = boost::chrono::steady_clock::now();
+		Enqueue(record);
+		Bump(slot.m_EnqueueLatencyNs[TelemetryBucket(NanosSince(tStart))]);
+	}
+
+	void QueuedFileAppender::Enqueue(const LogRecordPtr& record)
+	{
+		if(m_DoubleBuffer)
+		{
+			if(record->IsDeferred())
+			{
+				// only while another appender still had Log format deferred
+				std::string sText;
+				TimeFormatter formatter;
+				record->Render(sText, formatter);
+				m_DoubleBuffer->Push(sText, record->GetLevel());
+			}
+			else
+			{
+				m_DoubleBuffer->Push(record->GetText(), record->GetLevel());
+			}
+			return;
+		}
+		m_Queue.PushMsg(record);
+	}
+
+	// a line in the usual layout, written after the records that survived
+	void QueuedFileAppender::WriteDropReport(size_t nDropped)
+	{
+		Bump(ThreadTelemetry().m_nDropped, nDropped);
+		m_sRenderBuf.clear();
+		m_TimeFormatter.Append(m_sRenderBuf, GetCurrentLogTime(), Log::Instance().GetTimePrecision());
+		m_sRenderBuf.append(" - ");
+		m_sRenderBuf.append(c_LogLevelTag[LOG_LEVEL_WARN]);
+		m_sRenderBuf.append(" - ");
+		AppendUInt(m_sRenderBuf, nDropped);
+		m_sRenderBuf.append(" messages dropped, the queue was full [ ");
+		m_sRenderBuf.append(__FILE__);
+		m_sRenderBuf.append(" : ");
+		AppendInt(m_sRenderBuf, __LINE__);
+		m_sRenderBuf.append(" ]\n");
+		std::string sReport;
+		sReport.swap(m_sRenderBuf); // WriteText uses m_sRenderBuf to encode
+		FileAppender::WriteText(sReport);
+	}
+
+	size_t QueuedFileAppender::GetQueueDepth() const
+	{
+		return m_DoubleBuffer ? m_DoubleBuffer->GetDepth() : m_Queue.GetDepth();
+	}
+
+	QueuedFileAppenderPtr QueuedFileAppender::Create(QUEUE_TYPE type)
+	{
+		return QueuedFileAppenderPtr(new QueuedFileAppender(type));
+	}
+
+#ifndef WIN32
+	// MmapFileAppender
+	MmapFileAppender::MmapFileAppender()
+		: m_nFile(-1)
+		, m_pWindow(0)
+		, m_nWindowSize(0)
+		, m_nWindowBase(0)
+		, m_nDataEnd(0)
+		, m_nReserved(0)
+		, m_nWindowEnd(0)
+		, m_nActive(0)
+		, m_bStopped(false)
+		, m_nGeneration(0)
+		, m_tRollover(0)
+		, m_nOpenVersion(0)
+		, m_Housekeeper(Housekeeper::Instance())
+	{
+		SetWindowSize(16 * 1024 * 1024);
+	}
+
+	MmapFileAppender::~MmapFileAppender()
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		StopWriters();
+		CloseFile();
+		m_Housekeeper->Release(m_sHeldFile);
+	}
+
+	MmapFileAppenderPtr MmapFileAppender::Create()
+	{
+		return MmapFileAppenderPtr(new MmapFileAppender());
+	}
+
+	void MmapFileAppender::SetWindowSize(size_t nBytes)
+	{
+		size_t nPage = sysconf(_SC_PAGESIZE);
+		m_nNextWindowSize = (nBytes + nPage - 1) / nPage * nPage;
+		if(m_nNextWindowSize == 0)
+		{
+			m_nNextWindowSize = nPage;
+		}
+	}
+
+	void MmapFileAppender::Write(const std::string& msg)
+	{
+		size_t nLen = msg.size();
+		unsigned nGeneration = m_nGeneration.load();
+		m_nActive.fetch_add(1); // before the check of m_bStopped, StopWriters does them the other way round
+		if(!m_bStopped.load() && m_pWindow && time(NULL) < m_tRollover && m_nOpenVersion == m_nNameVersion)
+		{
+			size_t nPos = m_nReserved.fetch_add(nLen, boost::memory_order_relaxed);
+			if(nPos + nLen <= m_nWindowSize)
+			{
+				memcpy(m_pWindow + nPos, msg.data(), nLen);
+				m_nActive.fetch_sub(1, boost::memory_order_release);
+				Bump(ThreadTelemetry().m_nBytesWritten, nLen);
+				return;
+			}
+			if(nPos < m_nWindowSize)
+			{
+				m_nWindowEnd.store(nPos, boost::memory_order_relaxed); // only one line can cross the end
+			}
+		}
+		m_nActive.fetch_sub(1);
+		WriteSlow(msg, nGeneration);
+	}
+
+	void MmapFileAppender::WriteSlow(const std::string& msg, unsigned nGeneration)
+	{
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			// another writer may have mapped the next window in the meantime
+			if(m_nGeneration.load() == nGeneration)
+			{
+				StopWriters();
+				time_t ttNow = time(NULL);
+				if(!m_pWindow && ttNow < m_tRollover)
+				{
+					m_bStopped.store(false);
+					return; // a failed open or map is retried after a second, the lines are lost until then
+				}
+				if(m_nFile < 0 || ttNow >= m_tRollover || m_nOpenVersion != m_nNameVersion)
+				{
+					Reopen(ttNow);
+				}
+				else if(!MapWindow(msg.size()))
+				{
+					m_tRollover = ttNow + 1;
+				}
+				m_nGeneration.fetch_add(1);
+				m_bStopped.store(false);
+				if(!m_pWindow)
+				{
+					return;
+				}
+			}
+		}
+		Write(msg);
+	}
+
+	void MmapFileAppender::StopWriters()
+	{
+		m_bStopped.store(true);
+		while(m_nActive.load() != 0)
+		{
+			boost::this_thread::yield(); // a writer in the window only has a memcpy left
+		}
+		if(m_pWindow)
+		{
+			size_t nReserved = m_nReserved.load(boost::memory_order_relaxed);
+			m_nDataEnd = m_nWindowBase + (nReserved <= m_nWindowSize ? nReserved : m_nWindowEnd.load(boost::memory_order_relaxed));
+		}
+	}
+
+	void MmapFileAppender::Reopen(time_t ttNow)
+	{
+		CloseFile();
+		m_Housekeeper->Release(m_sHeldFile); // truncated to the data, it can be compressed now
+		m_tRollover = NextRolloverTime(ttNow);
+		m_nOpenVersion = m_nNameVersion;
+		m_Housekeeper->Watch(*this); // after the close, yesterday's file can be compressed
+		string sFileName = m_sHeldFile = m_Housekeeper->Hold(*this, "");
+		m_nFile = open(sFileName.c_str(), O_RDWR | O_CREAT, 0644);
+		if(m_nFile < 0)
+		{
+			cout << "open file failed: " << sFileName << endl;
+			m_tRollover = ttNow + 1; // try again in a second
+			return;
+		}
+		m_nDataEnd = FindDataEnd();
+		if(!MapWindow(0))
+		{
+			m_tRollover = ttNow + 1;
+		}
+		Bump(ThreadTelemetry().m_nOpens);
+	}
+
+	bool MmapFileAppender::MapWindow(size_t nMinSize)
+	{
+		Unmap();
+		size_t nPage = sysconf(_SC_PAGESIZE);
+		unsigned long long nBase = m_nDataEnd - m_nDataEnd % nPage;
+		size_t nStart = size_t(m_nDataEnd - nBase);
+		size_t nSize = max(m_nNextWindowSize, (nStart + nMinSize + nPage - 1) / nPage * nPage);
+		int nError = posix_fallocate(m_nFile, off_t(nBase), off_t(nSize));
+		if(nError != 0)
+		{
+			cout << "allocate file failed: " << strerror(nError) << endl;
+			return false;
+		}
+		void* p = mmap(0, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_nFile, off_t(nBase));
+		if(p == MAP_FAILED)
+		{
+			cout << "map file failed: " << strerror(errno) << endl;
+			return false;
+		}
+		m_pWindow = static_cast<char*>(p);
+		m_nWindowSize = nSize;
+		m_nWindowBase = nBase;
+		m_nReserved.store(nStart, boost::memory_order_relaxed);
+		m_nWindowEnd.store(nSize, boost::memory_order_relaxed);
+		return true;
+	}
+
+	void MmapFileAppender::Unmap()
+	{
+		if(m_pWindow)
+		{
+			munmap(m_pWindow, m_nWindowSize);
+			m_pWindow = 0;
+			m_nWindowSize = 0;
+		}
+	}
+
+	void MmapFileAppender::CloseFile()
+	{
+		if(m_nFile < 0)
+		{
+			return;
+		}
+		Unmap();
+		if(ftruncate(m_nFile, off_t(m_nDataEnd)) != 0)
+		{
+			cout << "truncate file failed: " << strerror(errno) << endl;
+		}
+		close(m_nFile);
+		m_nFile = -1;
+		Bump(ThreadTelemetry().m_nCloses);
+	}
+
+	unsigned long long MmapFileAppender::FindDataEnd()
+	{
+		struct stat st;
+		if(fstat(m_nFile, &st) != 0)
+		{
+			return 0;
+		}
+		unsigned long long nEnd = st.st_size;
+		char buf[64 * 1024];
+		while(nEnd > 0)
+		{
+			size_t nLen = size_t(min<unsigned long long>(nEnd, sizeof(buf)));
+			if(pread(m_nFile, buf, nLen, off_t(nEnd - nLen)) != ssize_t(nLen))
+			{
+				break;
+			}
+			for(size_t i = nLen; i > 0; i--)
+			{
+				if(buf[i - 1] != 0)
+				{
+					return nEnd - nLen + i;
+				}
+			}
+			nEnd -= nLen;
+		}
+		return nEnd;
+	}
+#endif
+
+	// queue
+
+	// the credit of a ring packs records in the high bits and bytes in the low ones, so both change together
+	static const int c_nCreditShift = 40;
+	static const unsigned long long c_nCreditBytesMask = (1ULL << c_nCreditShift) - 1;
+
+	// ring of records written by one thread. the slots own a reference to their record.
+	// when the ring is full the producer spills into a locked list, and keeps doing so until
+	// the consumer has taken the list, so the records of one thread always come out in order
+	class RecordRing
+	{
+	public:
+		explicit RecordRing(size_t nCapacity)
+			: m_pSlots(new boost::atomic<const LogRecord*>[nCapacity])
+			, m_nMask(nCapacity - 1)
+			, m_nHead(0)
+			, m_nTail(0)
+			, m_bSpilling(false)
+			, m_bClosed(false)
+			, m_nCredit(0)
+		{}
+
+		~RecordRing()
+		{
+			LogRecordPtr record;
+			while(Pop(record))
+			{
+			}
+			delete[] m_pSlots;
+		}
+
+		// producer
+		void Push(const LogRecordPtr& record)
+		{
+			if(!m_bSpilling.load(boost::memory_order_acquire))
+			{
+				size_t nTail = m_nTail.load(boost::memory_order_relaxed);
+				if(nTail - m_nHead.load(boost::memory_order_acquire) <= m_nMask)
+				{
+					intrusive_ptr_add_ref(record.get());
+					m_pSlots[nTail & m_nMask].store(record.get(), boost::memory_order_relaxed);
+					m_nTail.store(nTail + 1, boost::memory_order_release);
+					return;
+				}
+			}
+			boost::lock_guard<LogMutex> lock(m_SpillMutex);
+			m_bSpilling.store(true, boost::memory_order_relaxed);
+			m_Spill.push_back(record);
+		}
+
+		// the head only moves by compare and swap, so a slot is taken by exactly one caller
+		bool Pop(LogRecordPtr& record)
+		{
+			size_t nHead = m_nHead.load(boost::memory_order_acquire);
+			while(nHead != m_nTail.load(boost::memory_order_acquire))
+			{
+				const LogRecord* p = m_pSlots[nHead & m_nMask].load(boost::memory_order_relaxed);
+				if(m_nHead.compare_exchange_weak(nHead, nHead + 1, boost::memory_order_acq_rel))
+				{
+					record = LogRecordPtr(p, false); // adopts the reference of the slot
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// producer, makes room for the overflow policy
+		bool PopOldest(LogRecordPtr& record)
+		{
+			if(Pop(record))
+			{
+				return true;
+			}
+			boost::lock_guard<LogMutex> lock(m_SpillMutex);
+			if(m_Spill.empty())
+			{
+				return false;
+			}
+			record.swap(m_Spill.front());
+			m_Spill.pop_front();
+			return true;
+		}
+
+		// consumer, ring first: everything in the spill list is newer
+		void Drain(std::vector<LogRecordPtr>& vRecords)
+		{
+			LogRecordPtr record;
+			while(Pop(record))
+			{
+				vRecords.push_back(LogRecordPtr());
+				vRecords.back().swap(record);
+			}
+			if(m_bSpilling.load(boost::memory_order_acquire))
+			{
+				boost::lock_guard<LogMutex> lock(m_SpillMutex);
+				vRecords.insert(vRecords.end(), m_Spill.begin(), m_Spill.end());
+				m_Spill.clear();
+				m_bSpilling.store(false, boost::memory_order_release);
+			}
+		}
+
+		void Close() { m_bClosed.store(true, boost::memory_order_release); }
+		bool IsClosed() const { return m_bClosed.load(boost::memory_order_acquire); }
+
+		// producer, uses a record and nBytes of the capacity the ring holds. seq_cst, see SafeQueue::PushMsg
+		bool TakeCredit(size_t nBytes)
+		{
+			unsigned long long nCredit = m_nCredit.load(boost::memory_order_relaxed);
+			while((nCredit >> c_nCreditShift) != 0 && (nCredit & c_nCreditBytesMask) >= nBytes)
+			{
+				if(m_nCredit.compare_exchange_weak(nCredit, nCredit - ((1ULL << c_nCreditShift) + nBytes),
+					boost::memory_order_seq_cst, boost::memory_order_relaxed))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void AddCredit(size_t nRecords, size_t nBytes)
+		{
+			m_nCredit.fetch_add(((unsigned long long)nRecords << c_nCreditShift) + nBytes, boost::memory_order_relaxed);
+		}
+
+		// bTake gives it all back to the queue
+		void GetCredit(size_t& nRecords, size_t& nBytes, bool bTake)
+		{
+			unsigned long long nCredit = bTake ? m_nCredit.exchange(0, boost::memory_order_relaxed) : m_nCredit.load(boost::memory_order_seq_cst);
+			nRecords = size_t(nCredit >> c_nCreditShift);
+			nBytes = size_t(nCredit & c_nCreditBytesMask);
+		}
+
+	private:
+		RecordRing(const RecordRing&);
+		RecordRing& operator=(const RecordRing&);
+
+		boost::atomic<const LogRecord*>* m_pSlots;
+		size_t m_nMask;
+		boost::atomic<size_t> m_nHead; // next slot to pop
+		boost::atomic<size_t> m_nTail; // next slot to push, only the producer moves it
+		boost::atomic<bool> m_bSpilling;
+		boost::atomic<bool> m_bClosed; // the producer thread has exited
+		LogMutex m_SpillMutex;
+		std::deque<LogRecordPtr> m_Spill;
+		boost::atomic<unsigned long long> m_nCredit; // counted in the queue's capacity, not pushed yet
+	};
+	static const size_t c_nRingCapacity = 4096; // records, a power of two
+	static const size_t c_nCreditRecords = 64; // the most a ring takes from the capacity at once
+	static const size_t c_nCreditBytes = 64 * 1024;
+
+	// the rings of one thread, one per queue it has written to. the rings are closed when the thread exits
+	struct ThreadRings
+	{
+		ThreadRings() : m_nLastId(0), m_pLast(0) {}
+		~ThreadRings()
+		{
+			for(size_t i = 0; i < m_vRings.size(); i++)
+			{
+				m_vRings[i].second->Close();
+			}
+		}
+		std::vector<std::pair<unsigned long, RecordRingPtr> > m_vRings;
+		unsigned long m_nLastId;
+		RecordRing* m_pLast;
+	};
+	static boost::thread_specific_ptr<ThreadRings>* s_pThreadRings = new boost::thread_specific_ptr<ThreadRings>();
+	static boost::atomic<unsigned long> s_nNextQueueId(1);
+
+	SafeQueue::SafeQueue()
+		: m_nMaxRecords(1000000)
+		, m_nMaxBytes(256 * 1024 * 1024)
+		, m_Policy(OVERFLOW_BLOCK)
+		, m_DropLevel(LOG_LEVEL_WARN)
+		, m_nRecords(0)
+		, m_nBytes(0)
+		, m_nDropped(0)
+		, m_nBlocked(0)
+		, m_nWakeRecords(4096)
+		, m_nWakeBytes(1024 * 1024)
+		, m_bParked(false)
+		, m_bWake(false)
+		, m_nId(s_nNextQueueId.fetch_add(1))
+		, m_nVersion(0)
+		, m_nConsumerVersion(0)
+	{}
+
+	SafeQueue::~SafeQueue()
+	{
+		// the threads still hold their rings, they never find this queue's id again
+		boost::lock_guard<LogMutex> lock(m_RegistryMutex);
+		for(size_t i = 0; i < m_vRings.size(); i++)
+		{
+			m_vRings[i]->Close();
+		}
+	}
+
+	RecordRing& SafeQueue::GetRing()
+	{
+		ThreadRings* pRings = s_pThreadRings->get();
+		if(!pRings)
+		{
+			pRings = new ThreadRings();
+			s_pThreadRings->reset(pRings);
+		}
+		if(pRings->m_nLastId == m_nId)
+		{
+			return *pRings->m_pLast;
+		}
+		RecordRing* pRing = 0;
+		for(size_t i = 0; i < pRings->m_vRings.size(); i++)
+		{
+			if(pRings->m_vRings[i].first == m_nId)
+			{
+				pRing = pRings->m_vRings[i].second.get();
+				break;
+			}
+		}
+		if(!pRing)
+		{
+			// forget the rings of queues that are gone
+			for(size_t i = pRings->m_vRings.size(); i > 0; i--)
+			{
+				if(pRings->m_vRings[i - 1].second->IsClosed())
+				{
+					pRings->m_vRings.erase(pRings->m_vRings.begin() + (i - 1));
+				}
+			}
+			RecordRingPtr ring(new RecordRing(c_nRingCapacity));
+			pRings->m_vRings.push_back(std::make_pair(m_nId, ring));
+			pRing = ring.get();
+			boost::lock_guard<LogMutex> lock(m_RegistryMutex);
+			m_vRings.push_back(ring);
+			m_nVersion.fetch_add(1, boost::memory_order_release);
+		}
+		pRings->m_nLastId = m_nId;
+		pRings->m_pLast = pRing;
+		return *pRing;
+	}
+
+	bool SafeQueue::PushMsg(const LogRecordPtr& record)
+	{
+		size_t nBytes = record->GetText().size();
+		RecordRing& ring = GetRing();
+		if(!Reserve(ring, nBytes))
+		{
+			switch(m_Policy.load(boost::memory_order_relaxed))
+			{
+			case OVERFLOW_DROP_NEWEST:
+				m_nDropped.fetch_add(1, boost::memory_order_relaxed);
+				return false;
+			case OVERFLOW_DROP_OLDEST:
+				{
+					LogRecordPtr oldest;
+					if(!ring.PopOldest(oldest))
+					{
+						// this thread has nothing queued, its new record is the oldest it can drop
+						m_nDropped.fetch_add(1, boost::memory_order_relaxed);
+						return false;
+					}
+					ring.AddCredit(1, oldest->GetText().size());
+					m_nDropped.fetch_add(1, boost::memory_order_relaxed);
+					if(!Reserve(ring, nBytes))
+					{
+						m_nDropped.fetch_add(1, boost::memory_order_relaxed);
+						return false;
+					}
+				}
+				break;
+			case OVERFLOW_DROP_BELOW_LEVEL:
+				if(record->GetLevel() < m_DropLevel.load(boost::memory_order_relaxed))
+				{
+					m_nDropped.fetch_add(1, boost::memory_order_relaxed);
+					return false;
+				}
+				WaitForRoom(ring, nBytes);
+				break;
+			default:
+				WaitForRoom(ring, nBytes);
+				break;
+			}
+		}
+		ring.Push(record);
+		// the record was counted (in the counters or out of the ring's credit) by a seq_cst operation, and the
+		// consumer parks before it looks at them, so either it sees this record or this thread sees it parked
+		if(m_bParked.load(boost::memory_order_seq_cst) && IsReady(false))
+		{
+			Wake();
+		}
+		return true;
+	}
+
+	// the counters also hold the credit of the rings, a producer may wake the consumer a little early with them.
+	// the consumer takes the credit off, so it does not wake up again and again for records nobody pushed
+	bool SafeQueue::IsReady(bool bConsumer)
+	{
+		size_t nCreditRecords = 0;
+		size_t nCreditBytes = 0;
+		if(bConsumer)
+		{
+			RefreshRings();
+			for(size_t i = 0; i < m_vConsumerRings.size(); i++)
+			{
+				size_t nRecords = 0, nBytes = 0;
+				m_vConsumerRings[i]->GetCredit(nRecords, nBytes, false);
+				nCreditRecords += nRecords;
+				nCreditBytes += nBytes;
+			}
+		}
+		// the credit first: a ring takes more of it only after the counters went up
+		size_t nRecords = m_nRecords.load(boost::memory_order_seq_cst);
+		size_t nBytes = m_nBytes.load(boost::memory_order_seq_cst);
+		nRecords = (nRecords > nCreditRecords) ? nRecords - nCreditRecords : 0;
+		nBytes = (nBytes > nCreditBytes) ? nBytes - nCreditBytes : 0;
+		return nRecords >= m_nWakeRecords.load(boost::memory_order_relaxed)
+			|| nBytes >= m_nWakeBytes.load(boost::memory_order_relaxed)
+			|| m_nBlocked.load(boost::memory_order_seq_cst) > 0;
+	}
+
+	void SafeQueue::Wake(bool bAlways)
+	{
+		// only the first producer to see the consumer parked takes the lock
+		if(m_bParked.exchange(false, boost::memory_order_seq_cst) || bAlways)
+		{
+			boost::lock_guard<LogMutex> lock(m_WakeMutex);
+			m_bWake = true;
+			m_WakeCond.notify_one();
+		}
+	}
+
+	void SafeQueue::WaitForWork(unsigned nMaxWaitMs)
+	{
+		boost::system_time tDeadline = boost::get_system_time() + boost::posix_time::milliseconds(nMaxWaitMs);
+		boost::unique_lock<LogMutex> lock(m_WakeMutex);
+		m_bParked.store(true, boost::memory_order_seq_cst);
+		while(!m_bWake && !IsReady(true))
+		{
+			if(!m_WakeCond.timed_wait(lock, tDeadline))
+			{
+				break;
+			}
+		}
+		m_bWake = false;
+		m_bParked.store(false, boost::memory_order_relaxed);
+	}
+
+	void SafeQueue::SetWakeThreshold(size_t nRecords, size_t nBytes)
+	{
+		m_nWakeRecords.store(nRecords ? nRecords : 1, boost::memory_order_relaxed);
+		m_nWakeBytes.store(nBytes ? nBytes : 1, boost::memory_order_relaxed);
+	}
+
+	bool SafeQueue::Reserve(RecordRing& ring, size_t nBytes)
+	{
+		if(ring.TakeCredit(nBytes))
+		{
+			return true;
+		}
+		// the ring takes a batch of the capacity and pushes the next records without touching the shared
+		// counters. at most a 64th of the capacity and a 16th of the wake up threshold, so the credit left in
+		// the rings neither fills the queue nor wakes the consumer much early. a small queue counts every record
+		size_t nMaxRecords = m_nMaxRecords.load(boost::memory_order_relaxed);
+		size_t nMaxBytes = m_nMaxBytes.load(boost::memory_order_relaxed);
+		size_t nBatch = std::min(c_nCreditRecords, m_nWakeRecords.load(boost::memory_order_relaxed) / 16);
+		size_t nBatchBytes = std::min(c_nCreditBytes, m_nWakeBytes.load(boost::memory_order_relaxed) / 16);
+		nBatch = nMaxRecords ? std::min(nBatch, nMaxRecords / 64) : nBatch;
+		nBatchBytes = nMaxBytes ? std::min(nBatchBytes, nMaxBytes / 64) : nBatchBytes;
+		// what is left runs out of records or of bytes, it goes back so the other one does not pile up
+		size_t nLeftRecords = 0, nLeftBytes = 0;
+		ring.GetCredit(nLeftRecords, nLeftBytes, true);
+		if(nLeftRecords > 0 || nLeftBytes > 0)
+		{
+			Unreserve(nLeftRecords, nLeftBytes);
+		}
+		if(nBatch > 1 && nBatchBytes > 0 && TryReserve(nBatch, nBytes + nBatchBytes))
+		{
+			ring.AddCredit(nBatch - 1, nBatchBytes);
+			return true;
+		}
+		return TryReserve(1, nBytes);
+	}
+
+	bool SafeQueue::TryReserve(size_t nRecords, size_t nBytes)
+	{
+		size_t nMaxRecords = m_nMaxRecords.load(boost::memory_order_relaxed);
+		size_t nMaxBytes = m_nMaxBytes.load(boost::memory_order_relaxed);
+		// seq_cst for the consumer's wake up (see PushMsg), the bound alone would do with relaxed.
+		// with credit this runs once per batch, not per record
+		size_t nTotalRecords = m_nRecords.fetch_add(nRecords, boost::memory_order_seq_cst) + nRecords;
+		size_t nTotalBytes = m_nBytes.fetch_add(nBytes, boost::memory_order_seq_cst) + nBytes;
+		// a single record is always let into an empty queue, however big it is
+		if((nMaxRecords && nTotalRecords > nMaxRecords) || (nMaxBytes && nTotalBytes > nMaxBytes && nTotalRecords > 1))
+		{
+			Unreserve(nRecords, nBytes);
+			return false;
+		}
+		return true;
+	}
+
+	void SafeQueue::Unreserve(size_t nRecords, size_t nBytes)
+	{
+		m_nRecords.fetch_sub(nRecords, boost::memory_order_relaxed);
+		m_nBytes.fetch_sub(nBytes, boost::memory_order_relaxed);
+	}
+
+	// polls as well as waits, so a wake up that comes before the wait is not missed for long
+	void SafeQueue::WaitForRoom(RecordRing& ring, size_t nBytes)
+	{
+		m_nBlocked.fetch_add(1, boost::memory_order_seq_cst);
+		Wake(); // the queue is full, no point waiting for the writer's deadline
+		while(!Reserve(ring, nBytes))
+		{
+			boost::unique_lock<LogMutex> lock(m_RoomMutex);
+			m_RoomCond.timed_wait(lock, boost::posix_time::milliseconds(10));
+		}
+		m_nBlocked.fetch_sub(1, boost::memory_order_relaxed);
+	}
+
+	void SafeQueue::SetCapacity(size_t nMaxRecords, size_t nMaxBytes)
+	{
+		m_nMaxRecords.store(nMaxRecords, boost::memory_order_relaxed);
+		m_nMaxBytes.store(nMaxBytes, boost::memory_order_relaxed);
+	}
+
+	void SafeQueue::SetOverflowPolicy(OVERFLOW_POLICY policy, LOG_LEVEL dropLevel)
+	{
+		m_Policy.store(policy, boost::memory_order_relaxed);
+		m_DropLevel.store(dropLevel, boost::memory_order_relaxed);
+	}
+
+	size_t SafeQueue::TakeDropped()
+	{
+		return m_nDropped.exchange(0, boost::memory_order_relaxed);
+	}
+
+	void SafeQueue::RefreshRings()
+	{
+		unsigned nVersion = m_nVersion.load(boost::memory_order_acquire);
+		if(nVersion != m_nConsumerVersion)
+		{
+			boost::lock_guard<LogMutex> lock(m_RegistryMutex);
+			m_vConsumerRings = m_vRings;
+			m_nConsumerVersion = m_nVersion.load(boost::memory_order_relaxed);
+		}
+	}
+
+	void SafeQueue::PopAll(std::vector<LogRecordPtr>& vRecords)
+	{
+		RefreshRings();
+		m_vDrained.resize(m_vConsumerRings.size());
+		bool bClosed = false;
+		size_t nFreeRecords = 0;
+		size_t nFreeBytes = 0;
+		for(size_t i = 0; i < m_vConsumerRings.size(); i++)
+		{
+			// a ring seen closed before draining is empty after it, its thread is gone
+			bClosed = m_vConsumerRings[i]->IsClosed() || bClosed;
+			m_vConsumerRings[i]->Drain(m_vDrained[i]);
+			if(m_vDrained[i].empty())
+			{
+				// the credit of an idle ring goes back, a thread that stopped logging holds no capacity
+				TakeCredit(*m_vConsumerRings[i], nFreeRecords, nFreeBytes);
+			}
+		}
+		if(bClosed)
+		{
+			boost::lock_guard<LogMutex> lock(m_RegistryMutex);
+			for(size_t i = m_vRings.size(); i > 0; i--)
+			{
+				if(m_vRings[i - 1]->IsClosed())
+				{
+					// closed after we drained it, its last records go after the ones already drained from it and
+					// into the same merge. a ring registered since RefreshRings() gets a slot of its own
+					size_t nSlot = std::find(m_vConsumerRings.begin(), m_vConsumerRings.end(), m_vRings[i - 1]) - m_vConsumerRings.begin();
+					if(nSlot == m_vConsumerRings.size())
+					{
+						nSlot = m_vDrained.size();
+						m_vDrained.resize(nSlot + 1);
+					}
+					m_vRings[i - 1]->Drain(m_vDrained[nSlot]);
+					TakeCredit(*m_vRings[i - 1], nFreeRecords, nFreeBytes);
+					m_vRings.erase(m_vRings.begin() + (i - 1));
+				}
+			}
+			m_nVersion.fetch_add(1, boost::memory_order_release);
+		}
+		size_t nFirst = vRecords.size();
+		Merge(vRecords);
+
+		if(vRecords.size() > nFirst || nFreeRecords > 0 || nFreeBytes > 0)
+		{
+			for(size_t i = nFirst; i < vRecords.size(); i++)
+			{
+				nFreeBytes += vRecords[i]->GetText().size();
+			}
+			Unreserve(vRecords.size() - nFirst + nFreeRecords, nFreeBytes);
+			if(m_nBlocked.load(boost::memory_order_seq_cst) > 0)
+			{
+				boost::lock_guard<LogMutex> lock(m_RoomMutex);
+				m_RoomCond.notify_all();
+			}
+		}
+	}
+
+	void SafeQueue::TakeCredit(RecordRing& ring, size_t& nRecords, size_t& nBytes)
+	{
+		size_t nRingRecords = 0, nRingBytes = 0;
+		ring.GetCredit(nRingRecords, nRingBytes, true);
+		nRecords += nRingRecords;
+		nBytes += nRingBytes;
+	}
+
+	// orders by time, records with the same time keep the order of their rings
+	struct MergeHead
+	{
+		LogTime m_Time;
+		size_t m_nRing;
+		bool operator<(const MergeHead& other) const // reversed, std::priority_queue pops the largest
+		{
+			if(m_Time.m_nSec != other.m_Time.m_nSec)
+			{
+				return m_Time.m_nSec > other.m_Time.m_nSec;
+			}
+			if(m_Time.m_nNanoSec != other.m_Time.m_nNanoSec)
+			{
+				return m_Time.m_nNanoSec > other.m_Time.m_nNanoSec;
+			}
+			return m_nRing > other.m_nRing;
+		}
+	};
+
+	void SafeQueue::Merge(std::vector<LogRecordPtr>& vRecords)
+	{
+		std::priority_queue<MergeHead> heads;
+		std::vector<size_t> vPos(m_vDrained.size(), 0);
+		for(size_t i = 0; i < m_vDrained.size(); i++)
+		{
+			if(!m_vDrained[i].empty())
+			{
+				MergeHead head = { m_vDrained[i][0]->GetTime(), i };
+				heads.push(head);
+			}
+		}
+		if(heads.size() == 1)
+		{
+			std::vector<LogRecordPtr>& vOnly = m_vDrained[heads.top().m_nRing];
+			vRecords.insert(vRecords.end(), vOnly.begin(), vOnly.end());
+			vOnly.clear();
+			return;
+		}
+		while(!heads.empty())
+		{
+			MergeHead head = heads.top();
+			heads.pop();
+			std::vector<LogRecordPtr>& vRing = m_vDrained[head.m_nRing];
+			size_t& nPos = vPos[head.m_nRing];
+			vRecords.push_back(LogRecordPtr());
+			vRecords.back().swap(vRing[nPos++]);
+			if(nPos < vRing.size())
+			{
+				head.m_Time = vRing[nPos]->GetTime();
+				heads.push(head);
+			}
+			else
+			{
+				vRing.clear();
+			}
+		}
+	}
+
+	// DoubleBufferQueue
+	DoubleBufferQueue::DoubleBufferQueue()
+		: m_nMaxRecords(1000000)
+		, m_nMaxBytes(256 * 1024 * 1024)
+		, m_Policy(OVERFLOW_BLOCK)
+		, m_DropLevel(LOG_LEVEL_WARN)
+		, m_nDropped(0)
+		, m_nWakeRecords(4096)
+		, m_nWakeBytes(1024 * 1024)
+		, m_bParked(false)
+		, m_bWake(false)
+	{}
+
+	bool DoubleBufferQueue::Push(const std::string& sLine, LOG_LEVEL level)
+	{
+		boost::unique_lock<LogMutex> lock(m_Mutex);
+		// a single line is always let into an empty buffer, however big it is
+		while(!m_vFrontEnds.empty() && ((m_nMaxRecords && m_vFrontEnds.size() >= m_nMaxRecords)
+			|| (m_nMaxBytes && m_sFront.size() + sLine.size() > m_nMaxBytes)))
+		{
+			if(m_Policy == OVERFLOW_DROP_NEWEST || m_Policy == OVERFLOW_DROP_OLDEST
+				|| (m_Policy == OVERFLOW_DROP_BELOW_LEVEL && level < m_DropLevel))
+			{
+				m_nDropped++;
+				return false;
+			}
+			m_bWake = true; // the buffer is full, no point waiting for the writer's deadline
+			m_WakeCond.notify_one();
+			m_RoomCond.wait(lock);
+		}
+		m_sFront.append(sLine);
+		m_vFrontEnds.push_back(m_sFront.size());
+		if(m_bParked && IsReady())
+		{
+			m_bParked = false; // one signal is enough
+			m_bWake = true;
+			m_WakeCond.notify_one();
+		}
+		return true;
+	}
+
+	void DoubleBufferQueue::Swap(std::string& sLines, std::vector<size_t>& vEnds)
+	{
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			m_sFront.swap(sLines);
+			m_vFrontEnds.swap(vEnds);
+		}
+		m_RoomCond.notify_all();
+	}
+
+	size_t DoubleBufferQueue::GetDepth()
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		return m_vFrontEnds.size();
+	}
+
+	void DoubleBufferQueue::SetCapacity(size_t nMaxRecords, size_t nMaxBytes)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_nMaxRecords = nMaxRecords;
+		m_nMaxBytes = nMaxBytes;
+	}
+
+	void DoubleBufferQueue::SetOverflowPolicy(OVERFLOW_POLICY policy, LOG_LEVEL dropLevel)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_Policy = policy;
+		m_DropLevel = dropLevel;
+	}
+
+	size_t DoubleBufferQueue::TakeDropped()
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		size_t nDropped = m_nDropped;
+		m_nDropped = 0;
+		return nDropped;
+	}
+
+	void DoubleBufferQueue::SetWakeThreshold(size_t nRecords, size_t nBytes)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_nWakeRecords = nRecords ? nRecords : 1;
+		m_nWakeBytes = nBytes ? nBytes : 1;
+	}
+
+	void DoubleBufferQueue::WaitForWork(unsigned nMaxWaitMs)
+	{
+		boost::system_time tDeadline = boost::get_system_time() + boost::posix_time::milliseconds(nMaxWaitMs);
+		boost::unique_lock<LogMutex> lock(m_Mutex);
+		m_bParked = true;
+		while(!m_bWake && !IsReady())
+		{
+			if(!m_WakeCond.timed_wait(lock, tDeadline))
+			{
+				break;
+			}
+		}
+		m_bWake = false;
+		m_bParked = false;
+	}
+
+	void DoubleBufferQueue::Wake(bool bAlways)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		if(m_bParked || bAlways)
+		{
+			m_bWake = true;
+			m_WakeCond.notify_one();
+		}
+	}
+
+	//utils
+	string GetLogTime()
+	{
+		string sTime;
+		TimeFormatter().Append(sTime, GetCurrentLogTime(), TIME_PRECISION_SECOND);
+		return sTime;
+	}
+
+#ifndef WIN32
+	// memory stays at two chunks plus the deflate state, whatever the file size
+	bool GzipFile(const std::string& sSrc, const std::string& sDst, int nLevel, IoBudget* pBudget)
+	{
+		const size_t c_nChunk = 64 * 1024;
+		FILE* pIn = fopen(sSrc.c_str(), "rb");
+		if(!pIn)
+		{
+			cout << "open file failed: " << sSrc << endl;
+			return false;
+		}
+		string sTmp = sDst + ".tmp";
+		FILE* pOut = fopen(sTmp.c_str(), "wb");
+		if(!pOut)
+		{
+			fclose(pIn);
+			cout << "open file failed: " << sTmp << endl;
+			return false;
+		}
+
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		// 16 + 15: the biggest window with a gzip header and trailer instead of the zlib ones
+		if(deflateInit2(&zs, nLevel, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			fclose(pIn);
+			fclose(pOut);
+			::remove(sTmp.c_str());
+			cout << "deflate init failed: " << sSrc << endl;
+			return false;
+		}
+
+		std::vector<unsigned char> vIn(c_nChunk);
+		std::vector<unsigned char> vOut(c_nChunk);
+		bool bOk = true;
+		int nFlush = Z_NO_FLUSH;
+		while(bOk && nFlush != Z_FINISH)
+		{
+			zs.avail_in = (uInt)fread(&vIn[0], 1, c_nChunk, pIn);
+			zs.next_in = &vIn[0];
+			if(ferror(pIn))
+			{
+				bOk = false;
+				break;
+			}
+			if(pBudget)
+			{
+				pBudget->Take(zs.avail_in);
+			}
+			nFlush = feof(pIn) ? Z_FINISH : Z_NO_FLUSH;
+			do
+			{
+				zs.avail_out = (uInt)c_nChunk;
+				zs.next_out = &vOut[0];
+				deflate(&zs, nFlush);
+				size_t nHave = c_nChunk - zs.avail_out;
+				if(fwrite(&vOut[0], 1, nHave, pOut) != nHave)
+				{
+					bOk = false;
+					break;
+				}
+			} while(zs.avail_out == 0);
+		}
+		deflateEnd(&zs);
+		fclose(pIn);
+		if(fclose(pOut) != 0)
+		{
+			bOk = false;
+		}
+		if(bOk && ::rename(sTmp.c_str(), sDst.c_str()) != 0)
+		{
+			bOk = false;
+		}
+		if(!bOk)
+		{
+			::remove(sTmp.c_str());
+			cout << "compress file failed: " << sSrc << endl;
+		}
+		return bOk;
+	}
+
+	// block format, all the numbers are little endian
+	static const size_t c_nMemberHead = 20; // gzip header, XLEN, subfield id and length, member size
+	static const size_t c_nIndexEntry = 20; // offset, seconds, nanoseconds
+	static const size_t c_nMaxIndexEntries = 3000; // an extra field holds 64KB at most
+	static const size_t c_nTailSize = c_nMemberHead + 16 + 2 + 8;
+	static const size_t c_nMinFlushBlock = 64 * 1024;
+
+	static void PutLE(unsigned char* p, unsigned long long n, int nBytes)
+	{
+		for(int i = 0; i < nBytes; i++)
+		{
+			p[i] = (unsigned char)(n >> (8 * i));
+		}
+	}
+
+	static unsigned long long GetLE(const unsigned char* p, int nBytes)
+	{
+		unsigned long long n = 0;
+		for(int i = nBytes - 1; i >= 0; i--)
+		{
+			n = (n << 8) | p[i];
+		}
+		return n;
+	}
+
+	// a gzip member header with a "C" + cId extra subfield
+	static bool IsBlockMember(const unsigned char* p, char cId)
+	{
+		return p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && (p[3] & 4) && p[12] == 'C' && p[13] == cId;
+	}
+
+	static bool LogTimeLess(const LogTime& a, const LogTime& b)
+	{
+		return a.m_nSec < b.m_nSec || (a.m_nSec == b.m_nSec && a.m_nNanoSec < b.m_nNanoSec);
+	}
+
+	static int ParseDigits(const char* p, int nDigits)
+	{
+		int n = 0;
+		for(int i = 0; i < nDigits; i++)
+		{
+			n = n * 10 + (p[i] - '0');
+		}
+		return n;
+	}
+
+	// seconds and fraction, from the ':' before the seconds on
+	static bool ParseSeconds(const char* pText, size_t nLen, int& nSec, long& nNanoSec)
+	{
+		if(nLen < 19 || pText[16] != ':' || !isdigit((unsigned char)pText[17]) || !isdigit((unsigned char)pText[18]))
+		{
+			return false;
+		}
+		nSec = ParseDigits(pText + 17, 2);
+		nNanoSec = 0;
+		if(nLen > 20 && pText[19] == '.')
+		{
+			long nScale = 100000000;
+			for(size_t i = 20; i < nLen && i < 29 && isdigit((unsigned char)pText[i]); i++, nScale /= 10)
+			{
+				nNanoSec += (pText[i] - '0') * nScale;
+			}
+		}
+		return true;
+	}
+
+	bool ParseLogTime(const char* pText, size_t nLen, LogTime& tmLog)
+	{
+		static const char c_szPattern[] = "dddd/dd/dd dd:dd";
+		if(nLen < 19)
+		{
+			return false;
+		}
+		for(size_t i = 0; i < sizeof(c_szPattern) - 1; i++)
+		{
+			if(c_szPattern[i] == 'd' ? !isdigit((unsigned char)pText[i]) : pText[i] != c_szPattern[i])
+			{
+				return false;
+			}
+		}
+		int nSec = 0;
+		long nNanoSec = 0;
+		if(!ParseSeconds(pText, nLen, nSec, nNanoSec))
+		{
+			return false;
+		}
+		tm _tm;
+		memset(&_tm, 0, sizeof(_tm));
+		_tm.tm_year = ParseDigits(pText, 4) - 1900;
+		_tm.tm_mon = ParseDigits(pText + 5, 2) - 1;
+		_tm.tm_mday = ParseDigits(pText + 8, 2);
+		_tm.tm_hour = ParseDigits(pText + 11, 2);
+		_tm.tm_min = ParseDigits(pText + 14, 2);
+		_tm.tm_sec = nSec;
+		_tm.tm_isdst = -1;
+		tmLog.m_nSec = mktime(&_tm);
+		tmLog.m_nNanoSec = nNanoSec;
+		return tmLog.m_nSec != (time_t)-1;
+	}
+
+	// BlockLogWriter
+	BlockLogWriter::BlockLogWriter()
+		: m_pFile(0)
+		, m_bOk(false)
+		, m_nOffset(0)
+		, m_nBlockSize(1024 * 1024)
+		, m_tBlockStart(0)
+	{
+		m_LastTime.m_nSec = 0;
+		m_LastTime.m_nNanoSec = 0;
+	}
+
+	BlockLogWriter::~BlockLogWriter()
+	{
+		Close();
+	}
+
+	bool BlockLogWriter::Open(const std::string& sPath)
+	{
+		Close();
+		m_pFile = fopen(sPath.c_str(), "ab");
+		if(!m_pFile)
+		{
+			return false;
+		}
+		fseeko(m_pFile, 0, SEEK_END);
+		m_nOffset = ftello(m_pFile);
+		m_bOk = true;
+		m_sBlock.clear();
+		m_vBlocks.clear();
+		return true;
+	}
+
+	void BlockLogWriter::Write(const char* pData, size_t nLen)
+	{
+		if(!m_pFile)
+		{
+			return;
+		}
+		if(m_sBlock.empty())
+		{
+			m_tBlockStart = time(NULL);
+		}
+		m_sBlock.append(pData, nLen);
+		if(m_sBlock.size() >= m_nBlockSize)
+		{
+			// blocks end with a line, unless the line is longer than a block
+			size_t nEnd = m_sBlock.rfind('\n');
+			EndBlock(nEnd == string::npos ? m_sBlock.size() : nEnd + 1);
+		}
+	}
+
+	bool BlockLogWriter::Flush(bool bForce)
+	{
+		if(!m_pFile)
+		{
+			return false;
+		}
+		if(!m_sBlock.empty() && (bForce || m_sBlock.size() >= c_nMinFlushBlock || time(NULL) - m_tBlockStart >= 1))
+		{
+			EndBlock(m_sBlock.size());
+			if(fflush(m_pFile) != 0)
+			{
+				m_bOk = false;
+			}
+		}
+		return m_bOk;
+	}
+
+	bool BlockLogWriter::Close()
+	{
+		if(!m_pFile)
+		{
+			return true;
+		}
+		EndBlock(m_sBlock.size());
+		// the index, then the tail that points at it
+		static const unsigned char c_EmptyDeflate[2] = {0x03, 0x00};
+		unsigned long long nIndexOffset = m_nOffset;
+		std::vector<unsigned char> vIndex;
+		for(size_t nFirst = 0; nFirst < m_vBlocks.size(); nFirst += c_nMaxIndexEntries)
+		{
+			size_t nEntries = std::min(c_nMaxIndexEntries, m_vBlocks.size() - nFirst);
+			vIndex.resize(nEntries * c_nIndexEntry);
+			for(size_t i = 0; i < nEntries; i++)
+			{
+				const LogBlockInfo& info = m_vBlocks[nFirst + i];
+				PutLE(&vIndex[i * c_nIndexEntry], info.m_nOffset, 8);
+				PutLE(&vIndex[i * c_nIndexEntry + 8], (unsigned long long)info.m_FirstTime.m_nSec, 8);
+				PutLE(&vIndex[i * c_nIndexEntry + 16], info.m_FirstTime.m_nNanoSec, 4);
+			}
+			WriteMember('I', &vIndex[0], vIndex.size(), c_EmptyDeflate, sizeof(c_EmptyDeflate), 0, 0);
+		}
+		unsigned char tail[16];
+		PutLE(tail, nIndexOffset, 8);
+		PutLE(tail + 8, m_vBlocks.size(), 8);
+		WriteMember('T', tail, sizeof(tail), c_EmptyDeflate, sizeof(c_EmptyDeflate), 0, 0);
+		if(fclose(m_pFile) != 0)
+		{
+			m_bOk = false;
+		}
+		m_pFile = 0;
+		return m_bOk;
+	}
+
+	bool BlockLogWriter::EndBlock(size_t nLen)
+	{
+		if(nLen == 0)
+		{
+			return m_bOk;
+		}
+		const char* pText = m_sBlock.data();
+		LogBlockInfo info;
+		info.m_nOffset = m_nOffset;
+		info.m_FirstTime = m_LastTime;
+		for(size_t nPos = 0; nPos < nLen; )
+		{
+			size_t nEnd = m_sBlock.find('\n', nPos);
+			nEnd = (nEnd == string::npos || nEnd > nLen) ? nLen : nEnd;
+			if(ParseLogTime(pText + nPos, nEnd - nPos, info.m_FirstTime))
+			{
+				break;
+			}
+			nPos = nEnd + 1;
+		}
+		m_LastTime = info.m_FirstTime;
+
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		if(deflateInit2(&zs, 6, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			m_bOk = false;
+			return false;
+		}
+		m_vBuf.resize(deflateBound(&zs, (uLong)nLen) + 16);
+		zs.next_in = (Bytef*)pText;
+		zs.avail_in = (uInt)nLen;
+		zs.next_out = &m_vBuf[0];
+		zs.avail_out = (uInt)m_vBuf.size();
+		bool bDeflated = (deflate(&zs, Z_FINISH) == Z_STREAM_END);
+		size_t nData = m_vBuf.size() - zs.avail_out;
+		deflateEnd(&zs);
+		if(!bDeflated)
+		{
+			m_bOk = false;
+			return false;
+		}
+
+		unsigned char extra[12];
+		PutLE(extra, (unsigned long long)info.m_FirstTime.m_nSec, 8);
+		PutLE(extra + 8, info.m_FirstTime.m_nNanoSec, 4);
+		unsigned long nCrc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*)pText, (uInt)nLen);
+		WriteMember('L', extra, sizeof(extra), &m_vBuf[0], nData, nCrc, nLen);
+		info.m_nSize = (unsigned)(m_nOffset - info.m_nOffset);
+		m_vBlocks.push_back(info);
+		m_sBlock.erase(0, nLen);
+		m_tBlockStart = time(NULL);
+		return m_bOk;
+	}
+
+	bool BlockLogWriter::WriteMember(char cId, const unsigned char* pExtra, size_t nExtra, const unsigned char* pData, size_t nData, unsigned long nCrc, unsigned long nSize)
+	{
+		unsigned char head[c_nMemberHead] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff};
+		size_t nTotal = c_nMemberHead + nExtra + nData + 8;
+		PutLE(head + 10, 8 + nExtra, 2); // XLEN
+		head[12] = 'C';
+		head[13] = cId;
+		PutLE(head + 14, 4 + nExtra, 2);
+		PutLE(head + 16, nTotal, 4);
+		unsigned char trailer[8];
+		PutLE(trailer, nCrc, 4);
+		PutLE(trailer + 4, nSize, 4);
+		if(fwrite(head, 1, sizeof(head), m_pFile) != sizeof(head)
+			|| fwrite(pExtra, 1, nExtra, m_pFile) != nExtra
+			|| fwrite(pData, 1, nData, m_pFile) != nData
+			|| fwrite(trailer, 1, sizeof(trailer), m_pFile) != sizeof(trailer))
+		{
+			m_bOk = false;
+		}
+		m_nOffset += nTotal;
+		return m_bOk;
+	}
+
+	// BlockLogReader
+	BlockLogReader::BlockLogReader()
+		: m_pFile(0)
+		, m_bIndexed(false)
+		, m_tMinute(-1)
+	{
+		memset(m_szMinute, 0, sizeof(m_szMinute));
+	}
+
+	BlockLogReader::~BlockLogReader()
+	{
+		Close();
+	}
+
+	bool BlockLogReader::Open(const std::string& sPath)
+	{
+		Close();
+		m_pFile = fopen(sPath.c_str(), "rb");
+		if(!m_pFile)
+		{
+			return false;
+		}
+		fseeko(m_pFile, 0, SEEK_END);
+		unsigned long long nFileSize = ftello(m_pFile);
+		m_bIndexed = ReadIndex(nFileSize);
+		if(!m_bIndexed)
+		{
+			ScanHeaders(nFileSize);
+		}
+		return true;
+	}
+
+	void BlockLogReader::Close()
+	{
+		if(m_pFile)
+		{
+			fclose(m_pFile);
+			m_pFile = 0;
+		}
+		m_vBlocks.clear();
+		m_bIndexed = false;
+	}
+
+	bool BlockLogReader::ReadIndex(unsigned long long nFileSize)
+	{
+		m_vBlocks.clear();
+		unsigned char tail[c_nTailSize];
+		if(nFileSize < c_nTailSize || fseeko(m_pFile, nFileSize - c_nTailSize, SEEK_SET) != 0
+			|| fread(tail, 1, sizeof(tail), m_pFile) != sizeof(tail)
+			|| !IsBlockMember(tail, 'T') || GetLE(tail + 16, 4) != c_nTailSize)
+		{
+			return false;
+		}
+		unsigned long long nIndexOffset = GetLE(tail + c_nMemberHead, 8);
+		unsigned long long nCount = GetLE(tail + c_nMemberHead + 8, 8);
+		if(nIndexOffset > nFileSize - c_nTailSize)
+		{
+			return false;
+		}
+		m_vBuf.resize((size_t)(nFileSize - c_nTailSize - nIndexOffset));
+		if(!m_vBuf.empty() && (fseeko(m_pFile, nIndexOffset, SEEK_SET) != 0 || fread(&m_vBuf[0], 1, m_vBuf.size(), m_pFile) != m_vBuf.size()))
+		{
+			return false;
+		}
+		for(size_t nPos = 0; nPos + c_nMemberHead <= m_vBuf.size(); )
+		{
+			const unsigned char* p = &m_vBuf[nPos];
+			size_t nTotal = (size_t)GetLE(p + 16, 4);
+			if(!IsBlockMember(p, 'I') || nPos + nTotal > m_vBuf.size())
+			{
+				return false;
+			}
+			size_t nEntries = (size_t)(GetLE(p + 14, 2) - 4) / c_nIndexEntry;
+			for(size_t i = 0; i < nEntries; i++)
+			{
+				const unsigned char* pEntry = p + c_nMemberHead + i * c_nIndexEntry;
+				LogBlockInfo info;
+				info.m_nOffset = GetLE(pEntry, 8);
+				info.m_FirstTime.m_nSec = (time_t)(long long)GetLE(pEntry + 8, 8);
+				info.m_FirstTime.m_nNanoSec = (long)GetLE(pEntry + 16, 4);
+				if(!m_vBlocks.empty())
+				{
+					m_vBlocks.back().m_nSize = (unsigned)(info.m_nOffset - m_vBlocks.back().m_nOffset);
+				}
+				m_vBlocks.push_back(info);
+			}
+			nPos += nTotal;
+		}
+		if(!m_vBlocks.empty())
+		{
+			m_vBlocks.back().m_nSize = (unsigned)(nIndexOffset - m_vBlocks.back().m_nOffset);
+		}
+		return m_vBlocks.size() == nCount;
+	}
+
+	// walks the member headers, the last block may be incomplete if the file is still written
+	void BlockLogReader::ScanHeaders(unsigned long long nFileSize)
+	{
+		m_vBlocks.clear();
+		unsigned char head[c_nMemberHead + 12];
+		unsigned long long nPos = 0;
+		while(fseeko(m_pFile, nPos, SEEK_SET) == 0 && fread(head, 1, sizeof(head), m_pFile) == sizeof(head) && IsBlockMember(head, 'L'))
+		{
+			LogBlockInfo info;
+			info.m_nOffset = nPos;
+			info.m_nSize = (unsigned)GetLE(head + 16, 4);
+			info.m_FirstTime.m_nSec = (time_t)(long long)GetLE(head + c_nMemberHead, 8);
+			info.m_FirstTime.m_nNanoSec = (long)GetLE(head + c_nMemberHead + 8, 4);
+			if(nPos + info.m_nSize > nFileSize)
+			{
+				break;
+			}
+			m_vBlocks.push_back(info);
+			nPos += info.m_nSize;
+		}
+	}
+
+	size_t BlockLogReader::FindBlock(const LogTime& tmLog) const
+	{
+		// lines at tmLog may end the block before the first one starting at tmLog
+		size_t nLow = 0;
+		size_t nHigh = m_vBlocks.size();
+		while(nLow < nHigh)
+		{
+			size_t nMid = (nLow + nHigh) / 2;
+			if(LogTimeLess(m_vBlocks[nMid].m_FirstTime, tmLog))
+			{
+				nLow = nMid + 1;
+			}
+			else
+			{
+				nHigh = nMid;
+			}
+		}
+		return nLow ? nLow - 1 : 0;
+	}
+
+	bool BlockLogReader::ReadBlock(size_t nBlock, std::string& sText)
+	{
+		sText.clear();
+		if(!m_pFile || nBlock >= m_vBlocks.size())
+		{
+			return false;
+		}
+		const LogBlockInfo& info = m_vBlocks[nBlock];
+		m_vBuf.resize(info.m_nSize);
+		if(fseeko(m_pFile, info.m_nOffset, SEEK_SET) != 0 || fread(&m_vBuf[0], 1, m_vBuf.size(), m_pFile) != m_vBuf.size())
+		{
+			return false;
+		}
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		if(inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+		{
+			return false;
+		}
+		sText.resize((size_t)GetLE(&m_vBuf[m_vBuf.size() - 4], 4)); // the size from the trailer
+		zs.next_in = &m_vBuf[0];
+		zs.avail_in = (uInt)m_vBuf.size();
+		zs.next_out = sText.empty() ? Z_NULL : (Bytef*)&sText[0];
+		zs.avail_out = (uInt)sText.size();
+		int nRet = inflate(&zs, Z_FINISH);
+		inflateEnd(&zs);
+		return nRet == Z_STREAM_END && zs.avail_out == 0;
+	}
+
+	bool BlockLogReader::ReadRange(const LogTime& tmBegin, const LogTime& tmEnd, std::ostream& out)
+	{
+		std::string sText;
+		size_t nBlock = FindBlock(tmBegin);
+		if(nBlock >= m_vBlocks.size())
+		{
+			return true;
+		}
+		// lines without a time (the rest of a multi line message) go with the line before.
+		// the lines of several threads are not strictly in time order, so a line at or after tmEnd does not end
+		// the range, and a late line before tmEnd may follow the first line of a block that starts after it:
+		// the blocks that start before tmEnd and the one after them are read to their end and each line is filtered
+		LogTime tmLine = m_vBlocks[nBlock].m_FirstTime;
+		bool bPastEnd = false;
+		for(; nBlock < m_vBlocks.size() && !bPastEnd; nBlock++)
+		{
+			bPastEnd = !LogTimeLess(m_vBlocks[nBlock].m_FirstTime, tmEnd);
+			if(!ReadBlock(nBlock, sText))
+			{
+				return false;
+			}
+			for(size_t nPos = 0; nPos < sText.size(); )
+			{
+				size_t nEnd = sText.find('\n', nPos);
+				nEnd = (nEnd == string::npos) ? sText.size() : nEnd + 1;
+				ParseLineTime(sText.data() + nPos, nEnd - nPos, tmLine);
+				if(!LogTimeLess(tmLine, tmBegin) && LogTimeLess(tmLine, tmEnd))
+				{
+					out.write(sText.data() + nPos, nEnd - nPos);
+				}
+				nPos = nEnd;
+			}
+		}
+		return true;
+	}
+
+	bool BlockLogReader::ParseLineTime(const char* pText, size_t nLen, LogTime& tmLog)
+	{
+		int nSec = 0;
+		long nNanoSec = 0;
+		if(m_tMinute != -1 && nLen >= 19 && memcmp(pText, m_szMinute, sizeof(m_szMinute)) == 0 && ParseSeconds(pText, nLen, nSec, nNanoSec))
+		{
+			tmLog.m_nSec = m_tMinute + nSec;
+			tmLog.m_nNanoSec = nNanoSec;
+			return true;
+		}
+		if(!ParseLogTime(pText, nLen, tmLog))
+		{
+			return false;
+		}
+		memcpy(m_szMinute, pText, sizeof(m_szMinute));
+		m_tMinute = tmLog.m_nSec - ParseDigits(pText + 17, 2);
+		return true;
+	}
+
+	bool BlockGzipFile(const std::string& sSrc, const std::string& sDst, IoBudget* pBudget)
+	{
+		FILE* pIn = fopen(sSrc.c_str(), "rb");
+		if(!pIn)
+		{
+			cout << "open file failed: " << sSrc << endl;
+			return false;
+		}
+		string sTmp = sDst + ".tmp";
+		BlockLogWriter writer;
+		if(!writer.Open(sTmp))
+		{
+			fclose(pIn);
+			cout << "open file failed: " << sTmp << endl;
+			return false;
+		}
+		std::vector<char> vIn(64 * 1024);
+		size_t nRead = 0;
+		while((nRead = fread(&vIn[0], 1, vIn.size(), pIn)) > 0)
+		{
+			if(pBudget)
+			{
+				pBudget->Take(nRead);
+			}
+			writer.Write(&vIn[0], nRead);
+		}
+		bool bOk = !ferror(pIn);
+		fclose(pIn);
+		bOk = writer.Close() && bOk;
+		if(bOk && ::rename(sTmp.c_str(), sDst.c_str()) != 0)
+		{
+			bOk = false;
+		}
+		if(!bOk)
+		{
+			::remove(sTmp.c_str());
+			cout << "compress file failed: " << sSrc << endl;
+		}
+		return bOk;
+	}
+
+	// GzipWriter
+	GzipWriter::GzipWriter()
+		: m_pFile(0)
+		, m_bOk(false)
+		, m_vOut(64 * 1024)
+	{
+		memset(&m_Stream, 0, sizeof(m_Stream));
+	}
+
+	GzipWriter::~GzipWriter()
+	{
+		Close();
+	}
+
+	bool GzipWriter::Open(const std::string& sPath, bool bBlocks)
+	{
+		Close();
+		if(bBlocks)
+		{
+			m_Blocks.reset(new BlockLogWriter());
+			if(!m_Blocks->Open(sPath))
+			{
+				m_Blocks.reset();
+				return false;
+			}
+			return true;
+		}
+		m_pFile = fopen(sPath.c_str(), "ab");
+		if(!m_pFile)
+		{
+			return false;
+		}
+		memset(&m_Stream, 0, sizeof(m_Stream));
+		if(deflateInit2(&m_Stream, 6, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			fclose(m_pFile);
+			m_pFile = 0;
+			return false;
+		}
+		m_bOk = true;
+		return true;
+	}
+
+	void GzipWriter::Write(const char* pData, size_t nLen)
+	{
+		if(m_Blocks)
+		{
+			m_Blocks->Write(pData, nLen);
+			return;
+		}
+		if(!m_pFile)
+		{
+			return;
+		}
+		m_Stream.next_in = (Bytef*)pData;
+		m_Stream.avail_in = (uInt)nLen;
+		Deflate(Z_NO_FLUSH);
+	}
+
+	bool GzipWriter::Flush()
+	{
+		if(m_Blocks)
+		{
+			return m_Blocks->Flush();
+		}
+		if(!m_pFile)
+		{
+			return false;
+		}
+		Deflate(Z_SYNC_FLUSH);
+		if(fflush(m_pFile) != 0)
+		{
+			m_bOk = false;
+		}
+		return m_bOk;
+	}
+
+	bool GzipWriter::Close()
+	{
+		if(m_Blocks)
+		{
+			bool bOk = m_Blocks->Close();
+			m_Blocks.reset();
+			return bOk;
+		}
+		if(!m_pFile)
+		{
+			return true;
+		}
+		Deflate(Z_FINISH);
+		deflateEnd(&m_Stream);
+		if(fclose(m_pFile) != 0)
+		{
+			m_bOk = false;
+		}
+		m_pFile = 0;
+		return m_bOk;
+	}
+
+	// deflates the pending input and writes whatever comes out
+	void GzipWriter::Deflate(int nFlush)
+	{
+		do
+		{
+			m_Stream.next_out = &m_vOut[0];
+			m_Stream.avail_out = (uInt)m_vOut.size();
+			deflate(&m_Stream, nFlush);
+			size_t nHave = m_vOut.size() - m_Stream.avail_out;
+			if(nHave && fwrite(&m_vOut[0], 1, nHave, m_pFile) != nHave)
+			{
+				m_bOk = false;
+			}
+		} while(m_Stream.avail_out == 0);
+	}
+
+	// AsyncFileWriter
+	AsyncFileWriter::AsyncFileWriter(AsyncWriteStats& stats, LogMutex& statsMutex)
+		: m_Stats(stats)
+		, m_StatsMutex(statsMutex)
+		, m_nFile(-1)
+		, m_bOk(true)
+		, m_nOffset(0)
+		, m_nBufferSize(0)
+		, m_nCurrent(0)
+		, m_nInFlight(0)
+		, m_nRing(-1)
+	{}
+
+	AsyncFileWriter::~AsyncFileWriter()
+	{
+		Close();
+		for(size_t i = 0; i < m_vBuffers.size(); i++)
+		{
+			free(m_vBuffers[i]);
+		}
+	}
+
+	bool AsyncFileWriter::Open(const std::string& sPath, unsigned nBuffers, size_t nBufferSize)
+	{
+		m_nBufferSize = nBufferSize;
+		for(unsigned i = 0; i < nBuffers; i++)
+		{
+			void* p = 0;
+			if(posix_memalign(&p, 4096, nBufferSize) != 0)
+			{
+				return false;
+			}
+			m_vBuffers.push_back(static_cast<char*>(p));
+			m_vFree.push_back(nBuffers - 1 - i);
+		}
+		m_vLen.resize(nBuffers, 0);
+		m_vOffset.resize(nBuffers, 0);
+		m_nCurrent = nBuffers;
+		// no O_APPEND, every buffer is written at its own offset
+		m_nFile = open(sPath.c_str(), O_WRONLY | O_CREAT, 0644);
+		struct stat st;
+		if(m_nFile >= 0 && fstat(m_nFile, &st) != 0)
+		{
+			close(m_nFile);
+			m_nFile = -1;
+		}
+		if(m_nFile < 0)
+		{
+			return false;
+		}
+		m_nOffset = st.st_size;
+		bool bUring = SetupRing(nBuffers);
+		boost::lock_guard<LogMutex> lock(m_StatsMutex);
+		m_Stats.m_bUring = bUring;
+		return true;
+	}
+
+	void AsyncFileWriter::Write(const char* pData, size_t nLen)
+	{
+		while(nLen > 0)
+		{
+			if(m_nCurrent == m_vBuffers.size())
+			{
+				while(m_vFree.empty() && m_bOk)
+				{
+					if(m_nRing >= 0)
+					{
+						Reap(true);
+					}
+					else
+					{
+						WritePending();
+					}
+				}
+				if(m_vFree.empty())
+				{
+					return; // the ring failed with every buffer in flight, the error is reported
+				}
+				m_nCurrent = m_vFree.back();
+				m_vFree.pop_back();
+				m_vLen[m_nCurrent] = 0;
+			}
+			size_t nCopy = min(nLen, m_nBufferSize - m_vLen[m_nCurrent]);
+			memcpy(m_vBuffers[m_nCurrent] + m_vLen[m_nCurrent], pData, nCopy);
+			m_vLen[m_nCurrent] += nCopy;
+			pData += nCopy;
+			nLen -= nCopy;
+			if(m_vLen[m_nCurrent] == m_nBufferSize)
+			{
+				Submit();
+			}
+		}
+	}
+
+	bool AsyncFileWriter::Flush()
+	{
+		if(m_nFile < 0)
+		{
+			return false;
+		}
+		if(m_nCurrent != m_vBuffers.size())
+		{
+			Submit();
+		}
+		if(m_nRing >= 0)
+		{
+			Reap(false);
+		}
+		else
+		{
+			WritePending();
+		}
+		return m_bOk;
+	}
+
+	bool AsyncFileWriter::Close()
+	{
+		if(m_nFile < 0)
+		{
+			return false;
+		}
+		Flush();
+		while(m_nInFlight > 0 && m_bOk)
+		{
+			Reap(true);
+		}
+		CloseRing();
+		if(close(m_nFile) != 0)
+		{
+			m_bOk = false;
+		}
+		m_nFile = -1;
+		return m_bOk;
+	}
+
+	void AsyncFileWriter::Submit()
+	{
+		size_t nBuffer = m_nCurrent;
+		m_nCurrent = m_vBuffers.size();
+		m_vOffset[nBuffer] = m_nOffset;
+		m_nOffset += m_vLen[nBuffer];
+		if(m_nRing < 0)
+		{
+			m_vPending.push_back(nBuffer);
+			return;
+		}
+#ifdef CPPLOG_URING
+		// a slot is free for every buffer that is not in flight, the ring has as many entries as buffers
+		unsigned nTail = *m_pSqTail;
+		unsigned nIndex = nTail & *m_pSqMask;
+		io_uring_sqe* pSqe = &m_pSqes[nIndex];
+		memset(pSqe, 0, sizeof(*pSqe));
+		pSqe->fd = m_nFile;
+		pSqe->off = m_vOffset[nBuffer];
+		pSqe->user_data = nBuffer;
+		if(m_bFixed)
+		{
+			pSqe->opcode = IORING_OP_WRITE_FIXED;
+			pSqe->addr = (unsigned long long)(size_t)m_vBuffers[nBuffer];
+			pSqe->len = unsigned(m_vLen[nBuffer]);
+			pSqe->buf_index = (unsigned short)nBuffer;
+		}
+		else
+		{
+			m_vIov[nBuffer].iov_len = m_vLen[nBuffer];
+			pSqe->opcode = IORING_OP_WRITEV;
+			pSqe->addr = (unsigned long long)(size_t)&m_vIov[nBuffer];
+			pSqe->len = 1;
+		}
+		m_pSqArray[nIndex] = nIndex;
+		__atomic_store_n(m_pSqTail, nTail + 1, __ATOMIC_RELEASE);
+		long nSubmitted = syscall(__NR_io_uring_enter, m_nRing, 1, 0, 0, NULL, 0);
+		if(nSubmitted != 1 && __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE) == nTail)
+		{
+			// the kernel did not take the entry, no completion will come for it: take it back and write the
+			// buffer right away
+			if(nSubmitted < 0)
+			{
+				cout << "submit write failed: " << strerror(errno) << endl;
+			}
+			__atomic_store_n(m_pSqTail, nTail, __ATOMIC_RELEASE);
+			Count(1, m_vLen[nBuffer], m_nInFlight + 1);
+			Finish(nBuffer, 0);
+			return;
+		}
+		m_nInFlight++;
+		Count(1, m_vLen[nBuffer], m_nInFlight);
+#endif
+	}
+
+	void AsyncFileWriter::WritePending()
+	{
+		if(m_vPending.empty())
+		{
+			return;
+		}
+		// the pending buffers follow each other in the file
+		std::vector<iovec> vIov(m_vPending.size());
+		size_t nBytes = 0;
+		for(size_t i = 0; i < m_vPending.size(); i++)
+		{
+			vIov[i].iov_base = m_vBuffers[m_vPending[i]];
+			vIov[i].iov_len = m_vLen[m_vPending[i]];
+			nBytes += vIov[i].iov_len;
+		}
+		ssize_t nResult = pwritev(m_nFile, &vIov[0], int(vIov.size()), off_t(m_vOffset[m_vPending[0]]));
+		Count(unsigned(m_vPending.size()), nBytes, unsigned(m_vPending.size()));
+		if(nResult != ssize_t(nBytes))
+		{
+			// a short write, the rest goes out buffer by buffer
+			size_t nDone = nResult < 0 ? 0 : size_t(nResult);
+			for(size_t i = 0; i < m_vPending.size(); i++)
+			{
+				size_t nLen = m_vLen[m_vPending[i]];
+				Finish(m_vPending[i], long(min(nDone, nLen)));
+				nDone -= min(nDone, nLen);
+			}
+		}
+		else
+		{
+			m_vFree.insert(m_vFree.end(), m_vPending.begin(), m_vPending.end());
+		}
+		m_vPending.clear();
+	}
+
+	void AsyncFileWriter::Reap(bool bWait)
+	{
+#ifdef CPPLOG_URING
+		for(;;)
+		{
+			unsigned nHead = *m_pCqHead;
+			unsigned nTail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+			for(; nHead != nTail; nHead++)
+			{
+				const io_uring_cqe& cqe = m_pCqes[nHead & *m_pCqMask];
+				m_nInFlight--;
+				Finish(size_t(cqe.user_data), cqe.res);
+			}
+			__atomic_store_n(m_pCqHead, nHead, __ATOMIC_RELEASE);
+			if(!bWait || !m_vFree.empty() || m_nInFlight == 0)
+			{
+				return;
+			}
+			if(syscall(__NR_io_uring_enter, m_nRing, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+			{
+				cout << "write file failed: " << strerror(errno) << endl;
+				m_bOk = false;
+				return;
+			}
+		}
+#endif
+	}
+
+	// the rest of a short write is written right away
+	void AsyncFileWriter::Finish(size_t nBuffer, long nResult)
+	{
+		size_t nDone = nResult < 0 ? 0 : size_t(nResult);
+		while(nResult >= 0 && nDone < m_vLen[nBuffer])
+		{
+			ssize_t nWritten = pwrite(m_nFile, m_vBuffers[nBuffer] + nDone, m_vLen[nBuffer] - nDone, off_t(m_vOffset[nBuffer] + nDone));
+			if(nWritten <= 0)
+			{
+				nResult = nWritten < 0 ? -errno : -EIO;
+				break;
+			}
+			nDone += nWritten;
+		}
+		if(nResult < 0)
+		{
+			cout << "write file failed: " << strerror(int(-nResult)) << endl;
+			m_bOk = false;
+		}
+		m_vFree.push_back(nBuffer);
+	}
+
+	void AsyncFileWriter::Count(unsigned nWrites, size_t nBytes, unsigned nInFlight)
+	{
+		boost::lock_guard<LogMutex> lock(m_StatsMutex);
+		m_Stats.m_nWrites += nWrites;
+		m_Stats.m_nBytes += nBytes;
+		m_Stats.m_nMaxInFlight = max(m_Stats.m_nMaxInFlight, nInFlight);
+		m_Stats.m_nInFlightSum += (unsigned long long)nInFlight * nWrites;
+	}
+
+	bool AsyncFileWriter::SetupRing(unsigned nEntries)
+	{
+#ifdef CPPLOG_URING
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		m_nRing = int(syscall(__NR_io_uring_setup, nEntries, &params));
+		if(m_nRing < 0)
+		{
+			return false;
+		}
+		m_pSqRing = m_pCqRing = MAP_FAILED;
+		m_pSqes = 0;
+		m_nSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_nCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		m_nSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			m_nSqRingSize = m_nCqRingSize = max(m_nSqRingSize, m_nCqRingSize);
+		}
+		m_pSqRing = mmap(0, m_nSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_SQ_RING);
+		if(m_pSqRing != MAP_FAILED)
+		{
+			m_pCqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? m_pSqRing
+				: mmap(0, m_nCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_CQ_RING);
+		}
+		void* pSqes = mmap(0, m_nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_SQES);
+		if(m_pSqRing == MAP_FAILED || m_pCqRing == MAP_FAILED || pSqes == MAP_FAILED)
+		{
+			if(pSqes != MAP_FAILED)
+			{
+				munmap(pSqes, m_nSqesSize);
+			}
+			CloseRing();
+			return false;
+		}
+		m_pSqes = static_cast<io_uring_sqe*>(pSqes);
+		char* pSq = static_cast<char*>(m_pSqRing);
+		char* pCq = static_cast<char*>(m_pCqRing);
+		m_pSqHead = reinterpret_cast<unsigned*>(pSq + params.sq_off.head);
+		m_pSqTail = reinterpret_cast<unsigned*>(pSq + params.sq_off.tail);
+		m_pSqMask = reinterpret_cast<unsigned*>(pSq + params.sq_off.ring_mask);
+		m_pSqArray = reinterpret_cast<unsigned*>(pSq + params.sq_off.array);
+		m_pCqHead = reinterpret_cast<unsigned*>(pCq + params.cq_off.head);
+		m_pCqTail = reinterpret_cast<unsigned*>(pCq + params.cq_off.tail);
+		m_pCqMask = reinterpret_cast<unsigned*>(pCq + params.cq_off.ring_mask);
+		m_pCqes = reinterpret_cast<io_uring_cqe*>(pCq + params.cq_off.cqes);
+
+		m_vIov.resize(m_vBuffers.size());
+		for(size_t i = 0; i < m_vBuffers.size(); i++)
+		{
+			m_vIov[i].iov_base = m_vBuffers[i];
+			m_vIov[i].iov_len = m_nBufferSize;
+		}
+		// registering needs locked memory (RLIMIT_MEMLOCK), without it the buffers are passed with every write
+		m_bFixed = syscall(__NR_io_uring_register, m_nRing, IORING_REGISTER_BUFFERS, &m_vIov[0], unsigned(m_vIov.size())) == 0;
+		return true;
+#else
+		(void)nEntries;
+		return false;
+#endif
+	}
+
+	void AsyncFileWriter::CloseRing()
+	{
+#ifdef CPPLOG_URING
+		if(m_nRing < 0)
+		{
+			return;
+		}
+		if(m_pSqes)
+		{
+			munmap(m_pSqes, m_nSqesSize);
+		}
+		if(m_pCqRing != MAP_FAILED && m_pCqRing != m_pSqRing)
+		{
+			munmap(m_pCqRing, m_nCqRingSize);
+		}
+		if(m_pSqRing != MAP_FAILED)
+		{
+			munmap(m_pSqRing, m_nSqRingSize);
+		}
+		close(m_nRing);
+		m_nRing = -1;
+#endif
+	}
+
+	// parallel gzip
+	static const size_t c_nGzipChunk = 1024 * 1024;
+	static const size_t c_nGzipDict = 32 * 1024; // the deflate window
+
+	struct GzipChunk
+	{
+		std::vector<unsigned char> m_vIn;
+		std::vector<unsigned char> m_vOut;
+		std::vector<unsigned char> m_vDict; // the end of the chunk before
+		uLong m_nCrc;
+		bool m_bLast;
+		bool m_bOk;
+		bool m_bDone; // deflated, guarded by the mutex of the pipeline
+	};
+
+	// the chunks of a file in flight, in a ring of two slots per worker. the calling thread reads into the free
+	// slots and writes the deflated ones out in order while the workers deflate, the memory stays bounded
+	// whatever the file size
+	struct GzipPipeline
+	{
+		std::vector<GzipChunk> m_vSlots; // chunk n is in slot n % size
+		unsigned long long m_nRead; // chunks read, only the calling thread changes it
+		unsigned long long m_nTaken; // chunks a worker took
+		bool m_bStop;
+		LogMutex m_Mutex;
+		boost::condition_variable m_WorkCond; // a chunk was read
+		boost::condition_variable m_DoneCond; // a chunk was deflated
+	};
+
+	// a raw deflate stream ending on a byte boundary (sync flush), the last one with the final block
+	static void DeflateChunk(GzipChunk& chunk, int nLevel)
+	{
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		chunk.m_bOk = false;
+		chunk.m_vOut.clear();
+		chunk.m_nCrc = crc32(crc32(0L, Z_NULL, 0), chunk.m_vIn.empty() ? Z_NULL : &chunk.m_vIn[0], (uInt)chunk.m_vIn.size());
+		if(deflateInit2(&zs, nLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			return;
+		}
+		if(!chunk.m_vDict.empty())
+		{
+			deflateSetDictionary(&zs, &chunk.m_vDict[0], (uInt)chunk.m_vDict.size());
+		}
+		chunk.m_vOut.resize(deflateBound(&zs, (uLong)chunk.m_vIn.size()) + 16);
+		zs.next_in = chunk.m_vIn.empty() ? Z_NULL : &chunk.m_vIn[0];
+		zs.avail_in = (uInt)chunk.m_vIn.size();
+		zs.next_out = &chunk.m_vOut[0];
+		zs.avail_out = (uInt)chunk.m_vOut.size();
+		int nRet = deflate(&zs, chunk.m_bLast ? Z_FINISH : Z_SYNC_FLUSH);
+		chunk.m_bOk = chunk.m_bLast ? (nRet == Z_STREAM_END) : (nRet == Z_OK && zs.avail_in == 0);
+		chunk.m_vOut.resize(chunk.m_vOut.size() - zs.avail_out);
+		deflateEnd(&zs);
+	}
+
+	static void DeflateChunks(GzipPipeline* pPipe, int nLevel)
+	{
+		boost::unique_lock<LogMutex> lock(pPipe->m_Mutex);
+		while(true)
+		{
+			while(!pPipe->m_bStop && pPipe->m_nTaken == pPipe->m_nRead)
+			{
+				pPipe->m_WorkCond.wait(lock);
+			}
+			if(pPipe->m_bStop)
+			{
+				return;
+			}
+			GzipChunk& chunk = pPipe->m_vSlots[pPipe->m_nTaken++ % pPipe->m_vSlots.size()];
+			lock.unlock();
+			DeflateChunk(chunk, nLevel);
+			lock.lock();
+			chunk.m_bDone = true;
+			pPipe->m_DoneCond.notify_one();
+		}
+	}
+
+	bool ParallelGzipFile(const std::string& sSrc, const std::string& sDst, unsigned nThreads, int nLevel, IoBudget* pBudget)
+	{
+		FILE* pIn = fopen(sSrc.c_str(), "rb");
+		if(!pIn)
+		{
+			cout << "open file failed: " << sSrc << endl;
+			return false;
+		}
+		string sTmp = sDst + ".tmp";
+		FILE* pOut = fopen(sTmp.c_str(), "wb");
+		if(!pOut)
+		{
+			fclose(pIn);
+			cout << "open file failed: " << sTmp << endl;
+			return false;
+		}
+
+		// minimal gzip header: no name, no time, unknown os
+		static const unsigned char c_Header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+		bool bOk = (fwrite(c_Header, 1, sizeof(c_Header), pOut) == sizeof(c_Header));
+		nThreads = nThreads ? nThreads : 1;
+		GzipPipeline pipe;
+		pipe.m_vSlots.resize(2 * nThreads);
+		pipe.m_nRead = 0;
+		pipe.m_nTaken = 0;
+		pipe.m_bStop = false;
+		// one pool for the whole file, the workers deflate while this thread reads and writes
+		boost::thread_group workers;
+		for(unsigned i = 0; i < nThreads; i++)
+		{
+			workers.create_thread(boost::bind(&DeflateChunks, &pipe, nLevel));
+		}
+		const size_t nSlots = pipe.m_vSlots.size();
+		uLong nCrc = crc32(0L, Z_NULL, 0);
+		unsigned long long nTotal = 0;
+		unsigned long long nWritten = 0;
+		bool bEnd = false;
+		while(bOk && (!bEnd || nWritten < pipe.m_nRead))
+		{
+			GzipChunk& head = pipe.m_vSlots[nWritten % nSlots];
+			bool bWrite = false;
+			{
+				// read ahead while a slot is free, wait only when there is nothing else to do
+				boost::unique_lock<LogMutex> lock(pipe.m_Mutex);
+				while(!(bWrite = (nWritten < pipe.m_nRead && head.m_bDone)) && (bEnd || pipe.m_nRead - nWritten == nSlots))
+				{
+					pipe.m_DoneCond.wait(lock);
+				}
+			}
+			if(bWrite)
+			{
+				bOk = head.m_bOk && (fwrite(&head.m_vOut[0], 1, head.m_vOut.size(), pOut) == head.m_vOut.size());
+				nCrc = crc32_combine(nCrc, head.m_nCrc, (z_off_t)head.m_vIn.size());
+				nTotal += head.m_vIn.size();
+				nWritten++; // the slot is free, the input stays for the dictionary of the next chunk
+				continue;
+			}
+
+			GzipChunk& chunk = pipe.m_vSlots[pipe.m_nRead % nSlots];
+			chunk.m_vIn.resize(c_nGzipChunk);
+			chunk.m_vIn.resize(fread(&chunk.m_vIn[0], 1, c_nGzipChunk, pIn));
+			if(ferror(pIn))
+			{
+				bOk = false;
+				break;
+			}
+			if(pBudget)
+			{
+				pBudget->Take(chunk.m_vIn.size());
+			}
+			// peek at the next byte, the last chunk has to finish the stream
+			int c = fgetc(pIn);
+			bEnd = (c == EOF);
+			if(!bEnd)
+			{
+				ungetc(c, pIn);
+			}
+			chunk.m_bLast = bEnd;
+			chunk.m_vDict.clear();
+			if(pipe.m_nRead > 0)
+			{
+				// the chunk before is still in its slot, that is only read into again nSlots chunks later
+				const std::vector<unsigned char>& vPrev = pipe.m_vSlots[(pipe.m_nRead - 1) % nSlots].m_vIn;
+				size_t nDict = std::min(vPrev.size(), c_nGzipDict);
+				chunk.m_vDict.assign(vPrev.end() - nDict, vPrev.end());
+			}
+			{
+				boost::lock_guard<LogMutex> lock(pipe.m_Mutex);
+				chunk.m_bDone = false;
+				pipe.m_nRead++;
+			}
+			pipe.m_WorkCond.notify_one();
+		}
+		{
+			boost::lock_guard<LogMutex> lock(pipe.m_Mutex);
+			pipe.m_bStop = true;
+		}
+		pipe.m_WorkCond.notify_all();
+		workers.join_all();
+
+		// trailer: crc32 and the size modulo 2^32, both little endian
+		unsigned char trailer[8];
+		for(int i = 0; i < 4; i++)
+		{
+			trailer[i] = (unsigned char)(nCrc >> (8 * i));
+			trailer[4 + i] = (unsigned char)(nTotal >> (8 * i));
+		}
+		bOk = bOk && (fwrite(trailer, 1, sizeof(trailer), pOut) == sizeof(trailer));
+		fclose(pIn);
+		if(fclose(pOut) != 0)
+		{
+			bOk = false;
+		}
+		if(bOk && ::rename(sTmp.c_str(), sDst.c_str()) != 0)
+		{
+			bOk = false;
+		}
+		if(!bOk)
+		{
+			::remove(sTmp.c_str());
+			cout << "compress file failed: " << sSrc << endl;
+		}
+		return bOk;
+	}
+#endif
+
+	// binary records
+	static const char c_szBinaryMagic[] = "CPLB";
+	static const char c_nBinaryVersion = 1;
+
+	static void PutVarint(std::string& sBuf, unsigned long long n)
+	{
+		while(n >= 0x80)
+		{
+			sBuf.push_back(char((n & 0x7f) | 0x80));
+			n >>= 7;
+		}
+		sBuf.push_back(char(n));
+	}
+
+	// 1: read, 0: the data ends before the varint, -1: longer than 64 bits
+	static int GetVarint(const char* pData, size_t nLen, size_t& nPos, unsigned long long& n)
+	{
+		n = 0;
+		for(int nShift = 0; nShift < 64; nShift += 7)
+		{
+			if(nPos >= nLen)
+			{
+				return 0;
+			}
+			unsigned char c = pData[nPos++];
+			n |= (unsigned long long)(c & 0x7f) << nShift;
+			if(!(c & 0x80))
+			{
+				return 1;
+			}
+		}
+		return -1;
+	}
+
+	static unsigned long long ZigZag(long long n)
+	{
+		return ((unsigned long long)n << 1) ^ (unsigned long long)(n >> 63);
+	}
+
+	static long long UnZigZag(unsigned long long n)
+	{
+		return (long long)(n >> 1) ^ -(long long)(n & 1);
+	}
+
+	BinaryLogEncoder::BinaryLogEncoder()
+		: m_nLastTime(0)
+	{}
+
+	void BinaryLogEncoder::Begin(std::string& sBuf)
+	{
+		m_Sites.clear();
+		m_nLastTime = 0;
+		sBuf.push_back('H');
+		sBuf.append(c_szBinaryMagic, 4);
+		sBuf.push_back(c_nBinaryVersion);
+	}
+
+	void BinaryLogEncoder::Encode(const LogRecord& record, std::string& sBuf)
+	{
+		const LogSite* pSite = record.GetSite();
+		if(!pSite)
+		{
+			EncodeText(record.GetText(), sBuf);
+			return;
+		}
+		std::map<const LogSite*, unsigned>::iterator it = m_Sites.find(pSite);
+		if(it == m_Sites.end())
+		{
+			it = m_Sites.insert(std::make_pair(pSite, unsigned(m_Sites.size() + 1))).first;
+			size_t nFileLen = strlen(pSite->m_sFile);
+			sBuf.push_back('S');
+			PutVarint(sBuf, it->second);
+			PutVarint(sBuf, nFileLen);
+			sBuf.append(pSite->m_sFile, nFileLen);
+			PutVarint(sBuf, ZigZag(pSite->m_nLine));
+		}
+		const LogTime& tmLog = record.GetTime();
+		long long nTime = (long long)tmLog.m_nSec * 1000000000 + tmLog.m_nNanoSec;
+		sBuf.push_back('R');
+		PutVarint(sBuf, ZigZag(nTime - m_nLastTime));
+		m_nLastTime = nTime;
+		sBuf.push_back(char(record.GetLevel() | (record.GetTimePrecision() << 4)));
+		PutVarint(sBuf, it->second);
+		m_sMessage.clear();
+		record.RenderMessage(m_sMessage);
+		PutVarint(sBuf, m_sMessage.size());
+		sBuf.append(m_sMessage);
+	}
+
+	void BinaryLogEncoder::EncodeText(const std::string& sLine, std::string& sBuf)
+	{
+		sBuf.push_back('T');
+		PutVarint(sBuf, sLine.size());
+		sBuf.append(sLine);
+	}
+
+	// ,"key":value for every field
+	static void EncodeJsonFields(const std::string& sFields, std::string& sBuf)
+	{
+		size_t nPos = 0;
+		while(nPos < sFields.size())
+		{
+			nPos++; // the key is a string
+			unsigned int nKeyLen = GetArg<unsigned int>(sFields, nPos);
+			sBuf.append(",\"");
+			AppendJsonString(sBuf, sFields.data() + nPos, nKeyLen);
+			sBuf.append("\":");
+			nPos += nKeyLen;
+			switch(sFields[nPos++])
+			{
+			case ARG_STRING:
+				{
+					unsigned int nLen = GetArg<unsigned int>(sFields, nPos);
+					sBuf.push_back('"');
+					AppendJsonString(sBuf, sFields.data() + nPos, nLen);
+					sBuf.push_back('"');
+					nPos += nLen;
+				}
+				break;
+			case ARG_CHAR:
+				{
+					char c = GetArg<char>(sFields, nPos);
+					sBuf.push_back('"');
+					AppendJsonString(sBuf, &c, 1);
+					sBuf.push_back('"');
+				}
+				break;
+			case ARG_BOOL:
+				sBuf.append(GetArg<bool>(sFields, nPos) ? "true" : "false");
+				break;
+			case ARG_INT:
+				AppendInt(sBuf, GetArg<long long>(sFields, nPos));
+				break;
+			case ARG_UINT:
+				AppendUInt(sBuf, GetArg<unsigned long long>(sFields, nPos));
+				break;
+			case ARG_DOUBLE:
+				{
+					double d = GetArg<double>(sFields, nPos);
+					if(d - d == 0) // not inf or nan
+					{
+						AppendDouble(sBuf, d);
+					}
+					else
+					{
+						sBuf.append("null");
+					}
+				}
+				break;
+			case ARG_LONG_DOUBLE:
+				{
+					long double d = GetArg<long double>(sFields, nPos);
+					if(d - d == 0)
+					{
+						AppendLongDouble(sBuf, d);
+					}
+					else
+					{
+						sBuf.append("null");
+					}
+				}
+				break;
+			case ARG_POINTER:
+				sBuf.push_back('"');
+				AppendPointer(sBuf, GetArg<const void*>(sFields, nPos));
+				sBuf.push_back('"');
+				break;
+			default:
+				sBuf.append("null");
+				nPos = sFields.size();
+				break;
+			}
+		}
+	}
+
+	void JsonLogEncoder::Encode(const LogRecord& record, std::string& sBuf)
+	{
+		const LogSite* pSite = record.GetSite();
+		sBuf.append("{\"time\":\"");
+		m_Formatter.Append(sBuf, record.GetTime(), record.GetTimePrecision());
+		if(!pSite)
+		{
+			sBuf.append("\",\"msg\":\"");
+			const std::string& sText = record.GetText();
+			size_t nLen = sText.size();
+			if(nLen > 0 && sText[nLen - 1] == '\n')
+			{
+				nLen--;
+			}
+			AppendJsonString(sBuf, sText.data(), nLen);
+			sBuf.append("\"}\n");
+			return;
+		}
+		sBuf.append("\",\"level\":\"");
+		sBuf.append(c_LogLevelTag[record.GetLevel()]);
+		sBuf.append("\",\"msg\":\"");
+		if(record.IsDeferred())
+		{
+			m_sMessage.clear();
+			record.RenderArgs(m_sMessage);
+			AppendJsonString(sBuf, m_sMessage.data(), m_sMessage.size());
+		}
+		else
+		{
+			// straight from the text line, without the fields the line carries as text
+			AppendJsonString(sBuf, record.m_sText.data() + record.m_nMsgBegin, record.m_nFieldsBegin - record.m_nMsgBegin);
+		}
+		sBuf.append("\",\"file\":\"");
+		AppendJsonString(sBuf, pSite->m_sFile, strlen(pSite->m_sFile));
+		sBuf.append("\",\"line\":");
+		AppendInt(sBuf, pSite->m_nLine);
+		EncodeJsonFields(record.m_sFields, sBuf);
+		sBuf.append("}\n");
+	}
 
-using namespace std;
-using namespace boost::filesystem;
+	void JsonLogEncoder::EncodeText(const std::string& sLine, std::string& sBuf)
+	{
+		size_t nLen = sLine.size();
+		if(nLen > 0 && sLine[nLen - 1] == '\n')
+		{
+			nLen--;
+		}
+		sBuf.append("{\"msg\":\"");
+		AppendJsonString(sBuf, sLine.data(), nLen);
+		sBuf.append("\"}\n");
+	}
 
-namespace CppLog
-{
-	// member functions for Log
-	Log::Log()
-		: m_LogLevel(LOG_LEVEL_FATAL)
+	BinaryLogDecoder::BinaryLogDecoder()
+		: m_nLastTime(0)
+		, m_bCorrupt(false)
 	{}
 
-	Log::~Log(){}
-
-	AppenderList& Log::GetAppenderList()
+	size_t BinaryLogDecoder::Decode(const char* pData, size_t nLen, std::string& sOut)
 	{
-		return m_Appenders;
+		size_t nUsed = 0;
+		while(nUsed < nLen && !m_bCorrupt)
+		{
+			size_t nPos = nUsed;
+			size_t nOut = sOut.size();
+			int nRet = DecodeFrame(pData, nLen, nPos, sOut);
+			if(nRet <= 0)
+			{
+				sOut.resize(nOut);
+				m_bCorrupt = (nRet < 0);
+				break;
+			}
+			nUsed = nPos;
+		}
+		return nUsed;
 	}
 
-	void Log::AddAppender(AppenderPtr appender)
+	// the state only changes once the whole frame is there
+	int BinaryLogDecoder::DecodeFrame(const char* pData, size_t nLen, size_t& nPos, std::string& sOut)
 	{
-		m_Appenders.push_back(appender);
+		char cType = pData[nPos++];
+		unsigned long long n = 0;
+		int nRet = 1;
+		switch(cType)
+		{
+		case 'H':
+			if(nLen - nPos < 5)
+			{
+				return 0;
+			}
+			if(memcmp(pData + nPos, c_szBinaryMagic, 4) != 0 || pData[nPos + 4] != c_nBinaryVersion)
+			{
+				return -1;
+			}
+			nPos += 5;
+			m_Sites.clear();
+			m_nLastTime = 0;
+			return 1;
+		case 'S':
+			{
+				unsigned long long nId = 0, nFileLen = 0, nLine = 0;
+				if((nRet = GetVarint(pData, nLen, nPos, nId)) <= 0 || (nRet = GetVarint(pData, nLen, nPos, nFileLen)) <= 0)
+				{
+					return nRet;
+				}
+				if(nLen - nPos < nFileLen)
+				{
+					return 0;
+				}
+				size_t nFile = nPos;
+				nPos += nFileLen;
+				if((nRet = GetVarint(pData, nLen, nPos, nLine)) <= 0)
+				{
+					return nRet;
+				}
+				Site& site = m_Sites[nId];
+				site.m_sFile.assign(pData + nFile, nFileLen);
+				site.m_nLine = UnZigZag(nLine);
+			}
+			return 1;
+		case 'R':
+			{
+				unsigned long long nDelta = 0, nId = 0;
+				if((nRet = GetVarint(pData, nLen, nPos, nDelta)) <= 0)
+				{
+					return nRet;
+				}
+				if(nPos >= nLen)
+				{
+					return 0;
+				}
+				int nLevel = pData[nPos] & 0x0f;
+				int nPrecision = (pData[nPos] >> 4) & 0x0f;
+				nPos++;
+				if((nRet = GetVarint(pData, nLen, nPos, nId)) <= 0 || (nRet = GetVarint(pData, nLen, nPos, n)) <= 0)
+				{
+					return nRet;
+				}
+				if(nLen - nPos < n)
+				{
+					return 0;
+				}
+				std::map<unsigned long long, Site>::const_iterator it = m_Sites.find(nId);
+				if(it == m_Sites.end() || nLevel >= LOG_LEVEL_ALL || nPrecision > TIME_PRECISION_NANO)
+				{
+					return -1;
+				}
+				m_nLastTime += UnZigZag(nDelta);
+				LogTime tmLog;
+				tmLog.m_nSec = time_t(m_nLastTime / 1000000000);
+				tmLog.m_nNanoSec = long(m_nLastTime % 1000000000);
+				m_Formatter.Append(sOut, tmLog, TIME_PRECISION(nPrecision));
+				sOut.append(" - ");
+				sOut.append(c_LogLevelTag[nLevel]);
+				sOut.append(" - ");
+				sOut.append(pData + nPos, size_t(n));
+				sOut.append(" [ ");
+				sOut.append(it->second.m_sFile);
+				sOut.append(" : ");
+				AppendInt(sOut, it->second.m_nLine);
+				sOut.append(" ]\n");
+				nPos += size_t(n);
+			}
+			return 1;
+		case 'T':
+			if((nRet = GetVarint(pData, nLen, nPos, n)) <= 0)
+			{
+				return nRet;
+			}
+			if(nLen - nPos < n)
+			{
+				return 0;
+			}
+			sOut.append(pData + nPos, size_t(n));
+			nPos += size_t(n);
+			return 1;
+		default:
+			return -1;
+		}
 	}
 
-	void Log::SetLogLevel(LOG_LEVEL level)
+#ifndef WIN32
+	// a record cut by a crash at the end of the file is left out
+	bool BinaryLogDecoder::DecodeFile(const std::string& sPath, std::ostream& out)
 	{
-		m_LogLevel = level;
+		gzFile pFile = gzopen(sPath.c_str(), "rb"); // reads plain files too
+		if(!pFile)
+		{
+			cout << "open file failed: " << sPath << endl;
+			return false;
+		}
+		std::vector<char> vChunk(64 * 1024);
+		std::string sPending;
+		std::string sOut;
+		int nRead = 0;
+		while((nRead = gzread(pFile, &vChunk[0], unsigned(vChunk.size()))) > 0)
+		{
+			sPending.append(&vChunk[0], nRead);
+			sOut.clear();
+			sPending.erase(0, Decode(sPending.data(), sPending.size(), sOut));
+			out.write(sOut.data(), sOut.size());
+			if(m_bCorrupt)
+			{
+				break;
+			}
+		}
+		bool bOk = (nRead == 0) && !m_bCorrupt;
+		gzclose(pFile);
+		if(!bOk)
+		{
+			cout << "decode file failed: " << sPath << endl;
+		}
+		return bOk;
 	}
+#endif
 
-	LOG_LEVEL Log::GetLogLevel()
+	FileManager::FileManager()
+		: m_nNameVersion (0)
+		, m_sDir ("./")
 	{
-		return m_LogLevel;
+		SetCompress(true);
+		SetCompressThreads(1);
+		SetSeekableCompress(false);
+		SetMaxFileLife(100);
+		SetPrefixName("test");
 	}
 
-	LogMutex& Log::GetMutex()
+	bool FileManager::SetDir(const std::string& sDir)
 	{
-		return m_Mutex;
+		try
+		{
+			m_nNameVersion++;
+			m_sDir = sDir;
+			replace(m_sDir.begin(), m_sDir.end(), '\\', '/');
+			if('/' != m_sDir[m_sDir.length()-1])
+			{
+				m_sDir += "/";
+			}
+			if(!boost::filesystem::exists(m_sDir))
+			{
+				if(!boost::filesystem::create_directory(m_sDir))
+				{
+					m_sDir = "./";
+					return false;
+				}
+			}
+		}
+		catch(...)
+		{
+			return false;
+		}
+		return true;
 	}
-	
-	// member functions for Appender
 
+	// IoBudget
+	IoBudget::IoBudget()
+		: m_nRate(0)
+		, m_dTokens(0)
+		, m_tLast(boost::posix_time::microsec_clock::universal_time())
+	{}
 
-	// member functions for ConsoleAppender
-	ConsoleAppender::ConsoleAppender(){}
+	void IoBudget::SetRate(size_t nBytesPerSec)
+	{
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_nRate = nBytesPerSec;
+		m_dTokens = 0;
+	}
 
-	void ConsoleAppender::Write(const std::string& msg)
+	// the tokens may go below zero, the thread that did it sleeps until the budget has caught up
+	void IoBudget::Take(size_t nBytes)
 	{
-		cout << msg;
+		double dWaitSecs = 0;
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			if(m_nRate == 0)
+			{
+				return;
+			}
+			boost::posix_time::ptime tNow = boost::posix_time::microsec_clock::universal_time();
+			double dElapsed = (tNow - m_tLast).total_microseconds() / 1e6;
+			m_tLast = tNow;
+			// at most a second worth of tokens saved up
+			m_dTokens = std::min(m_dTokens + dElapsed * m_nRate, (double)m_nRate);
+			m_dTokens -= nBytes;
+			if(m_dTokens < 0)
+			{
+				dWaitSecs = -m_dTokens / m_nRate;
+			}
+		}
+		if(dWaitSecs > 0)
+		{
+			boost::this_thread::sleep(boost::posix_time::microseconds((long long)(dWaitSecs * 1e6)));
+		}
 	}
 
-	ConsoleAppenderPtr ConsoleAppender::Create()
+	// CompressionPool
+	CompressionPool::CompressionPool()
+		: m_nThreads(1)
+		, m_nWorkers(0)
+		, m_nNice(0)
+		, m_bRun(true)
+		, m_nCompressed(0)
+	{}
+
+	CompressionPool::~CompressionPool()
 	{
-		return ConsoleAppenderPtr(new ConsoleAppender());
+		{
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			m_bRun = false;
+			m_Cond.notify_all();
+		}
+		m_Workers.join_all(); // a file being compressed is finished, the queued ones are left for the next run
 	}
 
-	// member functions for FileAppender
-	FileAppender::FileAppender()
+	void CompressionPool::SetThreads(unsigned nThreads)
 	{
-		SetCompress(true);
-		SetPrefixName("test");
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_nThreads = nThreads ? nThreads : 1;
+		m_Cond.notify_all(); // extra workers quit
 	}
 
-	FileAppender::~FileAppender()
+	void CompressionPool::SetNice(int nNice)
 	{
-		m_filestream.close();
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_nNice = nNice; // taken by the workers before their next file
 	}
 
-	void FileAppender::Open()
+	bool CompressionPool::Submit(const FileManager& files, const std::string& sStemName)
 	{
-		ArrangeFiles();
-		string sFileName = SynthesizeTodyFileName();
-		m_filestream.open(sFileName.c_str(), ios_base::app);
-		if(m_filestream.fail())
+		Task task;
+		task.m_Files = files;
+		task.m_sStemName = sStemName;
+		task.m_sKey = files.FullPath(sStemName);
+
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		if(!m_bRun || !m_InFlight.insert(task.m_sKey).second)
 		{
-			m_filestream.clear();
-			cout << "open file failed: " << sFileName << endl;
+			return false;
 		}
+		m_Tasks.push_back(task);
+		// workers start when there is work for them
+		if(m_nWorkers < m_nThreads && m_nWorkers < m_InFlight.size())
+		{
+			m_nWorkers++;
+			m_Workers.create_thread(boost::bind(&CompressionPool::Loop, this));
+		}
+		m_Cond.notify_one();
+		return true;
 	}
 
-	void FileAppender::Close()
+	void CompressionPool::WaitIdle()
 	{
-		m_filestream.close();
-		if(m_filestream.fail())
+		boost::unique_lock<LogMutex> lock(m_Mutex);
+		while(!m_InFlight.empty() && m_bRun)
 		{
-			m_filestream.clear();
-			cout << "close file failed: " << endl;
+			m_IdleCond.wait(lock);
 		}
 	}
 
-	void FileAppender::Write(const std::string& msg)
+	void CompressionPool::Loop()
 	{
-		Open();
-		WriteWithoutFlush(msg);
-		Close();
-	}
+		int nNice = 0;
+		boost::unique_lock<LogMutex> lock(m_Mutex);
+		while(true)
+		{
+			while(m_bRun && m_Tasks.empty() && m_nWorkers <= m_nThreads)
+			{
+				m_Cond.wait(lock);
+			}
+			if(!m_bRun || m_nWorkers > m_nThreads)
+			{
+				break;
+			}
+			Task task = m_Tasks.front();
+			m_Tasks.pop_front();
+			if(nNice != m_nNice)
+			{
+				nNice = m_nNice;
+#ifdef WIN32
+				SetThreadPriority(GetCurrentThread(), nNice > 0 ? THREAD_PRIORITY_BELOW_NORMAL : (nNice < 0 ? THREAD_PRIORITY_ABOVE_NORMAL : THREAD_PRIORITY_NORMAL));
+#else
+				// linux keeps a nice value per thread
+				if(setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nNice) != 0)
+				{
+					cout << "set nice value failed: " << nNice << endl;
+				}
+#endif
+			}
+			lock.unlock();
 
-	void FileAppender::WriteWithoutFlush(const std::string& msg)
-	{
-		m_filestream << msg;
-	}
+			// a pass may have listed the file just before it was compressed. an exception must not leave a worker
+			// thread, the file stays as it is for the next pass
+			try
+			{
+				if(exists(task.m_Files.FullPath(task.m_sStemName + ".log")) && task.m_Files.Compress(task.m_sStemName, &m_Budget))
+				{
+					m_nCompressed.fetch_add(1, boost::memory_order_relaxed);
+				}
+			}
+			catch(const std::exception& e)
+			{
+				cout << "compress file failed: " << e.what() << endl;
+			}
 
-	FileAppenderPtr FileAppender::Create()
-	{
-		return FileAppenderPtr(new FileAppender());
+			lock.lock();
+			m_InFlight.erase(task.m_sKey);
+			if(m_InFlight.empty())
+			{
+				m_IdleCond.notify_all();
+			}
+		}
+		m_nWorkers--;
+		m_IdleCond.notify_all();
 	}
 
-	// QueuedAppender
-	QueuedFileAppender::QueuedFileAppender()
-		: m_bRun (true)
+	// Housekeeper
+	HousekeeperPtr Housekeeper::Instance()
 	{
-		m_ThreadPtr = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&QueuedFileAppender::Loop, this)));
+		static HousekeeperPtr s_Instance(new Housekeeper());
+		return s_Instance;
 	}
 
-	QueuedFileAppender::~QueuedFileAppender()
+	Housekeeper::Housekeeper()
+		: m_nInterval(3600)
+		, m_bPending(false)
+		, m_bRun(true)
 	{
-		m_bRun = false;
-		m_ThreadPtr->join();
-		Sync(); // flush all the messages in the queue before exit
+		memset(&m_Stats, 0, sizeof(m_Stats));
+		m_ThreadPtr = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&Housekeeper::Loop, this)));
 	}
 
-	void QueuedFileAppender::Sync()
+	Housekeeper::~Housekeeper()
 	{
-		std::string sMsg;
-		FileAppender::Open();
-		while(m_Queue.PopMsg(sMsg))
 		{
-			FileAppender::WriteWithoutFlush(sMsg);
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			m_bRun = false;
+			m_Cond.notify_one();
 		}
-		FileAppender::Close();
+		m_ThreadPtr->join();
 	}
 
-	void QueuedFileAppender::Loop()
+	void Housekeeper::Watch(const FileManager& files)
 	{
-		while(m_bRun)
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		size_t i = 0;
+		for(; i < m_vFiles.size(); i++)
 		{
-			boost::this_thread::sleep(boost::posix_time::seconds(2));
-			Sync();
+			if(m_vFiles[i].GetDir() == files.GetDir() && m_vFiles[i].GetPrefixName() == files.GetPrefixName())
+			{
+				m_vFiles[i] = files; // the settings may have changed
+				break;
+			}
 		}
-	}
-	
-	void QueuedFileAppender::Write(const std::string& msg)
-	{
-		m_Queue.PushMsg(msg);
+		if(i == m_vFiles.size())
+		{
+			m_vFiles.push_back(files);
+		}
+		m_bPending = true;
+		m_Cond.notify_one();
 	}
 
-	QueuedFileAppenderPtr QueuedFileAppender::Create()
+	string Housekeeper::Hold(FileManager& files, const std::string& sTag)
 	{
-		return QueuedFileAppenderPtr(new QueuedFileAppender());
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		string sFileName = files.FullPath(files.SynthesizeTodyFileStem() + sTag + ".log");
+		m_OpenFiles.insert(sFileName);
+		return sFileName;
 	}
 
-	// queue
-
-	bool SafeQueue::PopMsg(std::string& sMsg)
+	void Housekeeper::Release(std::string& sFileName)
 	{
-		boost::lock_guard<LogMutex> lg(m_QueueMutex);
-		if(m_MsgQueue.empty())
+		if(sFileName.empty())
 		{
-			return false;
+			return;
 		}
-		sMsg = m_MsgQueue.front();
-		m_MsgQueue.pop_front();
-		return true;
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		std::multiset<string>::iterator it = m_OpenFiles.find(sFileName);
+		if(it != m_OpenFiles.end())
+		{
+			m_OpenFiles.erase(it); // only one, two appenders may write the same file
+		}
+		sFileName.clear();
 	}
 
-	void SafeQueue::PushMsg(const std::string& sMsg)
+	void Housekeeper::SetInterval(unsigned nSeconds)
 	{
-		boost::lock_guard<LogMutex> lg(m_QueueMutex);
-		m_MsgQueue.push_back(sMsg);
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_nInterval = nSeconds ? nSeconds : 1;
+		m_Cond.notify_one();
 	}
 
-	//utils
-	string GetLogTime()
+	void Housekeeper::RunNow()
 	{
-		time_t ttNow;
-		tm tmNow;
-		std::stringstream stime;
-		ttNow = time(NULL);
-		LOCAL_TIME(tmNow, ttNow);
-		stime << std::setfill('0') << std::setw(4) << tmNow.tm_year+1900 << "/";
-		stime << std::setfill('0') << std::setw(2) << tmNow.tm_mon+1 << "/";
-		stime << std::setfill('0') << std::setw(2) << tmNow.tm_mday << " ";
-		stime << std::setfill('0') << std::setw(2) << tmNow.tm_hour << ":";
-		stime << std::setfill('0') << std::setw(2) << tmNow.tm_min << ":";
-		stime << std::setfill('0') << std::setw(2) << tmNow.tm_sec;
-		return stime.str();
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_bPending = true;
+		m_Cond.notify_one();
 	}
 
-	FileManager::FileManager()
-		: m_sDir ("./")
+	HousekeepingStats Housekeeper::GetStats()
 	{
-		SetCompress(true);
-		SetMaxFileLife(100);
-		SetPrefixName("test");
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		HousekeepingStats stats = m_Stats;
+		stats.m_nFilesCompressed += m_Pool.GetCompressed();
+		return stats;
 	}
 
-	bool FileManager::SetDir(const std::string& sDir)
+	void Housekeeper::Loop()
 	{
-		try
+		boost::unique_lock<LogMutex> lock(m_Mutex);
+		time_t tLastPass = time(NULL);
+		while(m_bRun)
 		{
-			m_sDir = sDir;
-			replace(m_sDir.begin(), m_sDir.end(), '\\', '/');
-			if('/' != m_sDir[m_sDir.length()-1])
-			{
-				m_sDir += "/";
-			}
-			if(!boost::filesystem::exists(m_sDir))
+			time_t ttNow = time(NULL);
+			// a second after midnight, so the name of the new day is certain
+			time_t tWake = std::min<time_t>(tLastPass + m_nInterval, FileManager::NextRolloverTime(tLastPass) + 1);
+			if(!m_bPending && ttNow < tWake)
 			{
-				if(!boost::filesystem::create_directory(m_sDir))
-				{
-					m_sDir = "./";
-					return false;
-				}
+				// a minute at most, the wall clock may jump
+				m_Cond.timed_wait(lock, boost::posix_time::seconds((long)std::min<time_t>(tWake - ttNow, 60)));
+				continue;
 			}
+			m_bPending = false;
+			tLastPass = ttNow;
+			lock.unlock();
+			RunPass();
+			lock.lock();
 		}
-		catch(...)
+	}
+
+	void Housekeeper::RunPass()
+	{
+		std::vector<FileManager> vFiles;
+		std::multiset<string> openFiles;
+		time_t ttNow = 0;
 		{
-			return false;
+			boost::lock_guard<LogMutex> lock(m_Mutex);
+			vFiles = m_vFiles;
+			openFiles = m_OpenFiles;
+			ttNow = time(NULL); // with the lock, see Hold()
 		}
-		return true;
+		HousekeepingStats stats;
+		memset(&stats, 0, sizeof(stats));
+		boost::chrono::steady_clock::time_point tStart = boost::chrono::steady_clock::now();
+		for(size_t i = 0; i < vFiles.size(); i++)
+		{
+			vFiles[i].ArrangeFiles(&stats, &m_Pool, &openFiles, ttNow);
+		}
+		unsigned long long nPassUs = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - tStart).count();
+
+		boost::lock_guard<LogMutex> lock(m_Mutex);
+		m_Stats.m_nPasses++;
+		m_Stats.m_nLastPassUs = nPassUs;
+		m_Stats.m_nMaxPassUs = std::max(m_Stats.m_nMaxPassUs, nPassUs);
+		m_Stats.m_nTotalPassUs += nPassUs;
+		m_Stats.m_nFilesCompressed += stats.m_nFilesCompressed;
+		m_Stats.m_nFilesRemoved += stats.m_nFilesRemoved;
+		m_Stats.m_tLastPass = time(NULL);
+	}
+
+	time_t FileManager::NextRolloverTime(time_t tt)
+	{
+		tm _tm;
+		LOCAL_TIME(_tm, tt);
+		_tm.tm_mday++; // mktime normalizes the end of the month
+		_tm.tm_hour = 0;
+		_tm.tm_min = 0;
+		_tm.tm_sec = 0;
+		_tm.tm_isdst = -1; // the next day may not be in the same dst state
+		return mktime(&_tm);
 	}
 
-	string FileManager::FullPath(const std::string& sName)
+	string FileManager::FullPath(const std::string& sName) const
 	{
 		return m_sDir + sName;
 	}
@@ -243,9 +5172,21 @@ namespace CppLog
 		return FullPath(m_sPrefixName + "_" + GetDateString(ttNow) + ".log");
 	}
 
-	string FileManager::SynthesizeTodyFileStem()
+	string FileManager::FreeGzipName(const std::string& sStemName) const
 	{
-		time_t ttNow = time(NULL);
+		string sName = FullPath(sStemName + ".log.gz");
+		for(int i = 1; exists(sName); i++)
+		{
+			char buf[16];
+			snprintf(buf, sizeof(buf), ".%d", i);
+			sName = FullPath(sStemName + buf + ".log.gz");
+		}
+		return sName;
+	}
+
+	string FileManager::SynthesizeTodyFileStem(time_t tt)
+	{
+		time_t ttNow = tt ? tt : time(NULL);
 		return m_sPrefixName + "_" + GetDateString(ttNow);
 	}
 
@@ -264,11 +5205,13 @@ namespace CppLog
 #endif
 	}
 
-	void FileManager::ArrangeFiles()
+	void FileManager::ArrangeFiles(HousekeepingStats* pStats, CompressionPool* pPool,
+		const std::multiset<std::string>* pOpenFiles, time_t tNow)
 	{
+		TelemetryTimer timer(TIMER_ARRANGE_FILES);
 		vector<string> vsLogFiles;
 		vector<string> vsZipFiles;
-		string sLogNameTody = SynthesizeTodyFileStem();   //־
+		string sLogNameTody = SynthesizeTodyFileStem(tNow);   //־
 		string sLogNameEarlist = SynthesizeEarlistFileStem();//Ч־
 
 		ListLogFileStem(vsLogFiles, vsZipFiles);
@@ -281,6 +5224,10 @@ namespace CppLog
 				try
 				{
 					RemoveCompressedFile(*itZF);
+					if(pStats)
+					{
+						pStats->m_nFilesRemoved++;
+					}
 				}
 				catch(filesystem_error e)
 				{
@@ -293,13 +5240,26 @@ namespace CppLog
 		{
 			if(m_bCompress &&  (*itLF < sLogNameTody) && (*itLF >= sLogNameEarlist))
 			{
-				Compress(*itLF);
+				if(pOpenFiles && pOpenFiles->count(FullPath(*itLF + ".log")))
+				{
+					continue; // yesterday's, but an appender has not rolled over yet. its Reopen() asks for a pass
+				}
+				if(pPool)
+				{
+					pPool->Submit(*this, *itLF);
+				}
+				else if(Compress(*itLF) && pStats)
+				{
+					pStats->m_nFilesCompressed++;
+				}
 			}
 		}
 	}
 
-	void FileManager::Compress(const std::string &sStemName)
+	bool FileManager::Compress(const std::string &sStemName, IoBudget* pBudget)
 	{
+		TelemetryTimer timer(TIMER_COMPRESS);
+		bool bOk = false;
 		string sFullLogName = sStemName + ".log";
 #ifdef WIN32
 		string sFullZipName = sStemName + ".zip";
@@ -309,6 +5269,7 @@ namespace CppLog
 		{
 			if(ZipAdd(hz, sFullLogName.c_str(), FullPath(sFullLogName).c_str()) == ZR_OK)
 			{
+				bOk = true;
 				//ɾӦlogļ
 				try
 				{
@@ -322,9 +5283,31 @@ namespace CppLog
 			CloseZip(hz);
 		}
 #else
-		string cmd = "gzip " + FullPath(sFullLogName);
-		system(cmd.c_str());
+		// same name as the gzip command gave it, unless the compressed output mode took it
+		string sGzName = FreeGzipName(sStemName);
+		bool bCompressed = false;
+		if(m_bSeekableCompress)
+		{
+			bCompressed = BlockGzipFile(FullPath(sFullLogName), sGzName, pBudget);
+		}
+		else if(m_nCompressThreads > 1)
+		{
+			bCompressed = ParallelGzipFile(FullPath(sFullLogName), sGzName, m_nCompressThreads, 6, pBudget);
+		}
+		else
+		{
+			bCompressed = GzipFile(FullPath(sFullLogName), sGzName, 6, pBudget);
+		}
+		if(bCompressed)
+		{
+			bOk = true;
+			if(::remove(FullPath(sFullLogName).c_str()) != 0)
+			{
+				cout << "remove file failed: " << FullPath(sFullLogName) << endl;
+			}
+		}
 #endif
+		return bOk;
 	}
 
 	void FileManager::ListLogFileStem(vector<string> &vsLogFileStem, vector<string> &vsZipFileStem)
@@ -1,18 +1,30 @@
 #ifndef __CPP_LOG_H__
 #define __CPP_LOG_H__
 
+#include <ctime>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <set>
+#include <map>
 #include <memory>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#ifndef WIN32
+	#include <sys/uio.h>
+#endif
  
 namespace CppLog
 {
+	class LogRecord;
+	class LogStream;
 	class Appender;
 	class ConsoleAppender;
 	class FileAppender;
@@ -21,10 +33,21 @@ namespace CppLog
 
 	// data types
 	typedef boost::shared_ptr<FileManager> FileManagerPtr; 
+	typedef boost::shared_ptr<class Housekeeper> HousekeeperPtr;
+	class CompressionPool;
+	class IoBudget;
+	class GzipWriter;
+	class AsyncFileWriter;
+	class LogEncoder;
+	class BinaryLogEncoder;
+	class JsonLogEncoder;
 	typedef boost::shared_ptr<ConsoleAppender> ConsoleAppenderPtr;
  	typedef boost::shared_ptr<FileAppender> FileAppenderPtr;
  	typedef boost::shared_ptr<QueuedFileAppender> QueuedFileAppenderPtr;
+	typedef boost::shared_ptr<class MmapFileAppender> MmapFileAppenderPtr;
+	typedef boost::shared_ptr<class TelemetryDumper> TelemetryDumperPtr;
 	typedef boost::shared_ptr<Appender> AppenderPtr;
+	typedef boost::intrusive_ptr<const LogRecord> LogRecordPtr;
 	typedef std::vector<AppenderPtr> AppenderList;
 	typedef boost::mutex LogMutex;
 	// log level
@@ -37,6 +60,41 @@ namespace CppLog
 		LOG_LEVEL_FATAL,
 		LOG_LEVEL_ALL
 	};
+	// digits written after the seconds of the log time
+	enum TIME_PRECISION
+	{
+		TIME_PRECISION_SECOND,
+		TIME_PRECISION_MILLI,
+		TIME_PRECISION_MICRO,
+		TIME_PRECISION_NANO
+	};
+	// what a full queue does with a new record
+	enum OVERFLOW_POLICY
+	{
+		OVERFLOW_BLOCK, // the producer waits for room
+		OVERFLOW_DROP_NEWEST, // the new record is dropped
+		OVERFLOW_DROP_OLDEST, // the oldest queued record of the producer thread makes room
+		OVERFLOW_DROP_BELOW_LEVEL // records below the drop level are dropped, the others wait for room
+	};
+	// the queue of a queued appender
+	enum QUEUE_TYPE
+	{
+		QUEUE_RINGS, // SafeQueue, the records are passed without copy or lock and may be formatted by the writer
+		QUEUE_DOUBLE_BUFFER // DoubleBufferQueue, the producers render and copy the text under a short lock
+	};
+	// wall clock time of a log message
+	struct LogTime
+	{
+		time_t m_nSec;
+		long m_nNanoSec;
+	};
+	// where a log message comes from, every LOG_* call site has one static instance and its address identifies it.
+	// the level is not part of it, LOG_CMD may be given a different level on every call
+	struct LogSite
+	{
+		const char* m_sFile;
+		int m_nLine;
+	};
 	// class Log 
 	class Log
 	{
@@ -47,57 +105,539 @@ namespace CppLog
 			return aLog;
 		}
 		~Log();
+		// the appenders are published as an immutable list that Write() reads without a lock or a shared
+		// counter, so a slow appender only holds up its own callers. a change copies the list, then, with the
+		// mutex released, waits for the Write() calls still on the old one before it is freed and the removed
+		// appenders are destroyed (so an appender must not change the list from its Write())
 		void AddAppender(AppenderPtr appender);
-		AppenderList& GetAppenderList();
-		void SetLogLevel(LOG_LEVEL level);
+		void RemoveAppender(const AppenderPtr& appender);
+		void ClearAppenders();
+		AppenderList GetAppenders() const; // a copy of the current list
+		void Write(const LogRecordPtr& record); // hand the record to every appender, each one guards itself
+		void SetLogLevel(LOG_LEVEL level); // messages at or above this level are written, LOG_LEVEL_ALL writes everything
 		LOG_LEVEL GetLogLevel();
-		LogMutex& GetMutex();
+		void SetTimePrecision(TIME_PRECISION precision) { m_TimePrecision.store(precision, boost::memory_order_relaxed); }
+		TIME_PRECISION GetTimePrecision() const { return static_cast<TIME_PRECISION>(m_TimePrecision.load(boost::memory_order_relaxed)); }
+		LogMutex& GetMutex(); // serializes the changes of the appender list and the levels, Write() does not take it
+		// deferred formatting: the calling thread only captures the arguments and the appender renders the text later.
+		// it only takes effect while every appender accepts deferred records (see Appender::AcceptsDeferred)
+		void SetDeferredFormat(bool bDeferred);
+		bool IsDeferredFormat() const { return m_bDeferred.load(boost::memory_order_relaxed); }
+		// lock free, LOG_CMD checks it before evaluating the event. true if the level passes the log level and at
+		// least one appender wants it, so nothing is formatted for a record that no appender would write
+		bool IsEnabled(LOG_LEVEL level) const
+		{
+			return level >= m_nEnabledLevel.load(boost::memory_order_relaxed);
+		}
+		void UpdateLevels(); // with GetMutex() held, recomputes the level IsEnabled checks after a level changed
 
 	private:
 		Log();
-		AppenderList m_Appenders;
-		LOG_LEVEL m_LogLevel;
-		LogMutex m_Mutex;
+		void UpdateDeferred();
+		const AppenderList* Publish(AppenderList* pAppenders); // with m_Mutex held, takes the new list and returns the old one
+		void Retire(const AppenderList* pOld); // without m_Mutex, frees the old list once no Write() reads it
+		boost::atomic<int> m_LogLevel;
+		boost::atomic<int> m_TimePrecision;
+		bool m_bDeferredWanted;
+		boost::atomic<bool> m_bDeferred;
+		boost::atomic<int> m_nEnabledLevel; // the lowest level written anywhere, above LOG_LEVEL_FATAL if none
+		boost::atomic<const AppenderList*> m_pAppenders;
+		mutable LogMutex m_Mutex;
+	};
+
+	class TimeFormatter;
+
+	// a formatted log message, it is never modified after creation so that all the appenders can share it
+	// records are recycled through a pool when the last reference goes away, so their buffers keep their capacity.
+	// a deferred record holds the captured arguments instead of the text, Render() produces the text.
+	// the fields of a structured message (LOG_*_KV) are always kept typed, next to the text
+	class LogRecord
+	{
+	public:
+		static LogRecordPtr Create(std::string& sText); // takes the content of sText, sText is left empty
+		const std::string& GetText() const { return m_sText; } // the whole line, for records that are not deferred
+		const LogTime& GetTime() const { return m_Time; }
+		LOG_LEVEL GetLevel() const { return m_Level; } // created from text: LOG_LEVEL_FATAL, never dropped by level
+		bool IsDeferred() const { return m_bDeferred; }
+		const LogSite* GetSite() const { return m_pSite; } // 0 for a record created from text
+		TIME_PRECISION GetTimePrecision() const { return m_TimePrecision; }
+		void Render(std::string& sBuf, TimeFormatter& formatter) const; // appends the text line
+		void RenderMessage(std::string& sBuf) const; // appends the message alone (fields as text included), a record created from text is all message
+		bool HasFields() const { return !m_sFields.empty(); }
+
+	private:
+		LogRecord() : m_nMsgBegin(0), m_nFieldsBegin(0), m_nMsgEnd(0), m_pSite(0), m_Level(LOG_LEVEL_FATAL), m_TimePrecision(TIME_PRECISION_SECOND), m_bDeferred(false), m_nRef(0) {}
+		LogRecord(const LogRecord&);
+		LogRecord& operator=(const LogRecord&);
+		static LogRecord* Acquire();
+		static void Recycle(LogRecord* pRecord);
+		friend void intrusive_ptr_add_ref(const LogRecord* p);
+		friend void intrusive_ptr_release(const LogRecord* p);
+		friend class LogStream;
+		friend class JsonLogEncoder;
+		void RenderArgs(std::string& sBuf) const; // the captured message of a deferred record, without the fields
+
+		std::string m_sText;
+		std::string m_sFields; // key and typed value of every field, in the encoding of the deferred arguments
+		size_t m_nMsgBegin; // the message part of m_sText
+		size_t m_nFieldsBegin; // where the fields as text start in a record that is not deferred
+		size_t m_nMsgEnd;
+		LogTime m_Time;
+		const LogSite* m_pSite;
+		LOG_LEVEL m_Level;
+		TIME_PRECISION m_TimePrecision;
+		bool m_bDeferred;
+		mutable boost::atomic<int> m_nRef;
+	};
+
+	LogTime GetCurrentLogTime();
+
+	// renders log times as "YYYY/MM/DD HH:MM:SS[.fraction]". the "YYYY/MM/DD HH:MM:" part is cached and only
+	// rendered again when the minute changes; utc offsets (dst included) only change on a minute boundary,
+	// so a cached minute is always right. not thread safe, every LogStream owns one
+	class TimeFormatter
+	{
+	public:
+		TimeFormatter();
+		void Append(std::string& sBuf, const LogTime& tmLog, TIME_PRECISION precision);
+
+	private:
+		void RenderMinute(time_t tt);
+		time_t m_nMinuteStart;
+		char m_szMinute[17];
+	};
+
+	// formatting helpers, they append to the buffer and never allocate once it has enough capacity
+	void AppendInt(std::string& sBuf, long long n);
+	void AppendUInt(std::string& sBuf, unsigned long long n);
+	void AppendDouble(std::string& sBuf, double d);
+	void AppendLongDouble(std::string& sBuf, long double d);
+	void AppendPointer(std::string& sBuf, const void* p);
+	void AppendJsonString(std::string& sBuf, const char* p, size_t nLen); // escaped for a json string, without the quotes
+
+	// formats one log message straight into a reusable record buffer of the calling thread.
+	// the common types have their own formatters, any other type with an operator<< goes through a std::ostream,
+	// and after a stateful manipulator (std::hex, std::setw, ...) the rest of the message does too.
+	// in deferred mode the common types are captured as raw bytes and the others are turned into strings right away
+	class LogStream
+	{
+	public:
+		LogStream& operator<<(const char* s);
+		LogStream& operator<<(char* s) { return *this << static_cast<const char*>(s); }
+		LogStream& operator<<(const signed char* s) { return *this << reinterpret_cast<const char*>(s); }
+		LogStream& operator<<(signed char* s) { return *this << reinterpret_cast<const char*>(s); }
+		LogStream& operator<<(const unsigned char* s) { return *this << reinterpret_cast<const char*>(s); }
+		LogStream& operator<<(unsigned char* s) { return *this << reinterpret_cast<const char*>(s); }
+		LogStream& operator<<(const std::string& s) { if(!m_bFast) return Special(s); m_pText->append(s); return *this; }
+		LogStream& operator<<(char c) { if(!m_bFast) return Special(c); m_pText->push_back(c); return *this; }
+		LogStream& operator<<(signed char c) { return *this << static_cast<char>(c); }
+		LogStream& operator<<(unsigned char c) { return *this << static_cast<char>(c); }
+		LogStream& operator<<(bool b) { if(!m_bFast) return Special(b); m_pText->push_back(b ? '1' : '0'); return *this; }
+		LogStream& operator<<(short n) { if(!m_bFast) return Special(n); AppendInt(*m_pText, n); return *this; }
+		LogStream& operator<<(unsigned short n) { if(!m_bFast) return Special(n); AppendUInt(*m_pText, n); return *this; }
+		LogStream& operator<<(int n) { if(!m_bFast) return Special(n); AppendInt(*m_pText, n); return *this; }
+		LogStream& operator<<(unsigned int n) { if(!m_bFast) return Special(n); AppendUInt(*m_pText, n); return *this; }
+		LogStream& operator<<(long n) { if(!m_bFast) return Special(n); AppendInt(*m_pText, n); return *this; }
+		LogStream& operator<<(unsigned long n) { if(!m_bFast) return Special(n); AppendUInt(*m_pText, n); return *this; }
+		LogStream& operator<<(long long n) { if(!m_bFast) return Special(n); AppendInt(*m_pText, n); return *this; }
+		LogStream& operator<<(unsigned long long n) { if(!m_bFast) return Special(n); AppendUInt(*m_pText, n); return *this; }
+		LogStream& operator<<(float d) { return *this << static_cast<double>(d); }
+		LogStream& operator<<(double d) { if(!m_bFast) return Special(d); AppendDouble(*m_pText, d); return *this; }
+		LogStream& operator<<(long double d) { if(!m_bFast) return Special(d); AppendLongDouble(*m_pText, d); return *this; }
+		LogStream& operator<<(const void* p) { if(!m_bFast) return Special(p); AppendPointer(*m_pText, p); return *this; }
+		template<class T> LogStream& operator<<(T* p) { return *this << static_cast<const void*>(p); }
+		LogStream& operator<<(std::ostream& (*pf)(std::ostream&));
+		LogStream& operator<<(std::ios_base& (*pf)(std::ios_base&));
+		template<class T> LogStream& operator<<(const T& v)
+		{
+			SlowStream() << v;
+			return FlushSlow();
+		}
+
+		// a field of a structured message: the text line gets " key=value" after the message, the json output a
+		// typed member. the common types are kept as they are, any other type is turned into its text
+		LogStream& Field(const char* sKey, const char* v);
+		LogStream& Field(const char* sKey, char* v) { return Field(sKey, static_cast<const char*>(v)); }
+		LogStream& Field(const char* sKey, const std::string& v);
+		LogStream& Field(const char* sKey, char c);
+		LogStream& Field(const char* sKey, signed char c) { return Field(sKey, static_cast<char>(c)); }
+		LogStream& Field(const char* sKey, unsigned char c) { return Field(sKey, static_cast<char>(c)); }
+		LogStream& Field(const char* sKey, bool b);
+		LogStream& Field(const char* sKey, short n) { return Field(sKey, static_cast<long long>(n)); }
+		LogStream& Field(const char* sKey, unsigned short n) { return Field(sKey, static_cast<unsigned long long>(n)); }
+		LogStream& Field(const char* sKey, int n) { return Field(sKey, static_cast<long long>(n)); }
+		LogStream& Field(const char* sKey, unsigned int n) { return Field(sKey, static_cast<unsigned long long>(n)); }
+		LogStream& Field(const char* sKey, long n) { return Field(sKey, static_cast<long long>(n)); }
+		LogStream& Field(const char* sKey, unsigned long n) { return Field(sKey, static_cast<unsigned long long>(n)); }
+		LogStream& Field(const char* sKey, long long n);
+		LogStream& Field(const char* sKey, unsigned long long n);
+		LogStream& Field(const char* sKey, float d) { return Field(sKey, static_cast<double>(d)); }
+		LogStream& Field(const char* sKey, double d);
+		LogStream& Field(const char* sKey, long double d);
+		LogStream& Field(const char* sKey, const void* p);
+		template<class T> LogStream& Field(const char* sKey, T* p) { return Field(sKey, static_cast<const void*>(p)); }
+		template<class T> LogStream& Field(const char* sKey, const T& v)
+		{
+			std::ostringstream os;
+			os << v;
+			return Field(sKey, os.str());
+		}
+		// the message and up to 8 fields, for LOG_*_KV
+		template<class M> void Kv(const M& msg)
+		{
+			*this << msg;
+		}
+		template<class M, class V1> void Kv(const M& msg, const char* k1, const V1& v1)
+		{
+			*this << msg;
+			Field(k1, v1);
+		}
+		template<class M, class V1, class V2> void Kv(const M& msg, const char* k1, const V1& v1, const char* k2, const V2& v2)
+		{
+			Kv(msg, k1, v1);
+			Field(k2, v2);
+		}
+		template<class M, class V1, class V2, class V3> void Kv(const M& msg, const char* k1, const V1& v1, const char* k2, const V2& v2,
+			const char* k3, const V3& v3)
+		{
+			Kv(msg, k1, v1, k2, v2);
+			Field(k3, v3);
+		}
+		template<class M, class V1, class V2, class V3, class V4> void Kv(const M& msg, const char* k1, const V1& v1, const char* k2, const V2& v2,
+			const char* k3, const V3& v3, const char* k4, const V4& v4)
+		{
+			Kv(msg, k1, v1, k2, v2, k3, v3);
+			Field(k4, v4);
+		}
+		template<class M, class V1, class V2, class V3, class V4, class V5> void Kv(const M& msg, const char* k1, const V1& v1, const char* k2, const V2& v2,
+			const char* k3, const V3& v3, const char* k4, const V4& v4, const char* k5, const V5& v5)
+		{
+			Kv(msg, k1, v1, k2, v2, k3, v3, k4, v4);
+			Field(k5, v5);
+		}
+		template<class M, class V1, class V2, class V3, class V4, class V5, class V6> void Kv(const M& msg, const char* k1, const V1& v1, const char* k2, const V2& v2,
+			const char* k3, const V3& v3, const char* k4, const V4& v4, const char* k5, const V5& v5, const char* k6, const V6& v6)
+		{
+			Kv(msg, k1, v1, k2, v2, k3, v3, k4, v4, k5, v5);
+			Field(k6, v6);
+		}
+		template<class M, class V1, class V2, class V3, class V4, class V5, class V6, class V7> void Kv(const M& msg, const char* k1, const V1& v1,
+			const char* k2, const V2& v2, const char* k3, const V3& v3, const char* k4, const V4& v4, const char* k5, const V5& v5,
+			const char* k6, const V6& v6, const char* k7, const V7& v7)
+		{
+			Kv(msg, k1, v1, k2, v2, k3, v3, k4, v4, k5, v5, k6, v6);
+			Field(k7, v7);
+		}
+		template<class M, class V1, class V2, class V3, class V4, class V5, class V6, class V7, class V8> void Kv(const M& msg, const char* k1, const V1& v1,
+			const char* k2, const V2& v2, const char* k3, const V3& v3, const char* k4, const V4& v4, const char* k5, const V5& v5,
+			const char* k6, const V6& v6, const char* k7, const V7& v7, const char* k8, const V8& v8)
+		{
+			Kv(msg, k1, v1, k2, v2, k3, v3, k4, v4, k5, v5, k6, v6, k7, v7);
+			Field(k8, v8);
+		}
+
+		// used by the log macros
+		static LogStream& Begin(const Log& log, const LogSite& site, LOG_LEVEL level); // takes a free stream of this thread and writes the time and level
+		LogRecordPtr Finish(); // writes the location and gives the stream back
+		void Abandon(); // gives the stream back without a record, for an event that threw
+
+	private:
+		LogStream();
+		~LogStream();
+		LogStream(const LogStream&);
+		LogStream& operator=(const LogStream&);
+		friend struct ThreadStreams;
+
+		// slow or deferred, the type is kept so that the std::ostream formats it exactly as before
+		template<class T> LogStream& Special(const T& v)
+		{
+			if(m_bSlow)
+			{
+				*m_pSlow << v;
+			}
+			else
+			{
+				Capture(v);
+			}
+			return *this;
+		}
+		void Capture(const std::string& s) { Capture(s.data(), s.size()); }
+		void Capture(const char* s, size_t nLen);
+		void Capture(char c);
+		void Capture(bool b);
+		void Capture(long long n);
+		void Capture(unsigned long long n);
+		void Capture(short n) { Capture(static_cast<long long>(n)); }
+		void Capture(unsigned short n) { Capture(static_cast<unsigned long long>(n)); }
+		void Capture(int n) { Capture(static_cast<long long>(n)); }
+		void Capture(unsigned int n) { Capture(static_cast<unsigned long long>(n)); }
+		void Capture(long n) { Capture(static_cast<long long>(n)); }
+		void Capture(unsigned long n) { Capture(static_cast<unsigned long long>(n)); }
+		void Capture(double d);
+		void Capture(long double d);
+		void Capture(const void* p);
+		std::string& FieldKey(const char* sKey); // appends the key to the fields of the record, the value goes after it
+		std::ostream& SlowStream();
+		LogStream& FlushSlow();
+
+		boost::intrusive_ptr<LogRecord> m_Record;
+		std::string* m_pText;
+		bool m_bFast; // neither slow nor deferred, the common types are formatted inline
+		bool m_bSlow; // a manipulator was used, the rest of the message goes through m_pSlow
+		bool m_bDeferred;
+		std::ostringstream* m_pSlow;
+		TimeFormatter m_TimeFormatter;
+	};
+
+	// gives the stream back to its thread if the event expression throws
+	class LogStreamGuard
+	{
+	public:
+		explicit LogStreamGuard(LogStream& stream) : m_pStream(&stream) {}
+		~LogStreamGuard() { if(m_pStream) m_pStream->Abandon(); }
+		LogRecordPtr Finish()
+		{
+			LogStream* pStream = m_pStream;
+			m_pStream = 0;
+			return pStream->Finish();
+		}
+	private:
+		LogStream* m_pStream;
 	};
 
 	// log appender, base class
 	class Appender
 	{
 	public:
-		Appender(){}
+		Appender() : m_Level(LOG_LEVEL_ALL) {}
 		virtual ~Appender(){};
 		virtual void Write(const std::string& msg) = 0;
+		// called by Log, the default writes the text, override it to keep the record without copying
+		virtual void Write(const LogRecordPtr& record);
+		// true if the appender renders deferred records itself, off the logging thread
+		virtual bool AcceptsDeferred() const { return false; }
+		// on top of the log level, this appender only gets the messages at or above its own level.
+		// LOG_LEVEL_ALL (the default) takes everything the log level lets through
+		void SetLevel(LOG_LEVEL level);
+		LOG_LEVEL GetLevel() const { return static_cast<LOG_LEVEL>(m_Level.load(boost::memory_order_relaxed)); }
+		bool Wants(LOG_LEVEL level) const
+		{
+			int nLevel = m_Level.load(boost::memory_order_relaxed);
+			return (nLevel == LOG_LEVEL_ALL) || (level >= nLevel);
+		}
 //		virtual void Open(){}
 //		virtual void Close(){}
 
 	private:
+		boost::atomic<int> m_Level;
 	};
 	
+	// what the housekeeping passes did, times in microseconds
+	struct HousekeepingStats
+	{
+		unsigned long m_nPasses;
+		unsigned long long m_nLastPassUs;
+		unsigned long long m_nMaxPassUs;
+		unsigned long long m_nTotalPassUs;
+		unsigned long m_nFilesCompressed;
+		unsigned long m_nFilesRemoved;
+		time_t m_tLastPass;
+	};
+
+	// what the asynchronous writes of a file appender did (FileAppender::SetAsyncWrites)
+	struct AsyncWriteStats
+	{
+		bool m_bUring; // false: the pwritev fallback
+		unsigned long long m_nWrites; // buffers handed to the kernel
+		unsigned long long m_nBytes;
+		unsigned m_nMaxInFlight; // buffers written at the same time
+		unsigned long long m_nInFlightSum; // in flight after every write, divided by m_nWrites gives the mean depth
+	};
+
+	// log2 buckets, bucket i counts the values from 2^i up to 2^(i+1)-1 (bucket 0 also counts 0)
+	const int c_nTelemetryBuckets = 32;
+	// an operation that is timed every time it runs
+	struct TimerStats
+	{
+		unsigned long long m_nCount;
+		unsigned long long m_nTotalNs;
+		unsigned long long m_nMaxNs;
+	};
+	// what the logger did since the process started. every thread counts into its own slot without a lock or a
+	// locked instruction, GetTelemetryStats() adds the slots up; the threads that are gone leave their counts behind
+	struct TelemetryStats
+	{
+		unsigned long long m_nMessages[LOG_LEVEL_ALL]; // handed to the appenders, per level
+		unsigned long long m_nBytesWritten; // by the file appenders, before compression
+		unsigned long long m_nBytesLost; // by the file appenders whose file could not be opened
+		unsigned long long m_nDropped; // by full queues
+		unsigned long long m_nQueueDepth; // records queued now, all the queued appenders together
+		unsigned long long m_nMaxQueueDepth; // the biggest batch a writer took, the queue was at least that deep
+		unsigned long long m_EnqueueLatencyNs[c_nTelemetryBuckets]; // queued appenders, one LOG_* call in 16 of every thread is timed
+		unsigned long long m_BatchSize[c_nTelemetryBuckets]; // records per batch of the queued writers
+		TimerStats m_Sync; // the queued writers, per batch
+		TimerStats m_ArrangeFiles; // retention passes
+		TimerStats m_Compress; // rotated files compressed
+		unsigned long long m_nOpens; // log files opened
+		unsigned long long m_nCloses;
+	};
+	TelemetryStats GetTelemetryStats();
+	void FormatTelemetryStats(const TelemetryStats& stats, std::string& sBuf); // appends one json object and a newline
+
+	// appends GetTelemetryStats() to a side file every interval as a json line with the time, and once more when
+	// it is destroyed. the file is opened for every line, it can be moved away at any time
+	class TelemetryDumper
+	{
+	public:
+		static TelemetryDumperPtr Create(const std::string& sPath, unsigned nIntervalSeconds = 10);
+		~TelemetryDumper();
+
+	private:
+		TelemetryDumper(const std::string& sPath, unsigned nIntervalSeconds);
+		TelemetryDumper(const TelemetryDumper&);
+		TelemetryDumper& operator=(const TelemetryDumper&);
+		void Loop();
+		void Dump();
+
+		std::string m_sPath;
+		unsigned m_nInterval;
+		bool m_bRun; // guarded by m_Mutex
+		LogMutex m_Mutex;
+		boost::condition_variable m_Cond;
+		boost::shared_ptr<boost::thread> m_ThreadPtr;
+	};
+
 	class FileManager
 	{
 	public:
 		FileManager();
 		bool SetDir(const std::string& sDir);
 		const std::string& GetDir() const { return m_sDir; }
-		void SetPrefixName(const std::string& sPrefixName) { m_sPrefixName = sPrefixName; }
+		void SetPrefixName(const std::string& sPrefixName) { m_sPrefixName = sPrefixName; m_nNameVersion++; }
 		const std::string& GetPrefixName() const { return m_sPrefixName; }
 		void SetMaxFileLife(int nDays){ m_nMaxFileLife = nDays; }
 		void SetCompress(bool bCompress) { m_bCompress = bCompress; }
+		void SetCompressThreads(unsigned nThreads) { m_nCompressThreads = nThreads; } // more than 1 splits big files into chunks deflated in parallel
+		void SetSeekableCompress(bool bSeekable) { m_bSeekableCompress = bSeekable; } // compress into the block format of BlockLogWriter
 
 		std::string SynthesizeTodyFileName(); // for current date, with path
-		void ArrangeFiles(); // clean and compress, if it is set
+		// clean and compress, if it is set. with a pool the compressions are queued to it. the files in pOpenFiles
+		// (with path) are left alone, an appender still writes them. tNow is the time of the pass, now if 0
+		void ArrangeFiles(HousekeepingStats* pStats = 0, CompressionPool* pPool = 0,
+			const std::multiset<std::string>* pOpenFiles = 0, time_t tNow = 0);
+		static time_t NextRolloverTime(time_t tt); // the next local midnight after tt
+	protected:
+		unsigned m_nNameVersion; // changes with the dir or the prefix, the open file is then the wrong one
+		std::string SynthesizeTodyFileStem(time_t tt = 0); // for the date of tt (current date if 0), without path
+		// stem.log.gz, or stem.N.log.gz with the first free N, with path. a gzip member is never appended
+		// to a file that a crash may have left with an unfinished one
+		std::string FreeGzipName(const std::string& sStemName) const;
+		std::string FullPath(const std::string& sName) const;
 	private:
-		std::string SynthesizeTodyFileStem(); // for current date, without path
 		std::string SynthesizeEarlistFileStem();  // for the earlist file, without path
 		void ListLogFileStem(std::vector<std::string> &vsLogFiles, std::vector<std::string> &vsZipFiles);
 		std::string GetDateString(time_t tt);
-		std::string FullPath(const std::string& sName);
-		void Compress(const std::string &sStemName);
+		bool Compress(const std::string &sStemName, IoBudget* pBudget = 0);
+		friend class CompressionPool;
+		friend class Housekeeper;
 		void RemoveCompressedFile(const std::string &sStemName);
 		std::string m_sDir;
 		std::string m_sPrefixName;
 		int m_nMaxFileLife; // exist days
 		bool m_bCompress;
+		unsigned m_nCompressThreads;
+		bool m_bSeekableCompress;
+	};
+
+	// a bytes per second budget shared by several threads, Take() sleeps when it is spent
+	class IoBudget
+	{
+	public:
+		IoBudget();
+		void SetRate(size_t nBytesPerSec); // 0 means no limit
+		void Take(size_t nBytes);
+	private:
+		LogMutex m_Mutex;
+		size_t m_nRate;
+		double m_dTokens; // negative when the threads are ahead of the budget
+		boost::posix_time::ptime m_tLast;
+	};
+
+	// compresses log files on several threads, for the backlog of days that piles up when compression is turned
+	// on for an old directory. a file already queued or being compressed is not queued again
+	class CompressionPool
+	{
+	public:
+		CompressionPool();
+		~CompressionPool();
+		void SetThreads(unsigned nThreads); // 1 by default
+		void SetNice(int nNice); // niceness of the compression threads (thread priority on windows), 0 by default
+		void SetIoBudget(size_t nBytesPerSec) { m_Budget.SetRate(nBytesPerSec); } // bytes read per second by all the threads, 0 means no limit
+		bool Submit(const FileManager& files, const std::string& sStemName); // false if the file is already queued
+		void WaitIdle(); // until the queue is empty and no file is being compressed
+		unsigned long GetCompressed() const { return m_nCompressed.load(boost::memory_order_relaxed); }
+
+	private:
+		CompressionPool(const CompressionPool&);
+		CompressionPool& operator=(const CompressionPool&);
+		void Loop();
+
+		struct Task
+		{
+			FileManager m_Files;
+			std::string m_sStemName;
+			std::string m_sKey;
+		};
+		std::deque<Task> m_Tasks;
+		std::set<std::string> m_InFlight; // queued or running, by full path
+		unsigned m_nThreads;
+		unsigned m_nWorkers;
+		int m_nNice;
+		bool m_bRun;
+		LogMutex m_Mutex;
+		boost::condition_variable m_Cond;
+		boost::condition_variable m_IdleCond;
+		boost::thread_group m_Workers;
+		IoBudget m_Budget;
+		boost::atomic<unsigned long> m_nCompressed;
+	};
+
+	// runs ArrangeFiles for every log directory on its own thread, so the writers never wait for a directory
+	// scan or a compression. a pass runs when a file appender opens a new file, after every local midnight
+	// and every interval (an hour by default)
+	class Housekeeper
+	{
+	public:
+		static HousekeeperPtr Instance(); // the appenders keep it alive until the last one is gone
+		~Housekeeper();
+		void Watch(const FileManager& files); // takes a copy of the settings and asks for a pass
+		// names today's .log of files, sTag goes before the extension, and keeps the passes from compressing it
+		// until Release(). the name is taken under the lock a pass takes its time with, so a pass can never
+		// count the file of an appender that is still opening it as yesterday's
+		std::string Hold(FileManager& files, const std::string& sTag);
+		void Release(std::string& sFileName); // after the file is closed, and clears the name. nothing if it is empty
+		void SetInterval(unsigned nSeconds);
+		void RunNow(); // asks for a pass, does not wait for it
+		HousekeepingStats GetStats(); // a pass only queues the compressions, m_nFilesCompressed counts the finished ones
+		CompressionPool& GetCompressionPool() { return m_Pool; }
+
+	private:
+		Housekeeper();
+		Housekeeper(const Housekeeper&);
+		Housekeeper& operator=(const Housekeeper&);
+		void Loop();
+		void RunPass();
+
+		std::vector<FileManager> m_vFiles; // one per dir and prefix
+		std::multiset<std::string> m_OpenFiles; // held by the appenders
+		unsigned m_nInterval;
+		bool m_bPending;
+		bool m_bRun;
+		HousekeepingStats m_Stats;
+		CompressionPool m_Pool;
+		LogMutex m_Mutex;
+		boost::condition_variable m_Cond;
+		boost::shared_ptr<boost::thread> m_ThreadPtr;
 	};
 
 	// file appender
@@ -107,57 +647,426 @@ namespace CppLog
 		static FileAppenderPtr Create();
 		~FileAppender();
 		virtual void Write(const std::string& msg);
+		virtual void Write(const LogRecordPtr& record);
+		// writes prefix_YYYYMMDD.log.gz directly (prefix_YYYYMMDD.N.log.gz if the process opens that day again).
+		// a flush is a deflate sync point, the file can be read up to there even if the process dies before the end.
+		// Write() flushes once a second or every 64KB, the queued appender after every batch. not on windows.
+		// bSeekable writes the block format of BlockLogWriter instead, a flush then ends the block if it is
+		// at least 64KB or a second old
+		void SetCompressedOutput(bool bCompressed, bool bSeekable = false);
+		// writes the records in the binary format of BinaryLogEncoder to prefix_YYYYMMDD.bin.log (.bin.log.gz with
+		// the compressed output), cpplog-decode turns it back into text. the .log extension keeps the files in
+		// the retention and compression of ArrangeFiles
+		void SetBinaryOutput(bool bBinary);
+		// writes one json object per record (see JsonLogEncoder) to prefix_YYYYMMDD.json.log, for pipelines that
+		// ingest json. with QUEUE_DOUBLE_BUFFER the queue already holds text lines, each one becomes a "msg"
+		void SetJsonOutput(bool bJson);
+		// plain output goes out in buffers of nBufferSize, up to nInFlight of them written at the same time while
+		// the next ones fill, so the queued writer thread does not wait for the disk. io_uring with registered
+		// buffers when the kernel has it, otherwise the filled buffers go out together with one pwritev. Write()
+		// hands its buffer to the kernel once a second or every 64KB, the queued appender after every batch.
+		// every buffer is written at its own offset, so no other appender may write the same file.
+		// 0 turns it off. ignored with the compressed output, not on windows
+		void SetAsyncWrites(unsigned nInFlight, size_t nBufferSize = 1024 * 1024);
+		AsyncWriteStats GetAsyncWriteStats() const;
+		// the next write closes the file and opens it again, as at the rollover. for a file moved away by an
+		// external rotation (logrotate), may be called from any thread
+		void RequestReopen() { m_bReopen.store(true, boost::memory_order_relaxed); }
 	protected:
 		FileAppender();
-		void Open();
+		void Open(); // the file stays open, it is only opened again when the day (or the name) changes
 		void Close();
-		void WriteWithoutFlush(const std::string& msg);
+		void Flush();
+		void WriteWithoutFlush(const std::string& msg); // raw bytes
+		void WriteText(const std::string& msg); // a text line, encoded in binary and json mode
+		void WriteRecord(const LogRecord& record); // rendered or encoded
+		void WriteBatch(const std::vector<LogRecordPtr>& vRecords); // same, with as few write calls as possible
+		void WriteLines(const std::string& sLines, const std::vector<size_t>& vEnds); // text lines ending at vEnds, encoded in binary and json mode
+
+		std::string m_sRenderBuf;
+		TimeFormatter m_TimeFormatter;
+		// Write() may be called by several threads at once, the queued writer holds it for a batch. the output
+		// settings take it too, so the encoder or the writer is never swapped under a write
+		LogMutex m_WriteMutex;
 	private:
-		std::ofstream m_filestream;
+		void Reopen(time_t ttNow);
+		bool IsOpen() const;
+		void FlushIfDue();
+		void SetEncoder(const boost::shared_ptr<LogEncoder>& encoder); // 0 for the text lines
+		std::string m_sLine; // one of the lines given to WriteLines
+		std::ofstream m_filestream; // plain output on windows
+#ifndef WIN32
+		void WriteSegments(); // m_vIov with one writev, or a few for more than IOV_MAX
+		int m_nFile; // plain output, O_APPEND, written without a user space buffer
+		std::vector<iovec> m_vIov; // the segments without base are the next bytes of m_sRenderBuf
+		void Lose(size_t nBytes); // no file is open, counts the bytes and says so at most once a second
+		unsigned long long m_nLostBytes; // since the last message
+		time_t m_tLostReported;
+#endif
+		boost::shared_ptr<LogEncoder> m_Encoder; // set in binary and json mode
+		boost::shared_ptr<GzipWriter> m_GzipWriter; // set in compressed mode
+		boost::shared_ptr<AsyncFileWriter> m_AsyncWriter; // set with the asynchronous writes
+		unsigned m_nAsyncInFlight;
+		size_t m_nAsyncBufferSize;
+		AsyncWriteStats m_AsyncStats;
+		mutable LogMutex m_StatsMutex;
+		bool m_bCompressedOutput;
+		bool m_bSeekableOutput;
+		time_t m_tLastFlush;
+		size_t m_nUnflushed;
+		time_t m_tRollover; // the file has to be reopened from then on
+		unsigned m_nOpenVersion;
+		HousekeeperPtr m_Housekeeper;
+		std::string m_sHeldFile; // the open .log, the housekeeper does not touch it
+		boost::atomic<bool> m_bReopen;
 	};
 	// console appender
 	class ConsoleAppender : public Appender
 	{
 	public:
 		static ConsoleAppenderPtr Create();
+		using Appender::Write;
 		virtual void Write(const std::string& msg);
 	protected:
 		ConsoleAppender();
+	private:
+		LogMutex m_Mutex; // the lines of several threads stay whole
 	};
 
 	// queue, thread safe
+	// every producer thread gets its own lock free single producer / single consumer ring the first time it
+	// pushes, so producers never contend with each other. the consumer drains all the rings and merges by time.
+	// the queue is bounded in records and bytes, the overflow policy decides what happens when it is full
+	class RecordRing;
+	typedef boost::shared_ptr<RecordRing> RecordRingPtr;
 	class SafeQueue
 	{
 	public:
-		bool PopMsg(std::string& sMsg);
-		void PushMsg(const std::string& sMsg);
+		SafeQueue();
+		~SafeQueue();
+		bool PushMsg(const LogRecordPtr& record); // false if the record was dropped
+		void PopAll(std::vector<LogRecordPtr>& vRecords); // consumer only, appends every queued record in time order
+		void SetCapacity(size_t nMaxRecords, size_t nMaxBytes); // 0 means no limit
+		void SetOverflowPolicy(OVERFLOW_POLICY policy, LOG_LEVEL dropLevel = LOG_LEVEL_WARN);
+		size_t TakeDropped(); // records dropped since the last call
+		// records queued now, with the capacity the producer threads took ahead (at most 64 records each)
+		size_t GetDepth() const { return m_nRecords.load(boost::memory_order_relaxed); }
+		// consumer wake up: producers signal once this many records or bytes are queued
+		void SetWakeThreshold(size_t nRecords, size_t nBytes);
+		void WaitForWork(unsigned nMaxWaitMs); // consumer only, parks until there is a batch, a wake up or the time is out
+		void Wake(bool bAlways = false); // wakes the consumer if it is parked, bAlways also cuts its next wait short
 
 	private:
-		std::stringstream m_ssCache;
-		std::deque<std::string> m_MsgQueue;
-		LogMutex m_QueueMutex;
+		SafeQueue(const SafeQueue&);
+		SafeQueue& operator=(const SafeQueue&);
+		RecordRing& GetRing(); // the ring of the calling thread
+		void RefreshRings();
+		void Merge(std::vector<LogRecordPtr>& vRecords);
+		// counts the record in, out of the credit of the calling thread's ring or the shared counters.
+		// false if that goes over the capacity
+		bool Reserve(RecordRing& ring, size_t nBytes);
+		bool TryReserve(size_t nRecords, size_t nBytes); // the shared counters, nothing is counted if it fails
+		bool IsReady(bool bConsumer); // enough queued to be worth waking the consumer
+		void Unreserve(size_t nRecords, size_t nBytes);
+		void TakeCredit(RecordRing& ring, size_t& nRecords, size_t& nBytes); // consumer, adds what the ring gives back
+		void WaitForRoom(RecordRing& ring, size_t nBytes);
+
+		boost::atomic<size_t> m_nMaxRecords;
+		boost::atomic<size_t> m_nMaxBytes;
+		boost::atomic<int> m_Policy;
+		boost::atomic<int> m_DropLevel;
+		boost::atomic<size_t> m_nRecords; // queued, and the credit of the rings
+		boost::atomic<size_t> m_nBytes;
+		boost::atomic<size_t> m_nDropped;
+		boost::atomic<int> m_nBlocked; // producers waiting for room
+		LogMutex m_RoomMutex;
+		boost::condition_variable m_RoomCond;
+		boost::atomic<size_t> m_nWakeRecords;
+		boost::atomic<size_t> m_nWakeBytes;
+		boost::atomic<bool> m_bParked; // the consumer is waiting, only then producers pay for a signal
+		bool m_bWake; // guarded by m_WakeMutex
+		LogMutex m_WakeMutex;
+		boost::condition_variable m_WakeCond;
+
+		unsigned long m_nId; // tells the queues apart in the thread local ring lists
+		LogMutex m_RegistryMutex;
+		std::vector<RecordRingPtr> m_vRings;
+		boost::atomic<unsigned> m_nVersion; // changes whenever m_vRings does
+		// consumer side
+		std::vector<RecordRingPtr> m_vConsumerRings;
+		unsigned m_nConsumerVersion;
+		std::vector<std::vector<LogRecordPtr> > m_vDrained;
+	};
+
+	// two byte buffers of rendered lines. producers append to the front one under a short lock, the writer swaps
+	// it with its back one in O(1) and writes that in one go. the buffers keep their capacity, so nothing is
+	// allocated once they have grown. the capacity, overflow policy and wake up work as in SafeQueue, except that
+	// OVERFLOW_DROP_OLDEST drops the new line (the old ones are already in one block)
+	class DoubleBufferQueue
+	{
+	public:
+		DoubleBufferQueue();
+		bool Push(const std::string& sLine, LOG_LEVEL level); // false if the line was dropped
+		void Swap(std::string& sLines, std::vector<size_t>& vEnds); // consumer only, gives the empty back buffers, gets the lines and where each one ends
+		void SetCapacity(size_t nMaxRecords, size_t nMaxBytes); // 0 means no limit
+		void SetOverflowPolicy(OVERFLOW_POLICY policy, LOG_LEVEL dropLevel = LOG_LEVEL_WARN);
+		size_t TakeDropped();
+		size_t GetDepth(); // lines in the front buffer
+		void SetWakeThreshold(size_t nRecords, size_t nBytes);
+		void WaitForWork(unsigned nMaxWaitMs);
+		void Wake(bool bAlways = false);
+
+	private:
+		DoubleBufferQueue(const DoubleBufferQueue&);
+		DoubleBufferQueue& operator=(const DoubleBufferQueue&);
+		bool IsReady() const { return m_vFrontEnds.size() >= m_nWakeRecords || m_sFront.size() >= m_nWakeBytes; }
+
+		LogMutex m_Mutex; // guards everything below
+		std::string m_sFront;
+		std::vector<size_t> m_vFrontEnds;
+		size_t m_nMaxRecords;
+		size_t m_nMaxBytes;
+		OVERFLOW_POLICY m_Policy;
+		LOG_LEVEL m_DropLevel;
+		size_t m_nDropped;
+		size_t m_nWakeRecords;
+		size_t m_nWakeBytes;
+		bool m_bParked;
+		bool m_bWake;
+		boost::condition_variable m_WakeCond;
+		boost::condition_variable m_RoomCond;
 	};
 
 	// queued appender, faster than file appender
 	class QueuedFileAppender : public FileAppender
 	{
 	public:
-		static QueuedFileAppenderPtr Create();
+		static QueuedFileAppenderPtr Create(QUEUE_TYPE type = QUEUE_RINGS);
 		~QueuedFileAppender();
 		virtual void Write(const std::string& msg);
+		virtual void Write(const LogRecordPtr& record); // queues the shared record, no copy (the text with the double buffer)
+		virtual bool AcceptsDeferred() const { return !m_DoubleBuffer; }
+		// by default at most 1000000 records or 256MB are queued and producers wait for room
+		void SetQueueCapacity(size_t nMaxRecords, size_t nMaxBytes);
+		void SetOverflowPolicy(OVERFLOW_POLICY policy, LOG_LEVEL dropLevel = LOG_LEVEL_WARN);
+		// the writer wakes up when nRecords or nBytes are queued, and at the latest nMaxLatencyMs after it parked.
+		// by default 4096 records, 1MB or 200ms
+		void SetFlushTrigger(size_t nRecords, size_t nBytes, unsigned nMaxLatencyMs);
+		size_t GetQueueDepth() const; // records (or lines) queued now
 	protected:
-		QueuedFileAppender();
+		explicit QueuedFileAppender(QUEUE_TYPE type);
 	private:
+		void WriteDropReport(size_t nDropped);
+		void Enqueue(const LogRecordPtr& record);
+
 		SafeQueue m_Queue;
-		bool m_bRun;
+		std::vector<LogRecordPtr> m_vBatch;
+		boost::shared_ptr<DoubleBufferQueue> m_DoubleBuffer; // used instead of m_Queue with QUEUE_DOUBLE_BUFFER
+		std::string m_sBackLines;
+		std::vector<size_t> m_vBackEnds;
+		boost::atomic<unsigned> m_nMaxLatencyMs;
+		boost::atomic<bool> m_bRun;
 		boost::shared_ptr<boost::thread> m_ThreadPtr;
 
 		void Sync();
 		void Loop();
 	};
 
+#ifndef WIN32
+	// writes through a shared mapping of the file: a writer reserves its bytes with one atomic add and copies the
+	// line into the mapped window, no syscall and no stream buffer per line. every window is allocated on the disk
+	// (fallocate) before it is mapped, the writer that finds it full maps the next one, and the file is cut to
+	// the written length when it is closed or rolls over. after a crash the kernel still writes the copied lines,
+	// the zeros left after them are cut at the next open. not on windows
+	class MmapFileAppender : public Appender, public FileManager
+	{
+	public:
+		static MmapFileAppenderPtr Create();
+		~MmapFileAppender();
+		using Appender::Write;
+		virtual void Write(const std::string& msg); // thread safe
+		void SetWindowSize(size_t nBytes); // 16MB by default, from the next window on
+	protected:
+		MmapFileAppender();
+	private:
+		MmapFileAppender(const MmapFileAppender&);
+		MmapFileAppender& operator=(const MmapFileAppender&);
+		void WriteSlow(const std::string& msg, unsigned nGeneration); // maps the next window, or the next file
+		void StopWriters(); // waits until no writer is in the window, and updates m_nDataEnd
+		void Reopen(time_t ttNow);
+		bool MapWindow(size_t nMinSize); // at m_nDataEnd
+		void Unmap();
+		void CloseFile();
+		unsigned long long FindDataEnd(); // before the zeros of a crash
+
+		int m_nFile;
+		char* m_pWindow;
+		size_t m_nWindowSize;
+		unsigned long long m_nWindowBase; // file offset of the window, page aligned
+		unsigned long long m_nDataEnd; // file offset, updated when the writers are stopped
+		boost::atomic<size_t> m_nReserved; // bytes of the window handed out, can go past its end
+		boost::atomic<size_t> m_nWindowEnd; // where the line that did not fit starts, the data of the window ends there
+		boost::atomic<int> m_nActive; // writers in the window
+		boost::atomic<bool> m_bStopped; // no writer may enter the window
+		boost::atomic<unsigned> m_nGeneration; // changes with every window
+		size_t m_nNextWindowSize;
+		time_t m_tRollover; // these two are only changed while the writers are stopped
+		unsigned m_nOpenVersion;
+		LogMutex m_Mutex; // the writers that map the next window
+		HousekeeperPtr m_Housekeeper;
+		std::string m_sHeldFile; // the open file, the housekeeper does not touch it
+	};
+#endif
+
+	// turns records into an output format other than the text lines, a FileAppender holds one per file
+	class LogEncoder
+	{
+	public:
+		virtual ~LogEncoder() {}
+		virtual const char* GetFileTag() const = 0; // goes before .log in the file name
+		virtual void Begin(std::string&) {} // appends what starts a file
+		virtual void Encode(const LogRecord& record, std::string& sBuf) = 0; // appends the record
+		virtual void EncodeText(const std::string& sLine, std::string& sBuf) = 0; // a line without a record
+	};
+
+	// compact binary records. a file is a sequence of frames:
+	//   'H' "CPLB" version                 starts a file (again after every reopen), the sites and the time are forgotten
+	//   'S' id file line                   a call site, written once per file before its first record
+	//   'R' time level site message        a record
+	//   'T' text                           a line without a record (drop reports, Write(string))
+	// numbers are LEB128 varints, the line is zigzag encoded; the time is the zigzag delta in nanoseconds to the
+	// record before; the level byte holds the level in its low 4 bits and the time precision in the high ones.
+	// strings are a varint length and the bytes
+	class BinaryLogEncoder : public LogEncoder
+	{
+	public:
+		BinaryLogEncoder();
+		const char* GetFileTag() const { return ".bin"; }
+		void Begin(std::string& sBuf); // appends the file header
+		void Encode(const LogRecord& record, std::string& sBuf); // appends the record, and its site the first time
+		void EncodeText(const std::string& sLine, std::string& sBuf); // a line without a record
+	private:
+		std::map<const LogSite*, unsigned> m_Sites;
+		long long m_nLastTime; // nanoseconds
+		std::string m_sMessage;
+	};
+
+	// json lines, one object per record written straight into the output buffer:
+	//   {"time":"YYYY/MM/DD HH:MM:SS","level":"INFO","msg":"order filled","file":"a.cpp","line":42,"id":7,"px":101.25}
+	// the fields of LOG_*_KV follow the fixed members with their type kept: numbers and booleans bare, the rest
+	// as strings, inf and nan as null. a line without a record is {"msg":"..."}. bytes are escaped as they are,
+	// they are not checked to be utf-8
+	class JsonLogEncoder : public LogEncoder
+	{
+	public:
+		const char* GetFileTag() const { return ".json"; }
+		void Encode(const LogRecord& record, std::string& sBuf);
+		void EncodeText(const std::string& sLine, std::string& sBuf);
+	private:
+		TimeFormatter m_Formatter;
+		std::string m_sMessage; // the message of a deferred record
+	};
+
+	// turns binary records back into the text lines, exactly as the text appenders write them
+	class BinaryLogDecoder
+	{
+	public:
+		BinaryLogDecoder();
+		size_t Decode(const char* pData, size_t nLen, std::string& sOut); // decodes the complete frames, returns the bytes used
+		bool IsCorrupt() const { return m_bCorrupt; } // an unknown frame was found, Decode() stops there
+#ifndef WIN32
+		bool DecodeFile(const std::string& sPath, std::ostream& out); // plain or gzip
+#endif
+	private:
+		int DecodeFrame(const char* pData, size_t nLen, size_t& nPos, std::string& sOut); // 1: done, 0: incomplete, -1: corrupt
+		struct Site
+		{
+			std::string m_sFile;
+			long long m_nLine;
+		};
+		std::map<unsigned long long, Site> m_Sites;
+		long long m_nLastTime;
+		bool m_bCorrupt;
+		TimeFormatter m_Formatter;
+	};
+
 	// utils
-	std::string GetLogTime();
+	std::string GetLogTime(); // current time, second precision
+#ifndef WIN32
+	// compresses sSrc into the gzip file sDst in fixed size chunks, sDst only appears once it is complete
+	bool GzipFile(const std::string& sSrc, const std::string& sDst, int nLevel = 6, IoBudget* pBudget = 0);
+	// same output format, the input is cut in chunks that nThreads deflate at the same time (like pigz).
+	// every chunk is primed with the end of the one before, so the ratio is close to a single stream
+	bool ParallelGzipFile(const std::string& sSrc, const std::string& sDst, unsigned nThreads, int nLevel = 6, IoBudget* pBudget = 0);
+	// same as GzipFile, into the block format of BlockLogWriter
+	bool BlockGzipFile(const std::string& sSrc, const std::string& sDst, IoBudget* pBudget = 0);
+	// "YYYY/MM/DD HH:MM:SS[.fraction]" at the start of a log line, local time
+	bool ParseLogTime(const char* pText, size_t nLen, LogTime& tmLog);
+
+	// one block of a seekable log file
+	struct LogBlockInfo
+	{
+		unsigned long long m_nOffset; // in the file
+		unsigned m_nSize; // compressed, with the gzip header and trailer
+		LogTime m_FirstTime; // of the first line that has a time
+	};
+
+	// seekable compressed log. the file is a plain gzip file (zcat reads it) made of one gzip member per block of
+	// whole lines; the extra field of every member header ("CL") holds its size and the time of its first line.
+	// Close() adds the index of the blocks as empty members ("CI") and a fixed size last member ("CT") that
+	// points at it. a file without them, still written or left by a crash, is indexed from the member headers
+	class BlockLogWriter
+	{
+	public:
+		BlockLogWriter();
+		~BlockLogWriter();
+		bool Open(const std::string& sPath); // a new file
+		void Write(const char* pData, size_t nLen);
+		bool Flush(bool bForce = false); // ends the block if it is 64KB or a second old, or if bForce
+		bool Close(); // ends the block and writes the index
+		void SetBlockSize(size_t nBytes) { m_nBlockSize = nBytes; } // uncompressed, 1MB by default
+	private:
+		BlockLogWriter(const BlockLogWriter&);
+		BlockLogWriter& operator=(const BlockLogWriter&);
+		bool EndBlock(size_t nLen); // compresses the first nLen bytes of m_sBlock as one member
+		bool WriteMember(char cId, const unsigned char* pExtra, size_t nExtra, const unsigned char* pData, size_t nData, unsigned long nCrc, unsigned long nSize);
+		FILE* m_pFile;
+		bool m_bOk;
+		unsigned long long m_nOffset;
+		size_t m_nBlockSize;
+		std::string m_sBlock;
+		time_t m_tBlockStart;
+		LogTime m_LastTime; // for a block without any time
+		std::vector<LogBlockInfo> m_vBlocks;
+		std::vector<unsigned char> m_vBuf;
+	};
+
+	class BlockLogReader
+	{
+	public:
+		BlockLogReader();
+		~BlockLogReader();
+		bool Open(const std::string& sPath); // reads the index, or builds it from the member headers
+		void Close();
+		bool IsIndexed() const { return m_bIndexed; } // the file had its index
+		const std::vector<LogBlockInfo>& GetBlocks() const { return m_vBlocks; }
+		size_t FindBlock(const LogTime& tmLog) const; // the first block that may hold lines from tmLog on
+		bool ReadBlock(size_t nBlock, std::string& sText); // the lines of the block
+		bool ReadRange(const LogTime& tmBegin, const LogTime& tmEnd, std::ostream& out); // the lines with tmBegin <= time < tmEnd
+	private:
+		BlockLogReader(const BlockLogReader&);
+		BlockLogReader& operator=(const BlockLogReader&);
+		bool ReadIndex(unsigned long long nFileSize);
+		void ScanHeaders(unsigned long long nFileSize);
+		bool ParseLineTime(const char* pText, size_t nLen, LogTime& tmLog); // ParseLogTime with the minute cached
+		FILE* m_pFile;
+		bool m_bIndexed;
+		std::vector<LogBlockInfo> m_vBlocks;
+		std::vector<unsigned char> m_vBuf;
+		char m_szMinute[16]; // "YYYY/MM/DD HH:MM" of m_tMinute
+		time_t m_tMinute;
+	};
+#endif
 
 	//
 	const std::string c_LogLevelTag[] = {"DEBUG","INFO","WARN","ERROR","FATAL"};
@@ -166,15 +1075,15 @@ namespace CppLog
 
 #define LOG_CMD(log,event,level) \
 	{\
-		boost::lock_guard<CppLog::LogMutex> lock(log.GetMutex());\
-		if(log.GetLogLevel() >= level)\
-			for(CppLog::AppenderList::iterator it = log.GetAppenderList().begin(); it != log.GetAppenderList().end(); ++it)\
-			{\
-				std::stringstream ssTemp;\
-				ssTemp << CppLog::GetLogTime() << " - " << CppLog::c_LogLevelTag[level] << " - " << event <<\
-					" [ " <<  __FILE__ << " : " << __LINE__ << " ]" << "\n";\
-				(*it)->Write(ssTemp.str());\
-			}\
+		const CppLog::LOG_LEVEL _logLevel = level;\
+		if(log.IsEnabled(_logLevel))\
+		{\
+			static const CppLog::LogSite _logSite = { __FILE__, __LINE__ };\
+			CppLog::LogStream& _logStream = CppLog::LogStream::Begin(log, _logSite, _logLevel);\
+			CppLog::LogStreamGuard _logGuard(_logStream);\
+			_logStream << event;\
+			log.Write(_logGuard.Finish());\
+		}\
 	}
 
 // log macros, it is recommended that you use these macors to write a log message in your code instead of the member functions 
@@ -185,4 +1094,25 @@ namespace CppLog
 #define LOG_INFO(event) LOG_CMD(CppLog::Log::Instance(),event,CppLog::LOG_LEVEL_INFO)
 #define LOG_DEBUG(event) LOG_CMD(CppLog::Log::Instance(),event,CppLog::LOG_LEVEL_DEBUG)
 
+#define LOG_KV_CMD(log,level,...) \
+	{\
+		const CppLog::LOG_LEVEL _logLevel = level;\
+		if(log.IsEnabled(_logLevel))\
+		{\
+			static const CppLog::LogSite _logSite = { __FILE__, __LINE__ };\
+			CppLog::LogStream& _logStream = CppLog::LogStream::Begin(log, _logSite, _logLevel);\
+			CppLog::LogStreamGuard _logGuard(_logStream);\
+			_logStream.Kv(__VA_ARGS__);\
+			log.Write(_logGuard.Finish());\
+		}\
+	}
+
+// structured messages, a message and up to 8 key/value pairs: LOG_INFO_KV("order filled", "id", nId, "px", dPx).
+// the text line reads "order filled id=7 px=101.25", the json output (FileAppender::SetJsonOutput) keeps typed fields
+#define LOG_FATAL_KV(...) LOG_KV_CMD(CppLog::Log::Instance(),CppLog::LOG_LEVEL_FATAL,__VA_ARGS__)
+#define LOG_ERROR_KV(...) LOG_KV_CMD(CppLog::Log::Instance(),CppLog::LOG_LEVEL_ERROR,__VA_ARGS__)
+#define LOG_WARN_KV(...) LOG_KV_CMD(CppLog::Log::Instance(),CppLog::LOG_LEVEL_WARN,__VA_ARGS__)
+#define LOG_INFO_KV(...) LOG_KV_CMD(CppLog::Log::Instance(),CppLog::LOG_LEVEL_INFO,__VA_ARGS__)
+#define LOG_DEBUG_KV(...) LOG_KV_CMD(CppLog::Log::Instance(),CppLog::LOG_LEVEL_DEBUG,__VA_ARGS__)
+
 #endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#include "CppLog.h"
+#include <iostream>
+using namespace std;
+
+using namespace CppLog;
+
+// cpplog-decode: prints binary logs (FileAppender::SetBinaryOutput) as the text lines they stand for
+//   cpplog-decode FILE...                 plain .bin.log or compressed .bin.log.gz files, in the order given
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		cerr << "usage: cpplog-decode FILE..." << endl;
+		return 2;
+	}
+	bool bOk = true;
+	for(int i = 1; i < argc; i++)
+	{
+		BinaryLogDecoder decoder;
+		bOk = decoder.DecodeFile(argv[i], cout) && bOk;
+	}
+	cout.flush();
+	return bOk ? 0 : 1;
+}
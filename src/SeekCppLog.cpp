@@ -0,0 +1,136 @@
+#include "CppLog.h"
+#include <iostream>
+#include <cstdlib>
+#include <boost/filesystem.hpp>
+using namespace std;
+
+using namespace CppLog;
+
+// cpplog-seek: reads time ranges out of the seekable compressed logs (see BlockLogWriter)
+//   cpplog-seek FILE                      lists the blocks of the file
+//   cpplog-seek FILE FROM [TO]            prints the lines from FROM up to TO
+//   cpplog-seek DIR PREFIX FROM [TO]      the same over the files prefix_YYYYMMDD[.N].log.gz of those days
+// times are local, "YYYY/MM/DD[ HH:MM[:SS[.fraction]]]"
+
+void Usage()
+{
+	cerr << "usage: cpplog-seek FILE" << endl;
+	cerr << "       cpplog-seek FILE FROM [TO]" << endl;
+	cerr << "       cpplog-seek DIR PREFIX FROM [TO]" << endl;
+	cerr << "times are local, \"YYYY/MM/DD[ HH:MM[:SS[.fraction]]]\"" << endl;
+}
+
+bool ParseArgTime(const string& sArg, LogTime& tmLog)
+{
+	string sTime = sArg;
+	if(sTime.size() == 10)
+	{
+		sTime += " 00:00";
+	}
+	if(sTime.size() == 16)
+	{
+		sTime += ":00";
+	}
+	if(!ParseLogTime(sTime.data(), sTime.size(), tmLog))
+	{
+		cerr << "bad time: " << sArg << endl;
+		return false;
+	}
+	return true;
+}
+
+void ListBlocks(BlockLogReader& reader)
+{
+	const vector<LogBlockInfo>& vBlocks = reader.GetBlocks();
+	cout << (reader.IsIndexed() ? "indexed" : "no index, read from the block headers") << ", " << vBlocks.size() << " blocks" << endl;
+	TimeFormatter formatter;
+	string sTime;
+	for(size_t i = 0; i < vBlocks.size(); i++)
+	{
+		sTime.clear();
+		formatter.Append(sTime, vBlocks[i].m_FirstTime, TIME_PRECISION_MICRO);
+		cout << i << "\toffset=" << vBlocks[i].m_nOffset << "\tsize=" << vBlocks[i].m_nSize << "\tfirst=" << sTime << endl;
+	}
+}
+
+bool ReadFile(const string& sPath, const LogTime& tmBegin, const LogTime& tmEnd)
+{
+	BlockLogReader reader;
+	if(!reader.Open(sPath))
+	{
+		cerr << "open file failed: " << sPath << endl;
+		return false;
+	}
+	if(reader.GetBlocks().empty())
+	{
+		cerr << "no blocks (not written in the seekable format?): " << sPath << endl;
+		return true;
+	}
+	if(!reader.ReadRange(tmBegin, tmEnd, cout))
+	{
+		cerr << "read failed: " << sPath << endl;
+		return false;
+	}
+	return true;
+}
+
+// the files of every day from tmBegin to tmEnd, in the order they were written
+bool ReadDir(const string& sDir, const string& sPrefix, const LogTime& tmBegin, const LogTime& tmEnd)
+{
+	bool bOk = true;
+	for(time_t tt = tmBegin.m_nSec; tt < tmEnd.m_nSec; tt = FileManager::NextRolloverTime(tt))
+	{
+		tm _tm;
+		localtime_r(&tt, &_tm);
+		char szDay[40]; // room for any int the format could see
+		snprintf(szDay, sizeof(szDay), "%04d%02d%02d", _tm.tm_year + 1900, _tm.tm_mon + 1, _tm.tm_mday);
+		string sStem = sDir + "/" + sPrefix + "_" + szDay;
+		string sPath = sStem + ".log.gz";
+		for(int i = 1; boost::filesystem::exists(sPath); i++)
+		{
+			bOk = ReadFile(sPath, tmBegin, tmEnd) && bOk;
+			char szIndex[16];
+			snprintf(szIndex, sizeof(szIndex), ".%d", i);
+			sPath = sStem + szIndex + ".log.gz";
+		}
+	}
+	return bOk;
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		Usage();
+		return 2;
+	}
+	bool bDir = boost::filesystem::is_directory(argv[1]);
+	int nTimeArg = bDir ? 3 : 2;
+	if((bDir && argc < 4) || argc > nTimeArg + 2)
+	{
+		Usage();
+		return 2;
+	}
+
+	if(!bDir && argc == 2)
+	{
+		BlockLogReader reader;
+		if(!reader.Open(argv[1]))
+		{
+			cerr << "open file failed: " << argv[1] << endl;
+			return 1;
+		}
+		ListBlocks(reader);
+		return 0;
+	}
+
+	LogTime tmBegin;
+	LogTime tmEnd = GetCurrentLogTime();
+	tmEnd.m_nSec += 24 * 3600; // no end: up to what is written now
+	if(!ParseArgTime(argv[nTimeArg], tmBegin) || (argc > nTimeArg + 1 && !ParseArgTime(argv[nTimeArg + 1], tmEnd)))
+	{
+		return 2;
+	}
+	bool bOk = bDir ? ReadDir(argv[1], argv[2], tmBegin, tmEnd) : ReadFile(argv[1], tmBegin, tmEnd);
+	return bOk ? 0 : 1;
+}
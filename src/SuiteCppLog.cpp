@@ -0,0 +1,289 @@
+#include "CppLog.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/barrier.hpp>
+using namespace std;
+
+using namespace CppLog;
+
+// cpplog-bench: throughput and caller latency of the appenders, one json object per run on stdout
+//   cpplog-bench [MESSAGES [MAX_THREADS]]   MESSAGES per run, shared by the threads (default 100000);
+//                                          threads 1, 2, 4, ... up to MAX_THREADS (default 64)
+// every appender runs with small, medium and large messages, with a disabled level, and the file appenders
+// also with a reopen every 10ms as at a rollover. the files go to ./bench_suite_log and are removed after
+// every run; the console appender writes to a file there (stdout carries the results)
+
+typedef boost::chrono::steady_clock SuiteClock;
+
+enum APPENDER_TYPE
+{
+	APPENDER_FILE,
+	APPENDER_QUEUED,
+	APPENDER_CONSOLE
+};
+const char* c_AppenderName[] = {"file", "queued", "console"};
+
+struct RunConfig
+{
+	APPENDER_TYPE m_Appender;
+	int m_nThreads;
+	size_t m_nMsgBytes;
+	bool m_bEnabled;
+	bool m_bRollover;
+	long m_nMessages;
+};
+
+struct RunResult
+{
+	double m_dElapsedNs; // first call to last call, all threads
+	double m_dDrainNs; // until the appender has written everything and is gone
+	unsigned long long m_nP50;
+	unsigned long long m_nP99;
+	unsigned long long m_nP999;
+	unsigned long long m_nMax;
+	long m_nReopens; // requested while the producers ran
+};
+
+const char* c_sDir = "bench_suite_log";
+
+double NanosSince(SuiteClock::time_point tStart)
+{
+	return boost::chrono::duration<double, boost::nano>(SuiteClock::now() - tStart).count();
+}
+
+// what one producer thread measured
+struct ThreadSlot
+{
+	vector<unsigned> m_vLatencies; // ns, one per call
+	SuiteClock::time_point m_tBegin;
+	SuiteClock::time_point m_tEnd;
+};
+
+// every call timed on its own
+void Producer(const RunConfig& config, const string& sPayload, long nCalls, ThreadSlot* pSlot, boost::barrier* pStart)
+{
+	vector<unsigned>& vLatencies = pSlot->m_vLatencies;
+	vLatencies.resize(nCalls);
+	pStart->wait();
+	pSlot->m_tBegin = SuiteClock::now();
+	for(long i = 0; i < nCalls; i++)
+	{
+		SuiteClock::time_point t0 = SuiteClock::now();
+		if(config.m_bEnabled)
+		{
+			LOG_INFO("bench " << i << " " << sPayload);
+		}
+		else
+		{
+			LOG_DEBUG("bench " << i << " " << sPayload);
+		}
+		vLatencies[i] = (unsigned)min(NanosSince(t0), 4e9);
+	}
+	pSlot->m_tEnd = SuiteClock::now();
+}
+
+void Reopener(FileAppenderPtr appender, boost::atomic<bool>* pRun, long* pReopens)
+{
+	while(pRun->load())
+	{
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		if(pRun->load())
+		{
+			appender->RequestReopen();
+			(*pReopens)++;
+		}
+	}
+}
+
+unsigned long long Percentile(const vector<unsigned>& vSorted, double dFraction)
+{
+	if(vSorted.empty())
+	{
+		return 0;
+	}
+	size_t nIndex = min(vSorted.size() - 1, (size_t)(dFraction * vSorted.size()));
+	return vSorted[nIndex];
+}
+
+RunResult Run(const RunConfig& config)
+{
+	RunResult result;
+	result.m_nReopens = 0;
+	string sPrefix = string("suite_") + c_AppenderName[config.m_Appender];
+	FileAppenderPtr fileAppender;
+	AppenderPtr appender;
+	if(config.m_Appender == APPENDER_QUEUED)
+	{
+		fileAppender = QueuedFileAppender::Create();
+	}
+	else if(config.m_Appender == APPENDER_FILE)
+	{
+		fileAppender = FileAppender::Create();
+	}
+	if(fileAppender)
+	{
+		fileAppender->SetDir(c_sDir);
+		fileAppender->SetPrefixName(sPrefix);
+		fileAppender->SetCompress(false);
+		appender = fileAppender;
+	}
+	else
+	{
+		appender = ConsoleAppender::Create();
+	}
+	Log::Instance().AddAppender(appender);
+
+	// "bench N " and the payload make up about the message size
+	string sPayload(config.m_nMsgBytes > 16 ? config.m_nMsgBytes - 16 : 1, 'x');
+	vector<ThreadSlot> vSlots(config.m_nThreads);
+	long nCallsPerThread = max(1L, config.m_nMessages / config.m_nThreads);
+	boost::barrier start(config.m_nThreads + 1);
+	boost::thread_group threads;
+	for(int i = 0; i < config.m_nThreads; i++)
+	{
+		threads.create_thread(boost::bind(Producer, boost::cref(config), boost::cref(sPayload), nCallsPerThread, &vSlots[i], &start));
+	}
+	boost::atomic<bool> bReopen(true);
+	boost::shared_ptr<boost::thread> reopener;
+	if(config.m_bRollover && fileAppender)
+	{
+		reopener.reset(new boost::thread(boost::bind(Reopener, fileAppender, &bReopen, &result.m_nReopens)));
+	}
+	start.wait();
+	threads.join_all();
+	bReopen = false;
+	if(reopener)
+	{
+		reopener->join();
+	}
+
+	// the queued appender writes the rest in its destructor
+	SuiteClock::time_point tDrain = SuiteClock::now();
+	Log::Instance().ClearAppenders();
+	fileAppender.reset();
+	appender.reset();
+	result.m_dDrainNs = NanosSince(tDrain);
+
+	// from the first call of any thread to the last one
+	SuiteClock::time_point tBegin = vSlots[0].m_tBegin;
+	SuiteClock::time_point tEnd = vSlots[0].m_tEnd;
+	vector<unsigned> vAll;
+	vAll.reserve(nCallsPerThread * config.m_nThreads);
+	for(size_t i = 0; i < vSlots.size(); i++)
+	{
+		tBegin = min(tBegin, vSlots[i].m_tBegin);
+		tEnd = max(tEnd, vSlots[i].m_tEnd);
+		vAll.insert(vAll.end(), vSlots[i].m_vLatencies.begin(), vSlots[i].m_vLatencies.end());
+	}
+	result.m_dElapsedNs = boost::chrono::duration<double, boost::nano>(tEnd - tBegin).count();
+	sort(vAll.begin(), vAll.end());
+	result.m_nP50 = Percentile(vAll, 0.50);
+	result.m_nP99 = Percentile(vAll, 0.99);
+	result.m_nP999 = Percentile(vAll, 0.999);
+	result.m_nMax = vAll.empty() ? 0 : vAll.back();
+
+	for(boost::filesystem::directory_iterator it(c_sDir); it != boost::filesystem::directory_iterator(); ++it)
+	{
+		if(it->path().filename().string().compare(0, sPrefix.size(), sPrefix) == 0)
+		{
+			boost::filesystem::remove(it->path());
+		}
+	}
+	return result;
+}
+
+void Report(const RunConfig& config, const RunResult& result)
+{
+	long nMessages = max(1L, config.m_nMessages / config.m_nThreads) * config.m_nThreads;
+	cout << "{\"appender\":\"" << c_AppenderName[config.m_Appender] << "\""
+		<< ",\"threads\":" << config.m_nThreads
+		<< ",\"msg_bytes\":" << config.m_nMsgBytes
+		<< ",\"level\":\"" << (config.m_bEnabled ? "enabled" : "disabled") << "\""
+		<< ",\"rollover\":" << (config.m_bRollover ? "true" : "false")
+		<< ",\"messages\":" << nMessages
+		<< ",\"msgs_per_s\":" << (long long)(nMessages / (result.m_dElapsedNs / 1e9))
+		<< ",\"p50_ns\":" << result.m_nP50
+		<< ",\"p99_ns\":" << result.m_nP99
+		<< ",\"p999_ns\":" << result.m_nP999
+		<< ",\"max_ns\":" << result.m_nMax
+		<< ",\"drain_ns\":" << (long long)result.m_dDrainNs
+		<< ",\"reopen_requests\":" << result.m_nReopens
+		<< "}" << endl;
+}
+
+// the console appender writes to cout, which is sent to a file for the run
+void RunAndReport(const RunConfig& config, ofstream& consoleOut)
+{
+	streambuf* pStdout = 0;
+	if(config.m_Appender == APPENDER_CONSOLE)
+	{
+		pStdout = cout.rdbuf(consoleOut.rdbuf());
+	}
+	RunResult result = Run(config);
+	if(pStdout)
+	{
+		cout.rdbuf(pStdout);
+	}
+	Report(config, result);
+}
+
+int main(int argc, char* argv[])
+{
+	long nMessages = (argc > 1) ? atol(argv[1]) : 100000;
+	int nMaxThreads = (argc > 2) ? atoi(argv[2]) : 64;
+	if(nMessages <= 0 || nMaxThreads <= 0)
+	{
+		cerr << "usage: cpplog-bench [MESSAGES [MAX_THREADS]]" << endl;
+		return 2;
+	}
+	boost::filesystem::create_directories(c_sDir);
+	ofstream consoleOut((string(c_sDir) + "/console.out").c_str());
+	Log::Instance().SetLogLevel(LOG_LEVEL_INFO); // LOG_DEBUG is the disabled level
+
+	// what timing a call costs by itself, it is part of every latency
+	vector<double> vClock(10000);
+	for(size_t i = 0; i < vClock.size(); i++)
+	{
+		SuiteClock::time_point t0 = SuiteClock::now();
+		vClock[i] = NanosSince(t0);
+	}
+	sort(vClock.begin(), vClock.end());
+	cout << "{\"suite\":\"cpplog-bench\",\"cores\":" << boost::thread::hardware_concurrency()
+		<< ",\"clock_overhead_ns\":" << (long long)vClock[vClock.size() / 2] << "}" << endl;
+
+	const size_t c_MsgBytes[] = {16, 128, 1024};
+	for(int nAppender = APPENDER_FILE; nAppender <= APPENDER_CONSOLE; nAppender++)
+	{
+		for(int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2)
+		{
+			RunConfig config;
+			config.m_Appender = static_cast<APPENDER_TYPE>(nAppender);
+			config.m_nThreads = nThreads;
+			config.m_nMessages = nMessages;
+			config.m_bEnabled = true;
+			config.m_bRollover = false;
+			for(size_t i = 0; i < sizeof(c_MsgBytes) / sizeof(c_MsgBytes[0]); i++)
+			{
+				config.m_nMsgBytes = c_MsgBytes[i];
+				RunAndReport(config, consoleOut);
+			}
+			config.m_nMsgBytes = 128;
+			config.m_bEnabled = false;
+			RunAndReport(config, consoleOut);
+			if(config.m_Appender != APPENDER_CONSOLE)
+			{
+				config.m_bEnabled = true;
+				config.m_bRollover = true;
+				RunAndReport(config, consoleOut);
+			}
+		}
+	}
+	consoleOut.close();
+	boost::filesystem::remove(string(c_sDir) + "/console.out");
+	return 0;
+}